@@ -0,0 +1,49 @@
+#pragma once
+
+// Martin Flaska - flegy@flegy.sk / https://www.linkedin.com/in/martinflaska
+
+#include <memory>
+#include <memory_resource>
+
+
+/** Memory resource a Storyboard allocates its strings, notes and indexes from */
+enum class ArenaKind {
+	None,      ///< default resource (global heap)
+	Monotonic, ///< bump allocation, freed memory is reclaimed only when the board goes away
+	Pool       ///< per size class pools, freed blocks are reused
+};
+
+/** Owning handle of a board arena
+ *
+ * The arena is released in one go (bulk teardown) when the board and all its copies made
+ * before the board was destroyed are gone. Arenas are not thread safe, like the board itself.
+ *
+ * @note std::pmr containers keep their memory resource on assignment, so does the handle:
+ *       assigning a board to another one leaves the target's arena in place.
+ */
+class Arena
+{
+public:
+	Arena() = default;
+	explicit Arena(ArenaKind kind)
+	{
+		if (kind == ArenaKind::Monotonic) {
+			m_resource = std::make_shared<std::pmr::monotonic_buffer_resource>();
+		} else if (kind == ArenaKind::Pool) {
+			m_resource = std::make_shared<std::pmr::unsynchronized_pool_resource>();
+		}
+	}
+	Arena(const Arena &) = default;
+	Arena(Arena &&) = default;
+	Arena &operator=(const Arena &) { return *this; }
+	Arena &operator=(Arena &&) { return *this; }
+
+	/** The arena or the default resource if there is none */
+	std::pmr::memory_resource *resource() const
+	{
+		return m_resource ? m_resource.get() : std::pmr::get_default_resource();
+	}
+
+private:
+	std::shared_ptr<std::pmr::memory_resource> m_resource;
+};
@@ -0,0 +1,790 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ConcurrentStoryboard.h"
+#include "DurableStoryboard.h"
+#include "MappedStoryboard.h"
+#include "PostingAlgebra.h"
+#include "ShardedStoryboard.h"
+#include "Storyboard.h"
+
+using namespace std;
+
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+/** Average time (us) of @f over @rounds runs */
+template<typename F>
+double measure(int rounds, F f)
+{
+	auto start = Clock::now();
+	for (int i = 0; i < rounds; i++) {
+		f();
+	}
+	std::chrono::duration<double, std::micro> d = Clock::now() - start;
+	return d.count() / rounds;
+}
+
+/** @n sorted unique ids out of [0, @universe) */
+std::vector<NoteId> randomList(size_t n, NoteId universe, std::mt19937 &rng)
+{
+	std::vector<NoteId> v;
+	std::uniform_int_distribution<NoteId> dist(0, universe - 1);
+	v.reserve(n);
+	for (size_t i = 0; i < n; i++) {
+		v.push_back(dist(rng));
+	}
+	std::sort(v.begin(), v.end());
+	v.erase(std::unique(v.begin(), v.end()), v.end());
+	return v;
+}
+
+void benchKernels()
+{
+	using namespace PostingAlgebra;
+
+	std::mt19937 rng(42);
+	struct Case { size_t na, nb; NoteId universe; };
+	const Case cases[] = {
+		{100000, 100000, 1000000},
+		{100000, 100000, 200000},
+		{1000, 1000000, 4000000},
+	};
+	const Kernel kernels[] = {Kernel::Scalar, Kernel::Sse, Kernel::Avx2};
+
+	std::cout << "# set algebra kernels (us per operation)" << std::endl;
+	for (auto const &c : cases) {
+		auto a = randomList(c.na, c.universe, rng);
+		auto b = randomList(c.nb, c.universe, rng);
+		std::cout << "lists " << a.size() << " x " << b.size() << " of " << c.universe << std::endl;
+		for (auto k : kernels) {
+			if (!isSupported(k)) {
+				continue;
+			}
+			std::vector<NoteId> out;
+			auto tAnd = measure(20, [&]() { out.clear(); intersect(a, b, out, k); });
+			auto tOr = measure(20, [&]() { out.clear(); unite(a, b, out, k); });
+			auto tNot = measure(20, [&]() { out.clear(); subtract(a, b, out, k); });
+			std::cout << "\t" << kernelName(k)
+				<< "\tAND " << tAnd << "\tOR " << tOr << "\tAND-NOT " << tNot << std::endl;
+		}
+	}
+}
+
+void benchBoardTagQueries()
+{
+	std::mt19937 rng(7);
+	const int noteCount = 200000;
+	const int tagCount = 50;
+	std::uniform_int_distribution<int> tagDist(0, tagCount - 1);
+
+	Storyboard sb;
+	for (int i = 0; i < noteCount; i++) {
+		sb.addNote({"Note " + std::to_string(i), "desc " + std::to_string(i),
+			{"t" + std::to_string(tagDist(rng)), "t" + std::to_string(tagDist(rng))}});
+	}
+	std::set<std::string> tags = {"t1", "t2", "t3"};
+
+	std::cout << "# board tag queries, " << noteCount << " notes (us per query)" << std::endl;
+
+	// What searchByTag(set) used to do: copy notes of every tag into a std::set
+	auto tSet = measure(3, [&]() {
+		Storyboard::NoteSet s;
+		for (auto const &tag : tags) {
+			for (auto const &n : sb.searchByTag(tag)) {
+				s.insert(n.toNote());
+			}
+		}
+	});
+	auto tOr = measure(20, [&]() { sb.searchByTag(tags); });
+	Storyboard::TagQuery qAnd;
+	qAnd.allOf = {"t1", "t2"};
+	auto tAnd = measure(20, [&]() { sb.searchByTags(qAnd); });
+	Storyboard::TagQuery qNot;
+	qNot.anyOf = tags;
+	qNot.noneOf = {"t4"};
+	auto tNot = measure(20, [&]() { sb.searchByTags(qNot); });
+
+	std::cout << "\tmerge into std::set<Note> " << tSet << std::endl
+		<< "\tOR (posting union) " << tOr << std::endl
+		<< "\tAND " << tAnd << std::endl
+		<< "\tOR AND-NOT " << tNot << std::endl;
+}
+
+void benchBulkLoad()
+{
+	std::mt19937 rng(3);
+	const int noteCount = 300000;
+	std::uniform_int_distribution<int> tagDist(0, 999);
+	std::vector<Note> notes;
+	notes.reserve(noteCount);
+	for (int i = 0; i < noteCount; i++) {
+		notes.push_back({"Note " + std::to_string(i), "Some longer description of the note number " + std::to_string(i),
+			{"t" + std::to_string(tagDist(rng)), "t" + std::to_string(tagDist(rng)), "t" + std::to_string(tagDist(rng))}});
+	}
+
+	std::cout << "# loading " << noteCount << " notes (ms)" << std::endl;
+	auto perNote = measure(1, [&]() {
+		Storyboard sb;
+		for (auto const &n : notes) {
+			sb.addNote(n);
+		}
+	});
+	auto bulk = measure(1, [&]() { Storyboard sb; sb.addNotes(notes); });
+	auto threads = std::max(2u, std::thread::hardware_concurrency());
+	auto parallel = measure(1, [&]() { Storyboard sb; sb.addNotes(notes, threads); });
+	std::cout << "\taddNote " << perNote / 1000 << std::endl
+		<< "\taddNotes " << bulk / 1000 << std::endl
+		<< "\taddNotes (" << threads << " threads) " << parallel / 1000 << std::endl;
+}
+
+void benchConcurrentReads()
+{
+	ConcurrentStoryboard sb;
+	std::vector<Note> notes;
+	for (int i = 0; i < 100000; i++) {
+		notes.push_back({"Note " + std::to_string(i), "desc " + std::to_string(i), {"t" + std::to_string(i % 100)}});
+	}
+	sb.addNotes(notes);
+
+	std::cout << "# concurrent reads, 95% reads / 5% writes (ops per second)" << std::endl;
+	for (unsigned threads = 1; threads <= std::max(1u, std::thread::hardware_concurrency()); threads *= 2) {
+		const int opsPerThread = 20000;
+		auto t = measure(1, [&]() {
+			std::vector<std::thread> workers;
+			for (unsigned w = 0; w < threads; w++) {
+				workers.emplace_back([&sb, w]() {
+					for (int i = 0; i < opsPerThread; i++) {
+						if (i % 20 == 0) {
+							sb.addNote({"New " + std::to_string(w) + "/" + std::to_string(i), "desc", {"new"}});
+						} else {
+							sb.read([i](const Storyboard &board) { return board.searchByTag("t" + std::to_string(i % 100)).size(); });
+						}
+					}
+				});
+			}
+			for (auto &w : workers) {
+				w.join();
+			}
+		});
+		std::cout << "\t" << threads << " threads " << threads * opsPerThread / (t / 1e6) << std::endl;
+	}
+}
+
+void benchShardedQueries()
+{
+	std::mt19937 rng(11);
+	std::uniform_int_distribution<int> tagDist(0, 49);
+	std::vector<Note> notes;
+	for (int i = 0; i < 200000; i++) {
+		notes.push_back({"Note " + std::to_string(i), "desc " + std::to_string(i),
+			{"t" + std::to_string(tagDist(rng)), "t" + std::to_string(tagDist(rng))}});
+	}
+	Storyboard single;
+	single.addNotes(notes);
+
+	std::cout << "# sharded tag queries, " << notes.size() << " notes (us per query)" << std::endl;
+	std::cout << "\t1 board " << measure(20, [&]() { single.searchByTag("t1").toNoteSet(); }) << std::endl;
+	for (unsigned shards = 2; shards <= std::max(2u, std::thread::hardware_concurrency()); shards *= 2) {
+		ShardedStoryboard sb(shards);
+		sb.addNotes(notes);
+		std::cout << "\t" << shards << " shards " << measure(20, [&]() { sb.searchByTag("t1"); }) << std::endl;
+	}
+}
+
+void benchSnapshot()
+{
+	const std::string path = "/tmp/storyboard_bench.snapshot";
+	std::vector<Note> notes;
+	for (int i = 0; i < 300000; i++) {
+		notes.push_back({"Note " + std::to_string(i), "Some longer description of the note number " + std::to_string(i),
+			{"t" + std::to_string(i % 1000), "t" + std::to_string(i % 777)}});
+	}
+	Storyboard sb;
+	sb.addNotes(notes);
+
+	std::cout << "# snapshot of " << notes.size() << " notes (ms)" << std::endl;
+	auto save = measure(1, [&]() { MappedStoryboard::save(sb, path); });
+	auto rebuild = measure(1, [&]() { Storyboard b; b.addNotes(notes); });
+	size_t found = 0;
+	auto open = measure(1, [&]() { MappedStoryboard m(path); found = m.searchByTag("t1").size(); });
+	std::cout << "\tsave " << save / 1000 << std::endl
+		<< "\trebuild with addNotes " << rebuild / 1000 << std::endl
+		<< "\tmap + first query " << open / 1000 << " (" << found << " notes)" << std::endl;
+	std::remove(path.c_str());
+}
+
+void benchDurableWrites()
+{
+	const std::string dir = "/tmp/storyboard_bench.durable";
+	std::cout << "# durable writes (notes per second)" << std::endl;
+	for (bool sync : {false, true}) {
+		for (unsigned threads : {1u, 16u}) {
+			std::system(("rm -rf " + dir).c_str());
+			DurableStoryboard::Options options;
+			options.syncWrites = sync;
+			DurableStoryboard sb(dir, options);
+			const int perThread = sync && threads == 1 ? 200 : 20000 / threads;
+			auto t = measure(1, [&]() {
+				std::vector<std::thread> workers;
+				for (unsigned w = 0; w < threads; w++) {
+					workers.emplace_back([&sb, w, perThread]() {
+						for (int i = 0; i < perThread; i++) {
+							sb.addNote({"Note " + std::to_string(w) + "/" + std::to_string(i), "desc", {"t"}});
+						}
+					});
+				}
+				for (auto &w : workers) {
+					w.join();
+				}
+				sb.sync();
+			});
+			std::cout << "\t" << (sync ? "sync " : "async ") << threads << " threads "
+				<< threads * perThread / (t / 1e6) << std::endl;
+		}
+	}
+	std::system(("rm -rf " + dir).c_str());
+}
+
+/** Current resident set size (kB) */
+long residentKb()
+{
+	long pages = 0, resident = 0;
+	std::ifstream("/proc/self/statm") >> pages >> resident;
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+void benchArenas()
+{
+	const int noteCount = 300000;
+	std::cout << "# arenas, " << noteCount << " addNote + 1/3 deleted (ms, RSS growth kB)" << std::endl;
+	const ArenaKind arenas[] = {ArenaKind::None, ArenaKind::Monotonic, ArenaKind::Pool};
+	const char *names[] = {"heap", "monotonic", "pool"};
+	for (int a = 0; a < 3; a++) {
+		// Every case in a fresh process, so the heap of the previous one does not skew RSS
+		std::cout.flush();
+		auto pid = fork();
+		if (pid == 0) {
+			std::mt19937 rng(5);
+			std::uniform_int_distribution<int> tagDist(0, 999);
+			std::vector<Note> notes;
+			for (int i = 0; i < noteCount; i++) {
+				notes.push_back({"Note " + std::to_string(i), "Some longer description of the note number " + std::to_string(i),
+					{"t" + std::to_string(tagDist(rng)), "t" + std::to_string(tagDist(rng))}});
+			}
+			auto before = residentKb();
+			Storyboard::Options options;
+			options.arena = arenas[a];
+			auto sb = new Storyboard(options);
+			auto insert = measure(1, [&]() {
+				for (auto const &n : notes) {
+					sb->addNote(n);
+				}
+				for (int i = 0; i < noteCount; i += 3) {
+					sb->deleteNote(notes[i]);
+				}
+			});
+			auto rss = residentKb() - before;
+			auto teardown = measure(1, [&]() { delete sb; });
+			std::cout << "\t" << names[a] << "\tinsert " << insert / 1000 << "\tRSS +" << rss
+				<< "\tteardown " << teardown / 1000 << std::endl;
+			std::cout.flush();
+			_exit(0);
+		}
+		waitpid(pid, nullptr, 0);
+	}
+}
+
+void benchKeyTries()
+{
+	std::vector<Note> notes;
+	for (int i = 0; i < 200000; i++) {
+		notes.push_back({"Note " + std::to_string(i), "desc", {"tag" + std::to_string(i % 5000)}});
+	}
+	Storyboard::Options options;
+	options.keyTries = true;
+	Storyboard sb(options);
+	sb.addNotes(notes);
+
+	std::cout << "# autocomplete over " << notes.size() << " titles (us)" << std::endl;
+	auto trie = measure(20, [&]() { sb.titleKeys().withPrefix("Note 1234", 10); });
+	auto top = measure(20, [&]() { sb.tagKeys().top(10, "tag1"); });
+	auto scan = measure(3, [&]() {
+		std::set<std::string> found;
+		for (auto const &n : sb.notes()) {
+			if (n.title.compare(0, 9, "Note 1234") == 0) {
+				found.insert(n.title);
+			}
+		}
+	});
+	std::cout << "\tprefix, 10 keys: trie " << trie << "\tscan " << scan << std::endl
+		<< "\ttop 10 tags by count " << top << std::endl;
+}
+
+void benchPagedSearch()
+{
+	Storyboard sb;
+	std::vector<Note> notes;
+	for (int i = 0; i < 200000; i++) {
+		notes.push_back({"Note " + std::to_string(i), "desc", {"common", "t" + std::to_string(i % 100)}});
+	}
+	sb.addNotes(notes);
+
+	std::cout << "# first 50 of " << sb.searchByTag("common").size() << " notes of a tag (us)" << std::endl;
+	auto page = measure(20, [&]() {
+		Storyboard::Cursor cursor;
+		for (auto n : sb.searchByTag("common", 50, cursor)) {
+			n.title();
+		}
+	});
+	auto resume = measure(20, [&]() {
+		Storyboard::Cursor cursor{150000};
+		sb.searchByTag("common", 50, cursor);
+	});
+	auto full = measure(3, [&]() { sb.searchByTag("common").toNoteSet(); });
+	std::cout << "\tpage " << page << "\tresume deep " << resume << "\twhole NoteSet " << full << std::endl;
+}
+
+void benchChangeFeed()
+{
+	const int noteCount = 100000;
+	std::vector<Note> notes;
+	for (int i = 0; i < noteCount; i++) {
+		notes.push_back({"Note " + std::to_string(i), "desc", {"t" + std::to_string(i % 4)}});
+	}
+	std::cout << "# addNote with change feed subscribers (us per note)" << std::endl;
+	for (int subscribers : {0, 1, 4}) {
+		Storyboard sb;
+		std::vector<ChangeFeed::Subscription> subs;
+		for (int s = 0; s < subscribers; s++) {
+			// one of the 4 tags each, every event is delivered once in total with 4 of them
+			subs.push_back(subscribers == 1 ? sb.subscribe({}, noteCount) : sb.subscribe({"t" + std::to_string(s)}, noteCount));
+		}
+		auto t = measure(1, [&]() {
+			for (auto const &n : notes) {
+				sb.addNote(n);
+			}
+		});
+		std::cout << "\t" << subscribers << " subscribers " << t / noteCount << std::endl;
+	}
+}
+
+void benchResultCache()
+{
+	std::vector<Note> notes;
+	for (int i = 0; i < 100000; i++) {
+		notes.push_back({"Note " + std::to_string(i), "desc", {"t" + std::to_string(i % 1000)}});
+	}
+	// skewed traffic: tag rank r is queried with probability ~ 1 / r
+	std::vector<double> weights;
+	for (int r = 1; r <= 1000; r++) {
+		weights.push_back(1.0 / r);
+	}
+	std::mt19937 rng(1);
+	std::discrete_distribution<int> zipf(weights.begin(), weights.end());
+	std::vector<std::string> queries;
+	for (int i = 0; i < 20000; i++) {
+		queries.push_back("t" + std::to_string(zipf(rng)));
+	}
+
+	std::cout << "# " << queries.size() << " skewed notesByTag queries, 1 write per 100 (us per query)" << std::endl;
+	for (size_t capacity : {0, 100}) {
+		Storyboard::Options options;
+		options.resultCache = capacity;
+		Storyboard sb(options);
+		sb.addNotes(notes);
+		size_t i = 0;
+		auto t = measure(1, [&]() {
+			for (auto const &q : queries) {
+				sb.notesByTag(q);
+				if (++i % 100 == 0) {
+					sb.addNote({"New " + std::to_string(i), "desc", {queries[i / 2]}});
+				}
+			}
+		});
+		auto stats = sb.cacheStats();
+		std::cout << "\tcache " << capacity << "\t" << t / queries.size() << "\thits " << stats.hits
+			<< " misses " << stats.misses << std::endl;
+	}
+}
+
+void benchMetrics()
+{
+	const int rounds = 1000000;
+	Metrics metrics;
+	auto timer = measure(1, [&]() {
+		for (int i = 0; i < rounds; i++) {
+			Metrics::Timer t(metrics, Metrics::SearchByTag);
+		}
+	});
+	Storyboard sb;
+	for (int i = 0; i < 100000; i++) {
+		sb.addNote({"Note " + std::to_string(i), "desc", {"t" + std::to_string(i % 1000)}});
+	}
+	auto stats = measure(3, [&]() { sb.stats(); });
+	std::cout << "# metrics" << std::endl
+		<< "\ttimer (record one latency) " << timer * 1000 / rounds << " ns" << std::endl
+		<< "\tstats() of 100000 notes " << stats / 1000 << " ms" << std::endl;
+}
+
+void benchDuplicateCheck()
+{
+	const int noteCount = 50000;
+	std::cout << "# addNote of " << noteCount << " notes sharing a title, by text length (us per note)" << std::endl;
+	for (size_t length : {16, 256, 4096}) {
+		std::vector<Note> notes;
+		for (int i = 0; i < noteCount; i++) {
+			auto text = std::to_string(i) + " ";
+			text.resize(length, 'x');
+			notes.push_back({"Same title", text, {"t" + std::to_string(i % 10)}});
+		}
+		Storyboard sb;
+		auto add = measure(1, [&]() {
+			for (auto const &n : notes) {
+				sb.addNote(n);
+			}
+		});
+		auto duplicate = measure(1, [&]() {
+			for (auto const &n : notes) {
+				sb.addNote(n);
+			}
+		});
+		std::cout << "\ttext " << length << "\tnew " << add / noteCount << "\tduplicate " << duplicate / noteCount << std::endl;
+	}
+}
+
+/** Latency samples of one operation */
+class Latencies
+{
+public:
+	template<typename F>
+	void time(F f)
+	{
+		auto start = Clock::now();
+		f();
+		m_samples.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+	}
+
+	size_t count() const { return m_samples.size(); }
+	/** Total time (us) */
+	double total() const
+	{
+		double t = 0;
+		for (auto s : m_samples) {
+			t += s;
+		}
+		return t;
+	}
+	/** @p-th percentile (us), @p in [0, 1] */
+	double percentile(double p)
+	{
+		if (m_samples.empty()) {
+			return 0;
+		}
+		auto nth = m_samples.begin() + static_cast<size_t>(p * (m_samples.size() - 1));
+		std::nth_element(m_samples.begin(), nth, m_samples.end());
+		return *nth;
+	}
+
+private:
+	std::vector<double> m_samples;
+};
+
+/** Ranks [0, n) with P(rank r) ~ 1 / (r + 1)^s */
+class Zipf
+{
+public:
+	Zipf(size_t n, double s)
+	{
+		std::vector<double> weights(n);
+		for (size_t r = 0; r < n; r++) {
+			weights[r] = 1.0 / std::pow(r + 1.0, s);
+		}
+		m_dist = std::discrete_distribution<size_t>(weights.begin(), weights.end());
+	}
+	size_t operator()(std::mt19937 &rng) { return m_dist(rng); }
+
+private:
+	std::discrete_distribution<size_t> m_dist;
+};
+
+/** Peak resident set size of the process (kB) */
+long peakRss()
+{
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+/** Peak RSS when the measured structure started to be built (after the input was generated) */
+long rssBaseline = 0;
+
+struct SuiteResult
+{
+	size_t scale;
+	std::string op;
+	size_t count;
+	double throughput; ///< ops per second
+	double p50;        ///< us
+	double p99;        ///< us
+	long rssGrowth;    ///< kB, peak RSS over rssBaseline (i.e. without the benchmark input)
+};
+
+SuiteResult summarize(size_t scale, const std::string &op, Latencies &l)
+{
+	return {scale, op, l.count(), l.count() / (l.total() / 1e6), l.percentile(0.5), l.percentile(0.99), peakRss() - rssBaseline};
+}
+
+void writeJson(std::ostream &os, const std::vector<SuiteResult> &results)
+{
+	os << "{\"project\": \"assignment01\", \"results\": [";
+	for (size_t i = 0; i < results.size(); i++) {
+		auto const &r = results[i];
+		os << (i ? "," : "") << "\n\t{\"scale\": " << r.scale << ", \"op\": \"" << r.op << "\", \"count\": " << r.count
+			<< ", \"throughput\": " << r.throughput << ", \"p50_us\": " << r.p50 << ", \"p99_us\": " << r.p99
+			<< ", \"rss_growth_kb\": " << r.rssGrowth << "}";
+	}
+	os << "\n]}" << std::endl;
+}
+
+/** Insert, query and delete @scale synthetic notes (Zipfian titles and tags) */
+void runSuite(size_t scale, std::vector<SuiteResult> &results)
+{
+	std::mt19937 rng(42);
+	const size_t titleCount = std::max<size_t>(1, scale / 4);
+	const size_t tagCount = std::max<size_t>(100, scale / 100);
+	Zipf titleDist(titleCount, 1.0);
+	Zipf tagDist(tagCount, 1.0);
+	const char *words[] = {"alpha", "beta", "gamma", "delta", "epsilon", "zeta", "eta", "theta"};
+
+	std::vector<Note> notes(scale);
+	for (size_t i = 0; i < scale; i++) {
+		auto &n = notes[i];
+		n.title = "Title " + std::to_string(titleDist(rng));
+		n.text = std::string(words[rng() % 8]) + " " + words[rng() % 8] + " note " + std::to_string(i);
+		for (auto tags = 1 + rng() % 4; n.tags.size() < tags; ) {
+			n.tags.insert("tag" + std::to_string(tagDist(rng)));
+		}
+	}
+
+	// Note: the notes are kept for the text queries, so memory is measured from here
+	rssBaseline = peakRss();
+	Storyboard::Options options;
+	options.textTokenIndex = true;
+	Storyboard sb(options);
+	std::vector<NoteId> ids;
+	ids.reserve(scale);
+	Latencies insert;
+	for (auto const &n : notes) {
+		insert.time([&]() { ids.push_back(sb.addNote(n)); });
+	}
+	results.push_back(summarize(scale, "insert", insert));
+
+	// Queries follow the data distribution, results are walked (a search itself is a view)
+	const size_t queryCount = std::min<size_t>(scale, 10000);
+	size_t found = 0;
+	auto walk = [&found](const Storyboard::Result &r) {
+		for (auto it = r.begin(); it != r.end(); ++it) {
+			found++;
+		}
+	};
+	auto query = [&](const std::string &op, std::function<Storyboard::Result()> next) {
+		Latencies l;
+		for (size_t q = 0; q < queryCount; q++) {
+			l.time([&]() { walk(next()); });
+		}
+		results.push_back(summarize(scale, op, l));
+	};
+	std::vector<std::string> keys(queryCount);
+	auto sample = [&](Zipf &dist, const char *prefix) {
+		for (auto &k : keys) {
+			k = prefix + std::to_string(dist(rng));
+		}
+	};
+	size_t q = 0;
+	sample(titleDist, "Title ");
+	query("searchByTitle", [&]() { return sb.searchByTitle(keys[q++ % queryCount]); });
+	q = 0;
+	query("searchByText", [&]() { return sb.searchByText(notes[rng() % scale].text); });
+	sample(tagDist, "tag");
+	query("searchByTag", [&]() { return sb.searchByTag(keys[q++ % queryCount]); });
+	query("searchByTag(set)", [&]() {
+		return sb.searchByTag(std::set<std::string>{keys[q++ % queryCount], keys[q++ % queryCount]});
+	});
+	query("searchByTags(and)", [&]() {
+		Storyboard::TagQuery tq;
+		tq.allOf = {keys[q++ % queryCount], keys[q++ % queryCount]};
+		return sb.searchByTags(tq);
+	});
+	query("searchByWords", [&]() { return sb.searchByWords(std::string(words[rng() % 8]) + " " + words[rng() % 8]); });
+	query("searchByPhrase", [&]() { return sb.searchByPhrase("note " + std::to_string(rng() % scale)); });
+
+	std::shuffle(ids.begin(), ids.end(), rng);
+	ids.resize(std::max<size_t>(1, scale / 10));
+	Latencies remove;
+	for (auto id : ids) {
+		remove.time([&]() { sb.deleteNote(id); });
+	}
+	results.push_back(summarize(scale, "delete", remove));
+	if (found == 0) {
+		std::cout << "\t(no results found)" << std::endl;
+	}
+}
+
+/** runSuite(@scale) in a forked child, so every scale gets its own peak RSS (it never decreases in a process)
+ * @return false if the child could not be run
+ */
+bool runSuiteIsolated(size_t scale, std::vector<SuiteResult> &results)
+{
+	int fds[2];
+	if (::pipe(fds) != 0) {
+		return false;
+	}
+	std::cout.flush();
+	auto pid = ::fork();
+	if (pid < 0) {
+		::close(fds[0]);
+		::close(fds[1]);
+		return false;
+	}
+	if (pid == 0) {
+		::close(fds[0]);
+		std::vector<SuiteResult> own;
+		runSuite(scale, own);
+		std::ostringstream os;
+		os << std::setprecision(17);
+		for (auto const &r : own) {
+			os << r.scale << '\t' << r.op << '\t' << r.count << '\t' << r.throughput << '\t' << r.p50 << '\t' << r.p99
+				<< '\t' << r.rssGrowth << '\n';
+		}
+		auto data = os.str();
+		for (size_t done = 0; done < data.size(); ) {
+			auto n = ::write(fds[1], data.data() + done, data.size() - done);
+			if (n <= 0) {
+				_exit(1);
+			}
+			done += n;
+		}
+		std::cout.flush();
+		_exit(0);
+	}
+
+	::close(fds[1]);
+	std::string data;
+	char buffer[4096];
+	for (ssize_t n; (n = ::read(fds[0], buffer, sizeof(buffer))) > 0; ) {
+		data.append(buffer, n);
+	}
+	::close(fds[0]);
+	int status = 0;
+	::waitpid(pid, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		return false;
+	}
+
+	std::istringstream is(data);
+	for (std::string line; std::getline(is, line); ) {
+		std::istringstream fields(line);
+		SuiteResult r;
+		fields >> r.scale;
+		fields.ignore();
+		std::getline(fields, r.op, '\t');
+		fields >> r.count >> r.throughput >> r.p50 >> r.p99 >> r.rssGrowth;
+		results.push_back(r);
+	}
+	return true;
+}
+
+/** Benchmark suite: @scales board sizes, results as a table and optionally JSON (@json file, "-" is stdout) */
+int suite(const std::vector<size_t> &scales, const std::string &json)
+{
+	std::vector<SuiteResult> results;
+	for (auto scale : scales) {
+		if (!runSuiteIsolated(scale, results)) {
+			std::cerr << "Benchmark of scale " << scale << " failed" << std::endl;
+			return 1;
+		}
+	}
+
+	std::cout << std::left << std::setw(10) << "scale" << std::setw(20) << "op" << std::setw(10) << "count"
+		<< std::setw(14) << "ops/s" << std::setw(10) << "p50 us" << std::setw(10) << "p99 us" << "RSS growth kB" << std::endl;
+	for (auto const &r : results) {
+		std::cout << std::left << std::setw(10) << r.scale << std::setw(20) << r.op << std::setw(10) << r.count
+			<< std::setw(14) << static_cast<long>(r.throughput) << std::setw(10) << r.p50 << std::setw(10) << r.p99
+			<< r.rssGrowth << std::endl;
+	}
+	if (json == "-") {
+		writeJson(std::cout, results);
+	} else if (!json.empty()) {
+		std::ofstream out(json);
+		writeJson(out, results);
+		if (!out) {
+			std::cerr << "Cannot write " << json << std::endl;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+} // anonymous ns
+
+int main(int argc, char **argv)
+{
+	// --suite [--scale N[,N...]] [--json FILE]: synthetic workload with latency percentiles,
+	// otherwise the individual benchmarks below
+	std::vector<size_t> scales;
+	std::string json;
+	bool suiteMode = false;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--suite") {
+			suiteMode = true;
+		} else if (arg == "--scale" && i + 1 < argc) {
+			std::stringstream list(argv[++i]);
+			for (std::string n; std::getline(list, n, ','); ) {
+				scales.push_back(std::stoul(n));
+			}
+		} else if (arg == "--json" && i + 1 < argc) {
+			json = argv[++i];
+		} else {
+			std::cerr << "Usage: " << argv[0] << " [--suite [--scale N[,N...]] [--json FILE|-]]" << std::endl;
+			return 1;
+		}
+	}
+	if (suiteMode) {
+		return suite(scales.empty() ? std::vector<size_t>{1000, 100000} : scales, json);
+	}
+
+	std::cout << "Assignment 1 benchmarks ..." << std::endl;
+	benchArenas(); // Note: first, the heap of the other benchmarks would skew RSS
+	benchKernels();
+	benchBoardTagQueries();
+	benchBulkLoad();
+	benchConcurrentReads();
+	benchShardedQueries();
+	benchSnapshot();
+	benchDurableWrites();
+	benchDuplicateCheck();
+	benchKeyTries();
+	benchPagedSearch();
+	benchChangeFeed();
+	benchResultCache();
+	benchMetrics();
+	return 0;
+}
@@ -0,0 +1,118 @@
+#include "ChangeFeed.h"
+
+#include <algorithm>
+
+#include "Storyboard.h"
+
+
+ChangeFeed::Subscription &ChangeFeed::Subscription::operator=(Subscription &&other)
+{
+	if (this != &other) {
+		if (m_channel) {
+			m_channel->closed.store(true, std::memory_order_release);
+		}
+		m_channel = std::move(other.m_channel);
+	}
+	return *this;
+}
+
+ChangeFeed::Subscription::~Subscription()
+{
+	if (m_channel) {
+		m_channel->closed.store(true, std::memory_order_release);
+	}
+}
+
+bool ChangeFeed::Subscription::poll(ChangeEvent &event)
+{
+	if (!m_channel) {
+		return false;
+	}
+	auto &ch = *m_channel;
+	auto head = ch.head.load(std::memory_order_relaxed);
+	if (head == ch.tail.load(std::memory_order_acquire)) {
+		return false;
+	}
+	auto &slot = ch.slots[head & (ch.slots.size() - 1)];
+	event = std::move(slot);
+	slot.note.reset(); // do not keep the note alive until the slot gets reused
+	ch.head.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+bool ChangeFeed::Subscription::overflowed() const
+{
+	return m_channel && m_channel->overflowed.load(std::memory_order_acquire);
+}
+
+ChangeFeed &ChangeFeed::operator=(const ChangeFeed &other)
+{
+	if (this != &other) {
+		dropAll();
+		m_sequence = other.m_sequence;
+	}
+	return *this;
+}
+
+ChangeFeed &ChangeFeed::operator=(ChangeFeed &&other)
+{
+	if (this != &other) {
+		dropAll();
+		m_sequence = other.m_sequence;
+		m_channels = std::move(other.m_channels);
+	}
+	return *this;
+}
+
+ChangeFeed::~ChangeFeed()
+{
+	// Note: subscribers may outlive the board, they see an overflow (no more events)
+	dropAll();
+}
+
+ChangeFeed::Subscription ChangeFeed::subscribe(const std::set<std::string> &tags, size_t capacity)
+{
+	auto ch = std::make_shared<Channel>();
+	size_t size = 1;
+	while (size < capacity) {
+		size *= 2;
+	}
+	ch->slots.resize(size);
+	ch->tags = tags;
+	m_channels.push_back(ch);
+	return Subscription(std::move(ch));
+}
+
+void ChangeFeed::dispatch(ChangeEvent::Kind kind, NoteId id, std::shared_ptr<const Note> note)
+{
+	// Unsubscribed and overflowed channels are dropped lazily here
+	m_channels.erase(std::remove_if(m_channels.begin(), m_channels.end(), [](const std::shared_ptr<Channel> &ch) {
+		return ch->closed.load(std::memory_order_acquire) || ch->overflowed.load(std::memory_order_relaxed);
+	}), m_channels.end());
+
+	for (auto &ch : m_channels) {
+		if (!ch->tags.empty() && std::none_of(note->tags.begin(), note->tags.end(),
+				[&ch](const std::string &tag) { return ch->tags.count(tag) != 0; })) {
+			continue;
+		}
+		auto tail = ch->tail.load(std::memory_order_relaxed);
+		if (tail - ch->head.load(std::memory_order_acquire) == ch->slots.size()) {
+			ch->overflowed.store(true, std::memory_order_release);
+			continue;
+		}
+		auto &slot = ch->slots[tail & (ch->slots.size() - 1)];
+		slot.sequence = m_sequence;
+		slot.kind = kind;
+		slot.id = id;
+		slot.note = note;
+		ch->tail.store(tail + 1, std::memory_order_release);
+	}
+}
+
+void ChangeFeed::dropAll()
+{
+	for (auto &ch : m_channels) {
+		ch->overflowed.store(true, std::memory_order_release);
+	}
+	m_channels.clear();
+}
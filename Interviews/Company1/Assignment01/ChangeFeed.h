@@ -0,0 +1,109 @@
+#pragma once
+
+// Martin Flaska - flegy@flegy.sk / https://www.linkedin.com/in/martinflaska
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "PostingIndex.h"
+
+struct Note;
+
+
+/** Note added / removed event of a board */
+struct ChangeEvent
+{
+	enum Kind { Added, Removed };
+
+	uint64_t sequence = 0; ///< board wide, increases by one with every change
+	Kind kind = Added;
+	NoteId id = 0;
+	std::shared_ptr<const Note> note; ///< shared by all the subscribers
+};
+
+/** Change stream of a board
+ *
+ * Every subscriber has its own bounded single producer / single consumer ring buffer: the
+ * board writer pushes events of matching notes (tag filtering is done on the writer side) and
+ * the subscriber reads them at its own pace from any thread, both lock-free. A writer never
+ * waits for a slow subscriber, a full buffer makes the subscription overflow instead (it gets
+ * no more events, the subscriber has to rescan the board and subscribe again).
+ *
+ * @note Copies of a feed share the sequence but no subscribers. Assigning a board to another one
+ *       overflows the target's subscriptions, their view of the board is gone.
+ */
+class ChangeFeed
+{
+	struct Channel;
+
+public:
+	/** Consumer side of a subscription, unsubscribes when destroyed */
+	class Subscription
+	{
+	public:
+		Subscription() = default;
+		explicit Subscription(std::shared_ptr<Channel> channel) : m_channel(std::move(channel)) {}
+		Subscription(Subscription &&) = default;
+		Subscription &operator=(Subscription &&other);
+		~Subscription();
+
+		/** Take the next event
+		 * @return false if there is none (yet)
+		 */
+		bool poll(ChangeEvent &event);
+
+		/** Events were dropped as the buffer was full, the subscription is dead once drained */
+		bool overflowed() const;
+
+	private:
+		std::shared_ptr<Channel> m_channel;
+	};
+
+	ChangeFeed() = default;
+	ChangeFeed(const ChangeFeed &other) : m_sequence(other.m_sequence) {}
+	ChangeFeed(ChangeFeed &&other) = default;
+	ChangeFeed &operator=(const ChangeFeed &other);
+	ChangeFeed &operator=(ChangeFeed &&other);
+	~ChangeFeed();
+
+	/** Subscribe to changes of notes having any of @tags (all the notes if empty)
+	 * @param capacity Buffer size in events (rounded up to a power of 2)
+	 */
+	Subscription subscribe(const std::set<std::string> &tags, size_t capacity);
+
+	/** Sequence number of the last change */
+	uint64_t sequence() const { return m_sequence; }
+
+	/** Record a change, @note() materializes the note and is called only if anybody listens */
+	template<typename F>
+	void publish(ChangeEvent::Kind kind, NoteId id, F note)
+	{
+		m_sequence++;
+		if (!m_channels.empty()) {
+			dispatch(kind, id, std::make_shared<const Note>(note()));
+		}
+	}
+
+private:
+	struct Channel
+	{
+		std::vector<ChangeEvent> slots; // size is a power of 2
+		std::set<std::string> tags;
+		std::atomic<uint64_t> head{0}; // next event to read, owned by the consumer
+		std::atomic<uint64_t> tail{0}; // next event to write, owned by the producer
+		std::atomic<bool> overflowed{false};
+		std::atomic<bool> closed{false};
+	};
+
+	void dispatch(ChangeEvent::Kind kind, NoteId id, std::shared_ptr<const Note> note);
+	/** Overflow all the subscriptions and forget them */
+	void dropAll();
+
+private:
+	uint64_t m_sequence = 0;
+	std::vector<std::shared_ptr<Channel>> m_channels;
+};
@@ -0,0 +1,90 @@
+#include "ConcurrentStoryboard.h"
+
+
+ConcurrentStoryboard::ConcurrentStoryboard(const Storyboard::Options &options)
+	: m_boards{Storyboard(options), Storyboard(options)}
+{
+}
+
+NoteId ConcurrentStoryboard::addNote(const Note &note)
+{
+	return write([&note](Storyboard &sb) { return sb.addNote(note); });
+}
+
+void ConcurrentStoryboard::deleteNote(const Note &note)
+{
+	write([&note](Storyboard &sb) { sb.deleteNote(note); });
+}
+
+void ConcurrentStoryboard::deleteNote(NoteId id)
+{
+	write([id](Storyboard &sb) { sb.deleteNote(id); });
+}
+
+size_t ConcurrentStoryboard::addNotes(const std::vector<Note> &notes, unsigned threads)
+{
+	return write([&notes, threads](Storyboard &sb) { return sb.addNotes(notes, threads); });
+}
+
+size_t ConcurrentStoryboard::compactIds()
+{
+	return write([](Storyboard &sb) { return sb.compactIds(); });
+}
+
+using NoteSet = ConcurrentStoryboard::NoteSet;
+
+NoteSet ConcurrentStoryboard::searchByTitle(const std::string &title) const
+{
+	return read([&title](const Storyboard &sb) { return sb.searchByTitle(title).toNoteSet(); });
+}
+
+NoteSet ConcurrentStoryboard::searchByText(const std::string &text) const
+{
+	return read([&text](const Storyboard &sb) { return sb.searchByText(text).toNoteSet(); });
+}
+
+NoteSet ConcurrentStoryboard::searchByTag(const std::string &tag) const
+{
+	return read([&tag](const Storyboard &sb) { return sb.searchByTag(tag).toNoteSet(); });
+}
+
+NoteSet ConcurrentStoryboard::searchByTag(const std::set<std::string> &tags) const
+{
+	return read([&tags](const Storyboard &sb) { return sb.searchByTag(tags).toNoteSet(); });
+}
+
+NoteSet ConcurrentStoryboard::searchByTags(const Storyboard::TagQuery &query) const
+{
+	return read([&query](const Storyboard &sb) { return sb.searchByTags(query).toNoteSet(); });
+}
+
+size_t ConcurrentStoryboard::size() const
+{
+	return read([](const Storyboard &sb) { return sb.size(); });
+}
+
+void ConcurrentStoryboard::waitForReaders()
+{
+	// Readers which arrived before the board swap may still use the old board. They are all
+	// registered at the current version: move new readers to the other indicator, then wait
+	// for both to drain (the other one first, it may hold readers of an earlier round).
+	auto prev = m_version.load(std::memory_order_relaxed);
+	auto next = 1 - prev;
+	while (!m_readers[next].empty()) {
+		std::this_thread::yield();
+	}
+	m_version.store(next, std::memory_order_seq_cst);
+	while (!m_readers[prev].empty()) {
+		std::this_thread::yield();
+	}
+}
+
+bool ConcurrentStoryboard::ReadIndicator::empty() const
+{
+	for (auto const &c : m_counters) {
+		if (c.value.load(std::memory_order_acquire) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+// Martin Flaska - flegy@flegy.sk / https://www.linkedin.com/in/martinflaska
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "Storyboard.h"
+
+
+/** Thread safe Storyboard for read mostly workloads
+ *
+ * Uses the Left-Right technique: there are two identical boards, readers use the one which is
+ * currently published while the single writer modifies the other one, publishes it, waits until
+ * no reader can still see the old one and repeats the same change there.
+ *
+ * Readers never block and never wait for writers, they only bump a per-thread-slot reader
+ * counter (padded to its own cache line), so reads scale with cores. Writers are serialized
+ * and each change is applied twice (memory is doubled as well).
+ */
+class ConcurrentStoryboard
+{
+public:
+	typedef Storyboard::NoteSet NoteSet;
+
+	ConcurrentStoryboard() = default;
+	explicit ConcurrentStoryboard(const Storyboard::Options &options);
+
+	ConcurrentStoryboard(const ConcurrentStoryboard &) = delete;
+	ConcurrentStoryboard &operator=(const ConcurrentStoryboard &) = delete;
+
+	NoteId addNote(const Note &note);
+	void deleteNote(const Note &note);
+	void deleteNote(NoteId id);
+	size_t addNotes(const std::vector<Note> &notes, unsigned threads = 1);
+	/** Storyboard::compactIds() of both boards (they are renumbered the same way) */
+	size_t compactIds();
+
+	/** Run @f(const Storyboard &) against a consistent snapshot
+	 *
+	 * The snapshot (and Storyboard::Result/NoteRef taken from it) is valid only inside @f.
+	 * @f must not modify this ConcurrentStoryboard.
+	 */
+	template<typename F>
+	auto read(F f) const -> decltype(f(std::declval<const Storyboard&>()))
+	{
+		ReadGuard guard(*this);
+		return f(m_boards[m_published.load(std::memory_order_seq_cst)]);
+	}
+
+	/** Lookup methods, return owning copies as the snapshot can not leave read()
+	 *
+	 * @{
+	 */
+	NoteSet searchByTitle(const std::string &title) const;
+	NoteSet searchByText(const std::string &text) const;
+	NoteSet searchByTag(const std::string &tag) const;
+	NoteSet searchByTag(const std::set<std::string> &tags) const;
+	NoteSet searchByTags(const Storyboard::TagQuery &query) const;
+	size_t size() const;
+	/* @} */
+
+private:
+	/** Per version reader counters, spread over cache lines to avoid contention */
+	class ReadIndicator
+	{
+	public:
+		void arrive() { slot().fetch_add(1, std::memory_order_seq_cst); }
+		void depart() { slot().fetch_sub(1, std::memory_order_release); }
+		bool empty() const;
+
+	private:
+		static const size_t Slots = 64;
+
+		struct alignas(64) Counter
+		{
+			std::atomic<long> value{0};
+		};
+
+		std::atomic<long> &slot() { return m_counters[std::hash<std::thread::id>()(std::this_thread::get_id()) % Slots].value; }
+
+	private:
+		Counter m_counters[Slots];
+	};
+
+	class ReadGuard
+	{
+	public:
+		explicit ReadGuard(const ConcurrentStoryboard &b)
+			: m_indicator(b.m_readers[b.m_version.load(std::memory_order_seq_cst)])
+		{
+			m_indicator.arrive();
+		}
+		~ReadGuard() { m_indicator.depart(); }
+
+	private:
+		ReadIndicator &m_indicator;
+	};
+
+	/** Apply @f(Storyboard &) to both boards (writers only)
+	 *
+	 * If @f throws, the board it failed on is not published (no reader uses it), so it gets restored
+	 * by a copy of the published one: a failure of the first call leaves both boards unchanged,
+	 * a failure of the second one leaves the change applied to both. Either way the boards stay equal.
+	 * @note Only if the restoring copy throws as well the object is unusable afterwards.
+	 */
+	template<typename F>
+	auto write(F f) -> decltype(f(std::declval<Storyboard&>()))
+	{
+		std::lock_guard<std::mutex> lock(m_writeMutex);
+		auto hidden = 1 - m_published.load(std::memory_order_relaxed);
+		try {
+			f(m_boards[hidden]);
+		} catch (...) {
+			m_boards[hidden] = m_boards[1 - hidden];
+			throw;
+		}
+		m_published.store(hidden, std::memory_order_seq_cst);
+		waitForReaders();
+		try {
+			return f(m_boards[1 - hidden]);
+		} catch (...) {
+			m_boards[1 - hidden] = m_boards[hidden];
+			throw;
+		}
+	}
+
+	/** Make sure no reader uses the board which is not published anymore */
+	void waitForReaders();
+
+private:
+	Storyboard m_boards[2];
+	std::atomic<int> m_published{0}; ///< board used by readers
+	std::atomic<int> m_version{0};   ///< read indicator new readers arrive at
+	mutable ReadIndicator m_readers[2];
+	std::mutex m_writeMutex;
+};
@@ -0,0 +1,271 @@
+#include "DurableStoryboard.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "MappedStoryboard.h"
+
+
+namespace {
+
+const char SegmentPrefix[] = "wal.";
+
+std::runtime_error ioError(const std::string &what, const std::string &path)
+{
+	return std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+}
+
+/** Directory holding @path */
+std::string parentDirectory(std::string path)
+{
+	while (path.size() > 1 && path.back() == '/') {
+		path.pop_back();
+	}
+	auto slash = path.rfind('/');
+	if (slash == std::string::npos) {
+		return ".";
+	}
+	return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+/** Make renames / creates / unlinks in @dir durable */
+void syncDirectory(const std::string &dir)
+{
+	int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+	if (fd < 0) {
+		throw ioError("Can not open", dir);
+	}
+	bool ok = ::fsync(fd) == 0;
+	::close(fd);
+	if (!ok) {
+		throw ioError("Can not sync", dir);
+	}
+}
+
+/** Generations of the log segments in @dir, sorted */
+std::vector<uint64_t> listSegments(const std::string &dir)
+{
+	std::vector<uint64_t> generations;
+	DIR *d = ::opendir(dir.c_str());
+	if (!d) {
+		throw ioError("Can not open", dir);
+	}
+	const size_t prefix = sizeof(SegmentPrefix) - 1;
+	while (auto entry = ::readdir(d)) {
+		const char *name = entry->d_name;
+		char *end;
+		if (std::strncmp(name, SegmentPrefix, prefix) == 0 && name[prefix] != '\0') {
+			auto generation = std::strtoull(name + prefix, &end, 10);
+			if (*end == '\0') {
+				generations.push_back(generation);
+			}
+		}
+	}
+	::closedir(d);
+	std::sort(generations.begin(), generations.end());
+	return generations;
+}
+
+} // anonymous ns
+
+DurableStoryboard::DurableStoryboard(const std::string &dir)
+	: DurableStoryboard(dir, Options())
+{
+}
+
+DurableStoryboard::DurableStoryboard(const std::string &dir, const Options &options)
+	: m_dir(dir)
+	, m_options(options)
+	, m_board(options.board)
+{
+	if (::mkdir(dir.c_str(), 0755) == 0) {
+		syncDirectory(parentDirectory(dir)); // the new directory entry
+	} else if (errno != EEXIST) {
+		throw ioError("Can not create", dir);
+	}
+	recover();
+	m_wal = std::make_shared<WriteAheadLog>(segmentPath(m_generation));
+	// Note: a record synced by the log is only durable once the entry of its (maybe new) segment is
+	syncDirectory(m_dir);
+	if (m_options.compactBytes > 0) {
+		m_compactor = std::thread(&DurableStoryboard::runCompactor, this);
+	}
+}
+
+DurableStoryboard::~DurableStoryboard()
+{
+	if (m_compactor.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(m_compactMutex);
+			m_stop = true;
+		}
+		m_compactCv.notify_one();
+		m_compactor.join();
+	}
+	// m_wal flushes in its destructor
+}
+
+std::string DurableStoryboard::segmentPath(uint64_t generation) const
+{
+	char name[32];
+	std::snprintf(name, sizeof(name), "%s%010llu", SegmentPrefix, static_cast<unsigned long long>(generation));
+	return m_dir + "/" + name;
+}
+
+std::string DurableStoryboard::snapshotPath() const
+{
+	return m_dir + "/snapshot";
+}
+
+void DurableStoryboard::recover()
+{
+	struct stat st;
+	if (::stat(snapshotPath().c_str(), &st) == 0) {
+		MappedStoryboard snapshot(snapshotPath());
+		m_board.addNotes(snapshot.notes());
+	}
+	auto segments = listSegments(m_dir);
+	for (auto generation : segments) {
+		m_recovered += WriteAheadLog::replay(segmentPath(generation), [this](WriteAheadLog::RecordType type, const Note &note) {
+			if (type == WriteAheadLog::RecordType::AddNote) {
+				m_board.addNote(note);
+			} else {
+				m_board.deleteNote(note);
+			}
+		});
+	}
+	// Note: continue the last segment, replay cut off its torn tail (if any)
+	if (!segments.empty()) {
+		m_generation = segments.back();
+	}
+}
+
+template<typename F>
+void DurableStoryboard::logged(F f)
+{
+	std::shared_ptr<WriteAheadLog> wal;
+	WriteAheadLog::Lsn lsn;
+	{
+		std::lock_guard<std::mutex> lock(m_writeMutex);
+		wal = m_wal;
+		f(*wal);
+		lsn = wal->end();
+	}
+	// Wait outside of the lock, so other writers can join the same sync
+	if (m_options.syncWrites) {
+		wal->waitDurable(lsn);
+	}
+	if (m_options.compactBytes > 0 && lsn > m_options.compactBytes) {
+		{
+			std::lock_guard<std::mutex> lock(m_compactMutex);
+			m_compactRequested = true;
+		}
+		m_compactCv.notify_one();
+	}
+}
+
+void DurableStoryboard::addNote(const Note &note)
+{
+	logged([this, &note](WriteAheadLog &wal) {
+		wal.append(WriteAheadLog::RecordType::AddNote, note);
+		m_board.addNote(note);
+	});
+}
+
+void DurableStoryboard::deleteNote(const Note &note)
+{
+	logged([this, &note](WriteAheadLog &wal) {
+		wal.append(WriteAheadLog::RecordType::DeleteNote, note);
+		m_board.deleteNote(note);
+		// Note: the API is note based (snapshots renumber notes anyway), so deleted slots are reclaimed right away
+		if (m_board.read([](const Storyboard &sb) { return sb.needsIdCompaction(); })) {
+			m_board.compactIds();
+		}
+	});
+}
+
+size_t DurableStoryboard::addNotes(const std::vector<Note> &notes)
+{
+	size_t added = 0;
+	logged([this, &notes, &added](WriteAheadLog &wal) {
+		for (auto const &n : notes) {
+			wal.append(WriteAheadLog::RecordType::AddNote, n);
+		}
+		added = m_board.addNotes(notes);
+	});
+	return added;
+}
+
+void DurableStoryboard::sync()
+{
+	std::shared_ptr<WriteAheadLog> wal;
+	{
+		std::lock_guard<std::mutex> lock(m_writeMutex);
+		wal = m_wal;
+	}
+	wal->flush();
+}
+
+void DurableStoryboard::checkpoint()
+{
+	std::lock_guard<std::mutex> checkpointLock(m_checkpointMutex);
+
+	// Switch to a new segment: everything logged before is applied to the board now
+	std::shared_ptr<WriteAheadLog> old;
+	uint64_t generation;
+	{
+		std::lock_guard<std::mutex> lock(m_writeMutex);
+		generation = m_generation + 1;
+		auto wal = std::make_shared<WriteAheadLog>(segmentPath(generation));
+		old = m_wal;
+		m_wal = wal;
+		m_generation = generation;
+	}
+	syncDirectory(m_dir);
+	old->flush();
+	old.reset();
+
+	// Copy, so the (slow) save does not hold a reader slot and stall writers
+	auto copy = m_board.read([](const Storyboard &sb) { return sb; });
+	MappedStoryboard::save(copy, snapshotPath());
+	syncDirectory(m_dir);
+
+	for (auto g : listSegments(m_dir)) {
+		if (g < generation && ::unlink(segmentPath(g).c_str()) != 0) {
+			throw ioError("Can not remove", segmentPath(g));
+		}
+	}
+	syncDirectory(m_dir);
+}
+
+void DurableStoryboard::runCompactor()
+{
+	std::unique_lock<std::mutex> lock(m_compactMutex);
+	for (;;) {
+		m_compactCv.wait(lock, [this]() { return m_stop || m_compactRequested; });
+		if (m_stop) {
+			return;
+		}
+		m_compactRequested = false;
+		lock.unlock();
+		try {
+			checkpoint();
+		} catch (const std::exception &e) {
+			// Note: the log is kept until a snapshot replaces it, so a failed compaction loses
+			//       nothing; it is retried once the log grows again
+			std::cerr << "Storyboard compaction failed: " << e.what() << std::endl;
+		}
+		lock.lock();
+	}
+}
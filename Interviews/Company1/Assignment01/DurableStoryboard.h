@@ -0,0 +1,112 @@
+#pragma once
+
+// Martin Flaska - flegy@flegy.sk / https://www.linkedin.com/in/martinflaska
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "ConcurrentStoryboard.h"
+#include "WriteAheadLog.h"
+
+
+/** Crash safe ConcurrentStoryboard
+ *
+ * A directory holds the latest snapshot (see MappedStoryboard) and write-ahead log segments
+ * wal.<generation>. Every change is logged before it is applied and, with syncWrites, the call
+ * returns once the log record is on disk; concurrent writers share fsyncs (group commit).
+ *
+ * Recovery loads the snapshot and replays all the log segments in order. Changes are idempotent
+ * set operations (re-adding a note is a no-op, deleting a missing one too), so replaying records
+ * already contained in the snapshot is harmless and the snapshot need not be exactly aligned
+ * with a segment boundary.
+ *
+ * Compaction (checkpoint) starts a new segment, writes a snapshot of a copy of the board and
+ * then drops the older segments. It runs on a background thread once the current segment grows
+ * over Options::compactBytes. Readers are never blocked; writers only wait while the segment is
+ * switched and while the board is being copied.
+ *
+ * @note Note ids are not stable across restarts (snapshots renumber notes), so the write API is
+ *       content based.
+ */
+class DurableStoryboard
+{
+public:
+	typedef Storyboard::NoteSet NoteSet;
+
+	struct Options
+	{
+		Storyboard::Options board;
+		/** Return from writes only once they are durable */
+		bool syncWrites = true;
+		/** Compact in background once the log segment is larger, 0 disables */
+		uint64_t compactBytes = 64 << 20;
+	};
+
+	/** Open (or create) storyboard stored in directory @dir and recover its content
+	 * @throw std::runtime_error on I/O errors
+	 */
+	explicit DurableStoryboard(const std::string &dir);
+	DurableStoryboard(const std::string &dir, const Options &options);
+	/** Flushes the log */
+	~DurableStoryboard();
+
+	DurableStoryboard(const DurableStoryboard &) = delete;
+	DurableStoryboard &operator=(const DurableStoryboard &) = delete;
+
+	void addNote(const Note &note);
+	void deleteNote(const Note &note);
+	/** @return Number of added notes */
+	size_t addNotes(const std::vector<Note> &notes);
+
+	/** See ConcurrentStoryboard::read() */
+	template<typename F>
+	auto read(F f) const -> decltype(f(std::declval<const Storyboard&>()))
+	{
+		return m_board.read(f);
+	}
+
+	NoteSet searchByTitle(const std::string &title) const { return m_board.searchByTitle(title); }
+	NoteSet searchByText(const std::string &text) const { return m_board.searchByText(text); }
+	NoteSet searchByTag(const std::string &tag) const { return m_board.searchByTag(tag); }
+	NoteSet searchByTag(const std::set<std::string> &tags) const { return m_board.searchByTag(tags); }
+	NoteSet searchByTags(const Storyboard::TagQuery &query) const { return m_board.searchByTags(query); }
+	size_t size() const { return m_board.size(); }
+
+	/** Make all the changes durable (needed with syncWrites disabled only) */
+	void sync();
+	/** Write a snapshot and drop the log it replaces (what background compaction does) */
+	void checkpoint();
+
+	/** Number of log records replayed when the board was opened */
+	size_t recoveredRecords() const { return m_recovered; }
+
+private:
+	std::string segmentPath(uint64_t generation) const;
+	std::string snapshotPath() const;
+	void recover();
+
+	/** Log a change (in the order it is applied) and wait until it is durable */
+	template<typename F>
+	void logged(F f);
+	void runCompactor();
+
+private:
+	std::string m_dir;
+	Options m_options;
+	ConcurrentStoryboard m_board;
+	size_t m_recovered = 0;
+
+	std::mutex m_writeMutex; ///< keeps the log order equal to the apply order
+	std::shared_ptr<WriteAheadLog> m_wal;
+	uint64_t m_generation = 1;
+
+	std::mutex m_checkpointMutex;
+	std::mutex m_compactMutex;
+	std::condition_variable m_compactCv;
+	bool m_compactRequested = false;
+	bool m_stop = false;
+	std::thread m_compactor;
+};
@@ -0,0 +1,155 @@
+#include "Fingerprint.h"
+
+#include <cstring>
+
+
+namespace {
+
+inline uint64_t rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t fmix(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdull;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ull;
+	k ^= k >> 33;
+	return k;
+}
+
+} // anonymous ns
+
+Fingerprint Fingerprint::of(std::string_view data, uint64_t seed)
+{
+	const uint64_t c1 = 0x87c37b91114253d5ull;
+	const uint64_t c2 = 0x4cf5ad432745937full;
+	auto bytes = reinterpret_cast<const unsigned char*>(data.data());
+	auto len = data.size();
+	auto blocks = len / 16;
+	uint64_t h1 = seed;
+	uint64_t h2 = seed;
+
+	for (size_t i = 0; i < blocks; i++) {
+		uint64_t k1, k2;
+		std::memcpy(&k1, bytes + i * 16, 8);
+		std::memcpy(&k2, bytes + i * 16 + 8, 8);
+
+		k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+		h1 = rotl(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+		k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+		h2 = rotl(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+	}
+
+	auto tail = bytes + blocks * 16;
+	uint64_t k1 = 0;
+	uint64_t k2 = 0;
+	switch (len & 15) {
+	case 15: k2 ^= uint64_t(tail[14]) << 48; // fall through
+	case 14: k2 ^= uint64_t(tail[13]) << 40; // fall through
+	case 13: k2 ^= uint64_t(tail[12]) << 32; // fall through
+	case 12: k2 ^= uint64_t(tail[11]) << 24; // fall through
+	case 11: k2 ^= uint64_t(tail[10]) << 16; // fall through
+	case 10: k2 ^= uint64_t(tail[9]) << 8;   // fall through
+	case 9:  k2 ^= uint64_t(tail[8]);
+		k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+		// fall through
+	case 8:  k1 ^= uint64_t(tail[7]) << 56; // fall through
+	case 7:  k1 ^= uint64_t(tail[6]) << 48; // fall through
+	case 6:  k1 ^= uint64_t(tail[5]) << 40; // fall through
+	case 5:  k1 ^= uint64_t(tail[4]) << 32; // fall through
+	case 4:  k1 ^= uint64_t(tail[3]) << 24; // fall through
+	case 3:  k1 ^= uint64_t(tail[2]) << 16; // fall through
+	case 2:  k1 ^= uint64_t(tail[1]) << 8;  // fall through
+	case 1:  k1 ^= uint64_t(tail[0]);
+		k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+	}
+
+	h1 ^= len;
+	h2 ^= len;
+	h1 += h2;
+	h2 += h1;
+	h1 = fmix(h1);
+	h2 = fmix(h2);
+	h1 += h2;
+	h2 += h1;
+	return {h1, h2};
+}
+
+const NoteId FingerprintIndex::Empty;
+
+void FingerprintIndex::insert(const Fingerprint &fp, NoteId id)
+{
+	// keep load factor <= 0.75
+	if ((m_size + 1) * 4 > m_slots.size() * 3) {
+		rehash(m_slots.empty() ? 16 : m_slots.size() * 2);
+	}
+	auto mask = m_slots.size() - 1;
+	auto i = slotOf(fp);
+	while (m_slots[i].id != Empty) {
+		i = (i + 1) & mask;
+	}
+	m_slots[i].fp = fp;
+	m_slots[i].id = id;
+	m_size++;
+}
+
+void FingerprintIndex::erase(const Fingerprint &fp, NoteId id)
+{
+	if (m_size == 0) {
+		return;
+	}
+	auto mask = m_slots.size() - 1;
+	auto hole = slotOf(fp);
+	for (; m_slots[hole].id != id || m_slots[hole].fp != fp; hole = (hole + 1) & mask) {
+		if (m_slots[hole].id == Empty) {
+			return;
+		}
+	}
+	m_slots[hole].id = Empty;
+	m_size--;
+
+	// Backward shift deletion, same as HashPostingMap
+	for (auto i = (hole + 1) & mask; m_slots[i].id != Empty; i = (i + 1) & mask) {
+		auto home = slotOf(m_slots[i].fp);
+		bool movable = hole <= i ? (home <= hole || home > i) : (home <= hole && home > i);
+		if (movable) {
+			m_slots[hole] = m_slots[i];
+			m_slots[i].id = Empty;
+			hole = i;
+		}
+	}
+}
+
+void FingerprintIndex::reserve(size_t count)
+{
+	size_t slots = m_slots.empty() ? 16 : m_slots.size();
+	while (count * 4 > slots * 3) {
+		slots *= 2;
+	}
+	if (slots != m_slots.size()) {
+		rehash(slots);
+	}
+}
+
+void FingerprintIndex::rehash(size_t slots)
+{
+	std::pmr::vector<Slot> old(slots, m_slots.get_allocator());
+	old.swap(m_slots);
+	m_shift = 64;
+	for (auto n = m_slots.size(); n > 1; n >>= 1) {
+		m_shift--;
+	}
+	auto mask = m_slots.size() - 1;
+	for (auto const &slot : old) {
+		if (slot.id != Empty) {
+			auto i = slotOf(slot.fp);
+			while (m_slots[i].id != Empty) {
+				i = (i + 1) & mask;
+			}
+			m_slots[i] = slot;
+		}
+	}
+}
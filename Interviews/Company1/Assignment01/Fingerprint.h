@@ -0,0 +1,95 @@
+#pragma once
+
+// Martin Flaska - flegy@flegy.sk / https://www.linkedin.com/in/martinflaska
+
+#include <cstdint>
+#include <memory_resource>
+#include <string_view>
+#include <vector>
+
+#include "PostingIndex.h"
+
+
+/** 128 bit content hash */
+struct Fingerprint
+{
+	uint64_t lo = 0;
+	uint64_t hi = 0;
+
+	/** MurmurHash3 (x64, 128 bit) of @data */
+	static Fingerprint of(std::string_view data, uint64_t seed = 0);
+
+	/** Order independent combination (used for sets, e.g. tags) */
+	Fingerprint &operator+=(const Fingerprint &other)
+	{
+		lo += other.lo;
+		hi += other.hi;
+		return *this;
+	}
+
+	bool operator==(const Fingerprint &other) const { return lo == other.lo && hi == other.hi; }
+	bool operator!=(const Fingerprint &other) const { return !(*this == other); }
+	bool operator<(const Fingerprint &other) const { return hi != other.hi ? hi < other.hi : lo < other.lo; }
+};
+
+
+/** Hash multimap Fingerprint -> NoteId (open addressing, linear probing)
+ *
+ * Different notes with equal fingerprints are allowed (the caller confirms a match), so the
+ * structure is exact even though collisions are practically impossible.
+ */
+class FingerprintIndex
+{
+public:
+	explicit FingerprintIndex(std::pmr::memory_resource *memory = std::pmr::get_default_resource()) : m_slots(memory) {}
+
+	void insert(const Fingerprint &fp, NoteId id);
+	void erase(const Fingerprint &fp, NoteId id);
+	void reserve(size_t count);
+	/** Replace every stored id by @map(id) */
+	template<typename F>
+	void renumber(F map)
+	{
+		for (auto &slot : m_slots) {
+			if (slot.id != Empty) {
+				slot.id = map(slot.id);
+			}
+		}
+	}
+	size_t size() const { return m_size; }
+
+	/** Find a note with fingerprint @fp for which @match(id) holds
+	 * @return The note id or @notFound
+	 */
+	template<typename F>
+	NoteId find(const Fingerprint &fp, F match, NoteId notFound) const
+	{
+		if (m_size == 0) {
+			return notFound;
+		}
+		auto mask = m_slots.size() - 1;
+		for (auto i = slotOf(fp); m_slots[i].id != Empty; i = (i + 1) & mask) {
+			if (m_slots[i].fp == fp && match(m_slots[i].id)) {
+				return m_slots[i].id;
+			}
+		}
+		return notFound;
+	}
+
+private:
+	static const NoteId Empty = static_cast<NoteId>(-1);
+
+	struct Slot
+	{
+		Fingerprint fp;
+		NoteId id = Empty;
+	};
+
+	size_t slotOf(const Fingerprint &fp) const { return m_shift == 64 ? 0 : fp.lo >> m_shift; }
+	void rehash(size_t slots);
+
+private:
+	std::pmr::vector<Slot> m_slots; // capacity is a power of 2
+	size_t m_size = 0;
+	unsigned m_shift = 64;
+};
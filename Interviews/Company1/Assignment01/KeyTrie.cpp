@@ -0,0 +1,286 @@
+#include "KeyTrie.h"
+
+#include <algorithm>
+#include <queue>
+
+
+const size_t KeyTrie::npos;
+
+KeyTrie::KeyTrie()
+	: m_nodes(1)
+{
+}
+
+void KeyTrie::insert(std::string_view key)
+{
+	std::vector<NodeId> path{0};
+	NodeId node = 0;
+	size_t pos = 0;
+	while (pos < key.size()) {
+		auto i = childIndex(m_nodes[node], key[pos]);
+		if (i == npos) {
+			// Note: newNode() may reallocate m_nodes, no node references are held across it
+			auto leaf = newNode(std::string(key.substr(pos)));
+			auto &children = m_nodes[node].children;
+			auto c = key[pos];
+			auto it = std::lower_bound(children.begin(), children.end(), c,
+				[this](NodeId child, char c) {
+					// Note: byte order of std::string, chars may be signed
+					return static_cast<unsigned char>(m_nodes[child].label[0]) < static_cast<unsigned char>(c);
+				});
+			children.insert(it, leaf);
+			node = leaf;
+			path.push_back(node);
+			break;
+		}
+
+		auto child = m_nodes[node].children[i];
+		auto rest = key.substr(pos);
+		auto const &label = m_nodes[child].label;
+		auto common = std::mismatch(label.begin(), label.begin() + std::min(label.size(), rest.size()),
+			rest.begin()).first - label.begin();
+		if (static_cast<size_t>(common) < label.size()) {
+			// Split the edge, the new node takes the common part of the label
+			auto mid = newNode(m_nodes[child].label.substr(0, common));
+			m_nodes[child].label.erase(0, common);
+			m_nodes[mid].children.push_back(child);
+			m_nodes[mid].maxCount = m_nodes[child].maxCount;
+			m_nodes[node].children[i] = mid;
+			child = mid;
+		}
+		node = child;
+		pos += common;
+		path.push_back(node);
+	}
+
+	if (m_nodes[node].count++ == 0) {
+		m_keyCount++;
+	}
+	updateMax(path);
+}
+
+void KeyTrie::erase(std::string_view key)
+{
+	std::vector<NodeId> path{0};
+	NodeId node = 0;
+	size_t pos = 0;
+	while (pos < key.size()) {
+		auto i = childIndex(m_nodes[node], key[pos]);
+		if (i == npos) {
+			return;
+		}
+		node = m_nodes[node].children[i];
+		auto const &label = m_nodes[node].label;
+		if (key.compare(pos, label.size(), label) != 0) {
+			return;
+		}
+		pos += label.size();
+		path.push_back(node);
+	}
+	if (m_nodes[node].count == 0) {
+		return;
+	}
+
+	if (--m_nodes[node].count == 0) {
+		m_keyCount--;
+		// Restore the invariant: inner nodes that are not keys have 2+ children
+		if (node != 0 && m_nodes[node].children.empty()) {
+			path.pop_back();
+			auto parent = path.back();
+			auto &siblings = m_nodes[parent].children;
+			siblings.erase(std::find(siblings.begin(), siblings.end(), node));
+			freeNode(node);
+			if (parent != 0 && m_nodes[parent].count == 0 && m_nodes[parent].children.size() == 1) {
+				merge(parent);
+			}
+		} else if (node != 0 && m_nodes[node].children.size() == 1) {
+			merge(node);
+		}
+	}
+	updateMax(path);
+}
+
+size_t KeyTrie::count(std::string_view key) const
+{
+	NodeId node;
+	std::string path;
+	if (!locate(key, node, path) || path.size() != key.size()) {
+		return 0;
+	}
+	return m_nodes[node].count;
+}
+
+std::vector<KeyTrie::Entry> KeyTrie::withPrefix(std::string_view prefix, size_t limit) const
+{
+	std::vector<Entry> out;
+	NodeId node;
+	std::string path;
+	if (locate(prefix, node, path)) {
+		collect(node, path, false, {}, nullptr, limit, out);
+	}
+	return out;
+}
+
+std::vector<KeyTrie::Entry> KeyTrie::range(std::string_view from, std::string_view to, size_t limit) const
+{
+	std::vector<Entry> out;
+	if (from < to) {
+		std::string path;
+		collect(0, path, true, from, &to, limit, out);
+	}
+	return out;
+}
+
+std::vector<KeyTrie::Entry> KeyTrie::top(size_t k, std::string_view prefix) const
+{
+	std::vector<Entry> out;
+	NodeId node;
+	std::string path;
+	if (k == 0 || !locate(prefix, node, path)) {
+		return out;
+	}
+
+	// Best-first walk: a subtree is expanded once its best count may beat the reported keys,
+	// a key is reported once it beats everything left in the queue
+	struct Item
+	{
+		size_t count;
+		bool key; ///< the node key itself, otherwise the whole node subtree
+		NodeId node;
+		std::string path;
+	};
+	auto worse = [](const Item &a, const Item &b) {
+		return a.count != b.count ? a.count < b.count : a.path > b.path;
+	};
+	std::priority_queue<Item, std::vector<Item>, decltype(worse)> queue(worse);
+	queue.push({m_nodes[node].maxCount, false, node, std::move(path)});
+	while (!queue.empty() && out.size() < k) {
+		auto item = queue.top();
+		queue.pop();
+		if (item.count == 0) {
+			break; // empty trie
+		}
+		if (item.key) {
+			out.push_back({std::move(item.path), item.count});
+			continue;
+		}
+		auto const &n = m_nodes[item.node];
+		if (n.count > 0) {
+			queue.push({n.count, true, item.node, item.path});
+		}
+		for (auto child : n.children) {
+			queue.push({m_nodes[child].maxCount, false, child, item.path + m_nodes[child].label});
+		}
+	}
+	return out;
+}
+
+size_t KeyTrie::childIndex(const Node &node, char c) const
+{
+	auto it = std::lower_bound(node.children.begin(), node.children.end(), c,
+		[this](NodeId child, char c) {
+			return static_cast<unsigned char>(m_nodes[child].label[0]) < static_cast<unsigned char>(c);
+		});
+	if (it == node.children.end() || static_cast<unsigned char>(m_nodes[*it].label[0]) != static_cast<unsigned char>(c)) {
+		return npos;
+	}
+	return it - node.children.begin();
+}
+
+bool KeyTrie::locate(std::string_view prefix, NodeId &node, std::string &path) const
+{
+	node = 0;
+	path.clear();
+	while (path.size() < prefix.size()) {
+		auto i = childIndex(m_nodes[node], prefix[path.size()]);
+		if (i == npos) {
+			return false;
+		}
+		node = m_nodes[node].children[i];
+		auto const &label = m_nodes[node].label;
+		auto rest = prefix.substr(path.size());
+		// the label either continues @prefix or @prefix ends within it
+		if (rest.compare(0, label.size(), label.substr(0, rest.size())) != 0) {
+			return false;
+		}
+		path += label;
+	}
+	return true;
+}
+
+KeyTrie::NodeId KeyTrie::newNode(std::string label)
+{
+	if (!m_free.empty()) {
+		auto node = m_free.back();
+		m_free.pop_back();
+		m_nodes[node].label = std::move(label);
+		return node;
+	}
+	m_nodes.emplace_back();
+	m_nodes.back().label = std::move(label);
+	return static_cast<NodeId>(m_nodes.size() - 1);
+}
+
+void KeyTrie::freeNode(NodeId node)
+{
+	m_nodes[node] = Node();
+	m_free.push_back(node);
+}
+
+void KeyTrie::merge(NodeId node)
+{
+	auto child = m_nodes[node].children[0];
+	auto &n = m_nodes[node];
+	auto &c = m_nodes[child];
+	n.label += c.label;
+	n.count = c.count;
+	n.maxCount = c.maxCount;
+	n.children = std::move(c.children);
+	freeNode(child);
+}
+
+void KeyTrie::updateMax(const std::vector<NodeId> &path)
+{
+	for (auto it = path.rbegin(); it != path.rend(); ++it) {
+		auto &n = m_nodes[*it];
+		n.maxCount = n.count;
+		for (auto child : n.children) {
+			n.maxCount = std::max(n.maxCount, m_nodes[child].maxCount);
+		}
+	}
+}
+
+bool KeyTrie::collect(NodeId node, std::string &path, bool bounded, std::string_view from, const std::string_view *to,
+	size_t limit, std::vector<Entry> &out) const
+{
+	auto const &n = m_nodes[node];
+	// a bounded path shorter than @from is less than it
+	if (n.count > 0 && !(bounded && path.size() < from.size())) {
+		if ((to && path >= *to) || out.size() >= limit) {
+			return false;
+		}
+		out.push_back({path, n.count});
+	}
+	for (auto child : n.children) {
+		auto const &label = m_nodes[child].label;
+		bool childBounded = false;
+		if (bounded) {
+			auto rest = from.substr(path.size());
+			auto len = std::min(label.size(), rest.size());
+			auto cmp = rest.compare(0, len, label.substr(0, len));
+			if (cmp > 0) {
+				continue; // the whole subtree is below @from
+			}
+			// equal and the label does not go past @from: still a prefix of it, otherwise
+			// the whole subtree is above @from
+			childBounded = cmp == 0 && label.size() <= rest.size();
+		}
+		path += label;
+		bool more = collect(child, path, childBounded, from, to, limit, out);
+		path.resize(path.size() - label.size());
+		if (!more) {
+			return false;
+		}
+	}
+	return true;
+}
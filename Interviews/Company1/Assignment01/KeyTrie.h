@@ -0,0 +1,89 @@
+#pragma once
+
+// Martin Flaska - flegy@flegy.sk / https://www.linkedin.com/in/martinflaska
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+/** Compressed radix trie of keys (titles, tags) with the number of live notes per key
+ *
+ * Every edge carries a label of one or more bytes and every inner node which is not a key has
+ * at least two children, so a subtree has O(number of its keys) nodes. Hence prefix and range
+ * queries cost O(length of the bound) to get to the first key plus O(reported keys). Each node
+ * also keeps the maximum key count of its subtree, top-k queries are a best-first walk driven
+ * by it and visit O(k * depth) nodes no matter how many keys are below the prefix.
+ *
+ * Keys are compared as byte strings (std::string order).
+ */
+class KeyTrie
+{
+public:
+	struct Entry
+	{
+		std::string key;
+		size_t count; ///< number of notes with the key
+
+		bool operator==(const Entry &other) const { return key == other.key && count == other.count; }
+	};
+
+	static const size_t npos = static_cast<size_t>(-1);
+
+	KeyTrie();
+
+	/** Count one more note with @key */
+	void insert(std::string_view key);
+	/** Count one note with @key less, the key goes away with its last note */
+	void erase(std::string_view key);
+
+	/** Number of notes with @key */
+	size_t count(std::string_view key) const;
+	/** Number of distinct keys */
+	size_t size() const { return m_keyCount; }
+
+	/** Keys starting with @prefix in lexicographic order, up to @limit of them */
+	std::vector<Entry> withPrefix(std::string_view prefix, size_t limit = npos) const;
+	/** Keys from [@from, @to) in lexicographic order, up to @limit of them */
+	std::vector<Entry> range(std::string_view from, std::string_view to, size_t limit = npos) const;
+	/** @k keys starting with @prefix with the highest counts (ties in lexicographic order) */
+	std::vector<Entry> top(size_t k, std::string_view prefix = {}) const;
+
+private:
+	typedef uint32_t NodeId;
+
+	struct Node
+	{
+		std::string label;            ///< edge label from the parent
+		uint32_t count = 0;           ///< notes with the key ending here, 0 = not a key
+		uint32_t maxCount = 0;        ///< max count in the subtree (node included)
+		std::vector<NodeId> children; ///< sorted by the first byte of their labels
+	};
+
+	/** Child of @node whose label starts with @c or npos */
+	size_t childIndex(const Node &node, char c) const;
+	/** Topmost @node whose @path starts with @prefix
+	 * @return false if there is no such node
+	 */
+	bool locate(std::string_view prefix, NodeId &node, std::string &path) const;
+
+	NodeId newNode(std::string label);
+	void freeNode(NodeId node);
+	/** Merge @node (not a key) with its only child */
+	void merge(NodeId node);
+	/** Recompute maxCount of the @path nodes, the deepest one last */
+	void updateMax(const std::vector<NodeId> &path);
+
+	/** In-order walk of @node subtree reporting keys from [@from, @to) (@to == nullptr: no upper
+	 * bound), @path is the key of @node and @bounded tells whether it is a prefix of @from
+	 * @return false once the walk has to stop
+	 */
+	bool collect(NodeId node, std::string &path, bool bounded, std::string_view from, const std::string_view *to,
+		size_t limit, std::vector<Entry> &out) const;
+
+private:
+	std::vector<Node> m_nodes; // m_nodes[0] is the root (empty key)
+	std::vector<NodeId> m_free;
+	size_t m_keyCount = 0;
+};
@@ -0,0 +1,526 @@
+#include "MappedStoryboard.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "PostingAlgebra.h"
+
+
+struct MappedStoryboard::Header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint64_t fileSize;
+	uint32_t noteCount;
+	uint32_t stringCount;
+	uint32_t slotCount;   ///< string hash table size (power of 2)
+	uint32_t tagRefCount; ///< total number of note tags
+	uint64_t stringOffsets;
+	uint64_t stringBytes;
+	uint64_t slots;
+	uint64_t notes;
+	uint64_t tags;
+	uint64_t postingOffsets[FieldCount];
+	uint64_t postingIds[FieldCount];
+};
+
+namespace {
+
+const char Magic[8] = {'S', 'B', 'S', 'N', 'A', 'P', '\0', '\0'};
+const uint32_t Version = 1;
+const uint32_t ByteOrder = 0x01020304;
+
+/** Stable hash (the file is shared by processes and builds, std::hash is not guaranteed to be) */
+uint64_t fnv1a(const char *data, size_t size)
+{
+	uint64_t h = 14695981039346656037ull;
+	for (size_t i = 0; i < size; i++) {
+		h ^= static_cast<unsigned char>(data[i]);
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+std::runtime_error ioError(const std::string &what, const std::string &path)
+{
+	return std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+}
+
+/** Snapshot image being built in memory */
+class Image
+{
+public:
+	/** Append @count items of @data at a 8 byte aligned offset
+	 * @return Offset of the data
+	 */
+	template<typename T>
+	uint64_t append(const T *data, size_t count)
+	{
+		m_bytes.resize((m_bytes.size() + 7) & ~size_t(7), 0);
+		auto offset = m_bytes.size();
+		m_bytes.insert(m_bytes.end(), reinterpret_cast<const char*>(data), reinterpret_cast<const char*>(data + count));
+		return offset;
+	}
+
+	std::vector<char> &bytes() { return m_bytes; }
+
+private:
+	std::vector<char> m_bytes;
+};
+
+/** Make the directory entries of @path durable (after a rename) */
+void syncParentDirectory(const std::string &path)
+{
+	auto slash = path.rfind('/');
+	auto dir = slash == std::string::npos ? std::string(".") : slash == 0 ? std::string("/") : path.substr(0, slash);
+	int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+	if (fd < 0) {
+		throw ioError("Can not open", dir);
+	}
+	bool ok = ::fsync(fd) == 0;
+	::close(fd);
+	if (!ok) {
+		throw ioError("Can not sync", dir);
+	}
+}
+
+} // anonymous ns
+
+void MappedStoryboard::save(const Storyboard &board, const std::string &path)
+{
+	const auto &pool = board.m_strings;
+
+	// Renumber the symbols used by live notes (the pool may have holes)
+	std::vector<SymbolId> remap(pool.idBound(), StringPool::npos);
+	std::vector<SymbolId> symbols; // new id -> pool id
+	auto symbol = [&remap, &symbols](SymbolId id) {
+		if (remap[id] == StringPool::npos) {
+			remap[id] = static_cast<SymbolId>(symbols.size());
+			symbols.push_back(id);
+		}
+		return remap[id];
+	};
+	std::vector<MappedNote> notes;
+	std::vector<SymbolId> tags;
+	for (auto const &rec : board.m_notes) {
+		if (!rec.alive()) {
+			continue;
+		}
+		MappedNote n;
+		n.title = symbol(rec.title);
+		n.text = symbol(rec.text);
+		n.tagsFirst = static_cast<uint32_t>(tags.size());
+		n.tagCount = static_cast<uint32_t>(rec.tags.size());
+		for (auto tag : rec.tags) {
+			tags.push_back(symbol(tag));
+		}
+		// Note: new symbol ids do not keep the string order, re-sort so lookups can merge
+		std::sort(tags.begin() + n.tagsFirst, tags.end());
+		notes.push_back(n);
+	}
+
+	Header h;
+	std::memset(&h, 0, sizeof(h));
+	std::memcpy(h.magic, Magic, sizeof(Magic));
+	h.version = Version;
+	h.byteOrder = ByteOrder;
+	h.noteCount = static_cast<uint32_t>(notes.size());
+	h.stringCount = static_cast<uint32_t>(symbols.size());
+	h.tagRefCount = static_cast<uint32_t>(tags.size());
+
+	Image image;
+	image.append(&h, 1);
+
+	std::vector<uint64_t> offsets{0};
+	std::string bytes;
+	for (auto id : symbols) {
+		bytes += pool.str(id);
+		offsets.push_back(bytes.size());
+	}
+	h.stringOffsets = image.append(offsets.data(), offsets.size());
+	h.stringBytes = image.append(bytes.data(), bytes.size());
+
+	h.slotCount = 2;
+	while (h.slotCount < symbols.size() * 2) {
+		h.slotCount *= 2;
+	}
+	std::vector<SymbolId> slots(h.slotCount, StringPool::npos);
+	for (SymbolId s = 0; s < symbols.size(); s++) {
+		auto const &str = pool.str(symbols[s]);
+		auto i = fnv1a(str.data(), str.size()) & (h.slotCount - 1);
+		while (slots[i] != StringPool::npos) {
+			i = (i + 1) & (h.slotCount - 1);
+		}
+		slots[i] = s;
+	}
+	h.slots = image.append(slots.data(), slots.size());
+	h.notes = image.append(notes.data(), notes.size());
+	h.tags = image.append(tags.data(), tags.size());
+
+	// Posting lists by counting sort of the notes, ids come out sorted
+	for (int f = 0; f < FieldCount; f++) {
+		std::vector<uint32_t> begin(symbols.size() + 1, 0);
+		auto forEachKey = [&notes, &tags, f](NoteId id, const std::function<void(SymbolId)> &fn) {
+			auto const &n = notes[id];
+			if (f == Title) {
+				fn(n.title);
+			} else if (f == Text) {
+				fn(n.text);
+			} else {
+				for (uint32_t t = 0; t < n.tagCount; t++) {
+					fn(tags[n.tagsFirst + t]);
+				}
+			}
+		};
+		for (NoteId id = 0; id < notes.size(); id++) {
+			forEachKey(id, [&begin](SymbolId s) { begin[s + 1]++; });
+		}
+		for (size_t s = 0; s < symbols.size(); s++) {
+			begin[s + 1] += begin[s];
+		}
+		std::vector<NoteId> ids(begin.back());
+		std::vector<uint32_t> pos(begin.begin(), begin.end() - 1);
+		for (NoteId id = 0; id < notes.size(); id++) {
+			forEachKey(id, [&ids, &pos, id](SymbolId s) { ids[pos[s]++] = id; });
+		}
+		h.postingOffsets[f] = image.append(begin.data(), begin.size());
+		h.postingIds[f] = image.append(ids.data(), ids.size());
+	}
+
+	auto &data = image.bytes();
+	data.resize((data.size() + 7) & ~size_t(7), 0);
+	h.fileSize = data.size();
+	std::memcpy(data.data(), &h, sizeof(h));
+
+	auto tmp = path + ".tmp";
+	int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		throw ioError("Can not create", tmp);
+	}
+	// Note: errno of the failure is kept for the message, the file is closed and removed on every error
+	auto fail = [&tmp](const std::string &what, int fd) {
+		auto error = ioError(what, tmp);
+		if (fd >= 0) {
+			::close(fd);
+		}
+		::unlink(tmp.c_str());
+		return error;
+	};
+	size_t written = 0;
+	while (written < data.size()) {
+		auto n = ::write(fd, data.data() + written, data.size() - written);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			throw fail("Can not write", fd);
+		}
+		written += n;
+	}
+	if (::fsync(fd) != 0) {
+		throw fail("Can not sync", fd);
+	}
+	if (::close(fd) != 0) {
+		throw fail("Can not write", -1);
+	}
+	if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+		throw fail("Can not rename", -1);
+	}
+	syncParentDirectory(path); // the rename itself
+}
+
+MappedStoryboard::MappedStoryboard(const std::string &path)
+{
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw ioError("Can not open", path);
+	}
+	struct stat st;
+	if (::fstat(fd, &st) != 0) {
+		::close(fd);
+		throw ioError("Can not stat", path);
+	}
+	m_size = st.st_size;
+	if (m_size < sizeof(Header)) {
+		::close(fd);
+		throw std::runtime_error(path + ": not a Storyboard snapshot");
+	}
+	m_data = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (m_data == MAP_FAILED) {
+		m_data = nullptr;
+		auto error = ioError("Can not map", path);
+		::close(fd);
+		throw error;
+	}
+	::close(fd); // Note: the mapping keeps the file referenced
+	try {
+		validate(m_size);
+	} catch (const std::runtime_error &e) {
+		unmap();
+		throw std::runtime_error(path + ": " + e.what());
+	}
+}
+
+MappedStoryboard::~MappedStoryboard()
+{
+	unmap();
+}
+
+MappedStoryboard::MappedStoryboard(MappedStoryboard &&other)
+	: m_data(other.m_data), m_size(other.m_size)
+{
+	other.m_data = nullptr;
+	other.m_size = 0;
+}
+
+MappedStoryboard &MappedStoryboard::operator=(MappedStoryboard &&other)
+{
+	if (this != &other) {
+		unmap();
+		std::swap(m_data, other.m_data);
+		std::swap(m_size, other.m_size);
+	}
+	return *this;
+}
+
+void MappedStoryboard::unmap()
+{
+	if (m_data) {
+		::munmap(m_data, m_size);
+		m_data = nullptr;
+		m_size = 0;
+	}
+}
+
+void MappedStoryboard::validate(size_t fileSize) const
+{
+	auto const &h = header();
+	if (std::memcmp(h.magic, Magic, sizeof(Magic)) != 0) {
+		throw std::runtime_error("not a Storyboard snapshot");
+	}
+	if (h.version != Version || h.byteOrder != ByteOrder) {
+		throw std::runtime_error("unsupported snapshot version or byte order");
+	}
+	if (h.fileSize != fileSize) {
+		throw std::runtime_error("truncated snapshot");
+	}
+	// Every section must fit in the file (contents are trusted, the writer is ours)
+	auto fits = [fileSize](uint64_t offset, uint64_t bytes) { return offset <= fileSize && bytes <= fileSize - offset; };
+	bool ok = fits(h.stringOffsets, (uint64_t(h.stringCount) + 1) * sizeof(uint64_t))
+		&& fits(h.slots, uint64_t(h.slotCount) * sizeof(SymbolId))
+		&& fits(h.notes, uint64_t(h.noteCount) * sizeof(MappedNote))
+		&& fits(h.tags, uint64_t(h.tagRefCount) * sizeof(SymbolId))
+		&& (h.slotCount & (h.slotCount - 1)) == 0 && h.slotCount > h.stringCount;
+	if (ok) {
+		ok = fits(h.stringBytes, section<uint64_t>(h.stringOffsets)[h.stringCount]);
+	}
+	for (int f = 0; ok && f < FieldCount; f++) {
+		ok = fits(h.postingOffsets[f], (uint64_t(h.stringCount) + 1) * sizeof(uint32_t))
+			&& fits(h.postingIds[f], uint64_t(section<uint32_t>(h.postingOffsets[f])[h.stringCount]) * sizeof(NoteId));
+	}
+	if (!ok) {
+		throw std::runtime_error("corrupted snapshot");
+	}
+}
+
+size_t MappedStoryboard::size() const
+{
+	return header().noteCount;
+}
+
+bool MappedStoryboard::equals(SymbolId id, const std::string &str) const
+{
+	auto offsets = section<uint64_t>(header().stringOffsets);
+	auto len = offsets[id + 1] - offsets[id];
+	return len == str.size() && std::memcmp(section<char>(header().stringBytes) + offsets[id], str.data(), len) == 0;
+}
+
+std::string MappedStoryboard::str(SymbolId id) const
+{
+	auto offsets = section<uint64_t>(header().stringOffsets);
+	return std::string(section<char>(header().stringBytes) + offsets[id], offsets[id + 1] - offsets[id]);
+}
+
+SymbolId MappedStoryboard::find(const std::string &str) const
+{
+	auto const &h = header();
+	auto slots = section<SymbolId>(h.slots);
+	auto i = fnv1a(str.data(), str.size()) & (h.slotCount - 1);
+	for (; slots[i] != StringPool::npos; i = (i + 1) & (h.slotCount - 1)) {
+		if (equals(slots[i], str)) {
+			return slots[i];
+		}
+	}
+	return StringPool::npos;
+}
+
+Note MappedStoryboard::note(NoteId id) const
+{
+	auto const &n = section<MappedNote>(header().notes)[id];
+	auto tags = section<SymbolId>(header().tags) + n.tagsFirst;
+	Note note;
+	note.title = str(n.title);
+	note.text = str(n.text);
+	for (uint32_t i = 0; i < n.tagCount; i++) {
+		note.tags.insert(str(tags[i]));
+	}
+	return note;
+}
+
+std::vector<Note> MappedStoryboard::notes() const
+{
+	std::vector<Note> notes;
+	notes.reserve(size());
+	for (NoteId id = 0; id < size(); id++) {
+		notes.push_back(note(id));
+	}
+	return notes;
+}
+
+NoteId MappedStoryboard::findNote(const Note &note) const
+{
+	auto title = find(note.title);
+	auto text = find(note.text);
+	if (title == StringPool::npos || text == StringPool::npos) {
+		return Storyboard::InvalidNoteId;
+	}
+	std::vector<SymbolId> tags;
+	for (auto const &tag : note.tags) {
+		auto sym = find(tag);
+		if (sym == StringPool::npos) {
+			return Storyboard::InvalidNoteId;
+		}
+		tags.push_back(sym);
+	}
+	std::sort(tags.begin(), tags.end());
+
+	auto byTitle = postings(Title, title);
+	auto byText = postings(Text, text);
+	auto const &shorter = byTitle.size() < byText.size() ? byTitle : byText;
+	auto notes = section<MappedNote>(header().notes);
+	auto allTags = section<SymbolId>(header().tags);
+	for (auto id : shorter) {
+		auto const &n = notes[id];
+		if (n.title == title && n.text == text && n.tagCount == tags.size()
+			&& std::equal(tags.begin(), tags.end(), allTags + n.tagsFirst)) {
+			return id;
+		}
+	}
+	return Storyboard::InvalidNoteId;
+}
+
+using Result = MappedStoryboard::Result;
+
+Result MappedStoryboard::postings(Field field, SymbolId key) const
+{
+	auto offsets = section<uint32_t>(header().postingOffsets[field]);
+	auto ids = section<NoteId>(header().postingIds[field]);
+	return Result(this, ids + offsets[key], ids + offsets[key + 1]);
+}
+
+Result MappedStoryboard::postings(Field field, const std::string &key) const
+{
+	auto sym = find(key);
+	return sym == StringPool::npos ? Result() : postings(field, sym);
+}
+
+Result MappedStoryboard::searchByTitle(const std::string &title) const
+{
+	return postings(Title, title);
+}
+
+Result MappedStoryboard::searchByText(const std::string &text) const
+{
+	return postings(Text, text);
+}
+
+Result MappedStoryboard::searchByTag(const std::string &tag) const
+{
+	return postings(Tag, tag);
+}
+
+std::vector<NoteId> MappedStoryboard::unite(Field field, const std::set<std::string> &keys) const
+{
+	std::vector<NoteId> ids;
+	std::vector<NoteId> tmp;
+	for (auto const &key : keys) {
+		auto list = postings(field, key);
+		tmp.clear();
+		PostingAlgebra::unite(ids.data(), ids.size(), list.begin(), list.size(), tmp);
+		ids.swap(tmp);
+	}
+	return ids;
+}
+
+Result MappedStoryboard::searchByTag(const std::set<std::string> &tags) const
+{
+	return Result(this, unite(Tag, tags));
+}
+
+Result MappedStoryboard::searchByTags(const Storyboard::TagQuery &query) const
+{
+	if (query.allOf.empty() && query.anyOf.empty()) {
+		return Result();
+	}
+
+	std::vector<NoteId> ids;
+	std::vector<NoteId> tmp;
+	bool first = true;
+
+	if (!query.allOf.empty()) {
+		std::vector<Result> lists;
+		for (auto const &tag : query.allOf) {
+			lists.push_back(postings(Tag, tag));
+			if (lists.back().empty()) {
+				return Result();
+			}
+		}
+		std::sort(lists.begin(), lists.end(), [](const Result &a, const Result &b) { return a.size() < b.size(); });
+		ids = lists[0].ids();
+		for (size_t i = 1; i < lists.size() && !ids.empty(); i++) {
+			tmp.clear();
+			PostingAlgebra::intersect(ids.data(), ids.size(), lists[i].begin(), lists[i].size(), tmp);
+			ids.swap(tmp);
+		}
+		first = false;
+	}
+
+	if (!query.anyOf.empty()) {
+		auto any = unite(Tag, query.anyOf);
+		if (first) {
+			ids.swap(any);
+		} else {
+			tmp.clear();
+			PostingAlgebra::intersect(ids, any, tmp);
+			ids.swap(tmp);
+		}
+	}
+
+	for (auto const &tag : query.noneOf) {
+		auto list = postings(Tag, tag);
+		if (!list.empty() && !ids.empty()) {
+			tmp.clear();
+			PostingAlgebra::subtract(ids.data(), ids.size(), list.begin(), list.size(), tmp);
+			ids.swap(tmp);
+		}
+	}
+	return Result(this, std::move(ids));
+}
+
+MappedStoryboard::NoteSet MappedStoryboard::Result::toNoteSet() const
+{
+	NoteSet notes;
+	for (auto id : *this) {
+		notes.insert(m_board->note(id));
+	}
+	return notes;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+// Martin Flaska - flegy@flegy.sk / https://www.linkedin.com/in/martinflaska
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Storyboard.h"
+
+
+/** Read only Storyboard answering queries straight from a memory mapped snapshot
+ *
+ * Opening a snapshot costs a mmap() and a header check, nothing is deserialized: lookups hash
+ * the key into the mapped string table and return spans of the mapped posting lists. Pages are
+ * loaded lazily and shared (page cache) by all the processes mapping the same file.
+ *
+ * Snapshot layout (native byte order, every section 8 byte aligned):
+ *  - Header
+ *  - strings: offsets uint64_t[S + 1] into the string bytes, then the bytes
+ *  - string hash table: SymbolId slots (power of 2, linear probing, FNV-1a), empty slot = npos
+ *  - notes: MappedNote[N], then SymbolId tags[] the notes refer to (sorted per note)
+ *  - title, text and tag posting lists (CSR): offsets uint32_t[S + 1], then NoteId ids[]
+ *
+ * Only live notes are stored and they get renumbered to 0 .. N-1 (in their original order).
+ */
+class MappedStoryboard
+{
+public:
+	typedef Storyboard::NoteSet NoteSet;
+
+	/** Write snapshot of @board to @path (via a temporary file and rename, so it is atomic)
+	 * @throw std::runtime_error on I/O errors
+	 */
+	static void save(const Storyboard &board, const std::string &path);
+
+	/** Map snapshot @path
+	 * @throw std::runtime_error if the file can not be mapped or is not a valid snapshot
+	 */
+	explicit MappedStoryboard(const std::string &path);
+	~MappedStoryboard();
+
+	MappedStoryboard(MappedStoryboard &&other);
+	MappedStoryboard &operator=(MappedStoryboard &&other);
+	MappedStoryboard(const MappedStoryboard &) = delete;
+	MappedStoryboard &operator=(const MappedStoryboard &) = delete;
+
+	/** Search results, note ids in the mapped posting list or an owned vector (combined results) */
+	class Result
+	{
+	public:
+		Result() = default;
+		Result(const MappedStoryboard *board, const NoteId *first, const NoteId *last)
+			: m_board(board), m_first(first), m_last(last) {}
+		Result(const MappedStoryboard *board, std::vector<NoteId> &&ids)
+			: m_board(board), m_owned(std::move(ids)) {}
+
+		const NoteId *begin() const { return m_owned.empty() ? m_first : m_owned.data(); }
+		const NoteId *end() const { return m_owned.empty() ? m_last : m_owned.data() + m_owned.size(); }
+		size_t size() const { return end() - begin(); }
+		bool empty() const { return size() == 0; }
+		bool contains(NoteId id) const { return std::binary_search(begin(), end(), id); }
+
+		NoteSet toNoteSet() const;
+		std::vector<NoteId> ids() const { return std::vector<NoteId>(begin(), end()); }
+
+	private:
+		const MappedStoryboard *m_board = nullptr;
+		const NoteId *m_first = nullptr;
+		const NoteId *m_last = nullptr;
+		std::vector<NoteId> m_owned;
+	};
+
+	/** Same semantics as the Storyboard lookups
+	 *
+	 * @{
+	 */
+	Result searchByTitle(const std::string &title) const;
+	Result searchByText(const std::string &text) const;
+	Result searchByTag(const std::string &tag) const;
+	Result searchByTag(const std::set<std::string> &tags) const;
+	Result searchByTags(const Storyboard::TagQuery &query) const;
+	/* @} */
+
+	/** @return Note id or Storyboard::InvalidNoteId */
+	NoteId findNote(const Note &note) const;
+	Note note(NoteId id) const;
+	/** All the notes, e.g. to load the snapshot into a Storyboard */
+	std::vector<Note> notes() const;
+	size_t size() const;
+
+private:
+	struct Header;
+	struct MappedNote
+	{
+		SymbolId title;
+		SymbolId text;
+		uint32_t tagsFirst;
+		uint32_t tagCount;
+	};
+
+	enum Field { Title, Text, Tag, FieldCount };
+
+	const Header &header() const { return *static_cast<const Header*>(m_data); }
+	template<typename T>
+	const T *section(uint64_t offset) const
+	{
+		return reinterpret_cast<const T*>(static_cast<const char*>(m_data) + offset);
+	}
+
+	/** @return Symbol of @str or StringPool::npos */
+	SymbolId find(const std::string &str) const;
+	std::string str(SymbolId id) const;
+	bool equals(SymbolId id, const std::string &str) const;
+	Result postings(Field field, const std::string &key) const;
+	Result postings(Field field, SymbolId key) const;
+	std::vector<NoteId> unite(Field field, const std::set<std::string> &keys) const;
+
+	void validate(size_t fileSize) const;
+	void unmap();
+
+private:
+	void *m_data = nullptr;
+	size_t m_size = 0;
+};
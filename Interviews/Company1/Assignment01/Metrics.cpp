@@ -0,0 +1,309 @@
+#include "Metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <sstream>
+
+
+namespace {
+
+const char *seriesName(Metrics::Series series)
+{
+	static const char *names[] = {
+		"addNote", "addNotes", "deleteNote",
+		"searchByTitle", "searchByText", "searchByTag", "searchByTags", "searchByWords", "searchByPhrase",
+	};
+	return names[series];
+}
+
+/** Escape @s for a Prometheus label value or a JSON string (the same rules for \, " and new line) */
+std::string escape(const std::string &s, bool json)
+{
+	std::string out;
+	out.reserve(s.size());
+	for (unsigned char c : s) {
+		if (c == '\\' || c == '"') {
+			out.push_back('\\');
+			out.push_back(static_cast<char>(c));
+		} else if (c == '\n') {
+			out += "\\n";
+		} else if (json && c < 0x20) {
+			char buf[8];
+			std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+			out += buf;
+		} else {
+			out.push_back(static_cast<char>(c));
+		}
+	}
+	return out;
+}
+
+/** Sample value, exact for integers (counts, ns sums) and round-trippable otherwise */
+std::string formatValue(double value)
+{
+	char buf[32];
+	if (std::fabs(value) < 9007199254740992.0 && value == std::floor(value)) { // 2^53, all integers are exact
+		std::snprintf(buf, sizeof(buf), "%lld", static_cast<long long>(value));
+	} else {
+		std::snprintf(buf, sizeof(buf), "%.17g", value);
+	}
+	return buf;
+}
+
+/** Slots of the running threads, the lowest free one is handed out first so they stay dense */
+class SlotRegistry
+{
+public:
+	unsigned claim()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_free.empty()) {
+			return m_next++;
+		}
+		auto slot = m_free.top();
+		m_free.pop();
+		return slot;
+	}
+	void release(unsigned slot)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_free.push(slot);
+	}
+
+private:
+	std::mutex m_mutex;
+	std::priority_queue<unsigned, std::vector<unsigned>, std::greater<unsigned>> m_free;
+	unsigned m_next = 0;
+};
+
+SlotRegistry &slotRegistry()
+{
+	static auto registry = new SlotRegistry(); // Note: never destroyed, threads may exit after static destructors
+	return *registry;
+}
+
+/** Slot held by a thread for its lifetime */
+struct ThreadSlot
+{
+	ThreadSlot() : slot(slotRegistry().claim()) {}
+	~ThreadSlot() { slotRegistry().release(slot); }
+	unsigned slot;
+};
+
+} // anonymous ns
+
+const unsigned Histogram::SubBits;
+const size_t Histogram::BucketCount;
+
+void Histogram::record(uint64_t value, uint64_t times)
+{
+	if (times == 0) {
+		return;
+	}
+	if (m_buckets.empty()) {
+		m_buckets.resize(BucketCount);
+	}
+	m_buckets[bucketOf(value)] += times;
+	m_count += times;
+	m_sum += value * times;
+	m_max = std::max(m_max, value);
+}
+
+void Histogram::merge(const Histogram &other)
+{
+	if (other.m_count == 0) {
+		return;
+	}
+	if (m_buckets.empty()) {
+		m_buckets.resize(BucketCount);
+	}
+	for (size_t i = 0; i < BucketCount; i++) {
+		m_buckets[i] += other.m_buckets[i];
+	}
+	m_count += other.m_count;
+	m_sum += other.m_sum;
+	m_max = std::max(m_max, other.m_max);
+}
+
+uint64_t Histogram::quantile(double q) const
+{
+	if (m_count == 0) {
+		return 0;
+	}
+	// nearest rank
+	auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * m_count)));
+	uint64_t seen = 0;
+	for (size_t i = 0; i < BucketCount; i++) {
+		seen += m_buckets[i];
+		if (seen >= rank) {
+			auto upper = i + 1 < BucketCount ? lowerBound(i + 1) - 1 : UINT64_MAX;
+			return std::min(upper, m_max);
+		}
+	}
+	return m_max;
+}
+
+
+void MetricsReport::add(const std::string &name, const char *type, const Labels &labels, double value)
+{
+	m_samples.push_back({name, type, labels, value});
+}
+
+void MetricsReport::summary(const std::string &name, const Labels &labels, const Histogram &h)
+{
+	for (auto q : {"0.5", "0.9", "0.99"}) {
+		auto l = labels;
+		l.emplace_back("quantile", q);
+		add(name, "summary", l, static_cast<double>(h.quantile(std::stod(q))));
+	}
+	add(name + "_sum", "summary", labels, static_cast<double>(h.sum()));
+	add(name + "_count", "summary", labels, static_cast<double>(h.count()));
+}
+
+std::string MetricsReport::prometheus() const
+{
+	// Samples of a family have to be together, families are kept in the order of their first sample
+	std::vector<std::pair<std::string, std::vector<const Sample*>>> families;
+	for (auto const &s : m_samples) {
+		// summary _sum / _count belong to their base name
+		auto base = s.name;
+		if (std::string(s.type) == "summary") {
+			for (auto suffix : {"_sum", "_count"}) {
+				auto n = std::string(suffix).size();
+				if (base.size() > n && base.compare(base.size() - n, n, suffix) == 0) {
+					base.resize(base.size() - n);
+				}
+			}
+		}
+		auto it = std::find_if(families.begin(), families.end(), [&base](const std::pair<std::string, std::vector<const Sample*>> &f) {
+			return f.first == base;
+		});
+		if (it == families.end()) {
+			families.emplace_back(base, std::vector<const Sample*>());
+			it = families.end() - 1;
+		}
+		it->second.push_back(&s);
+	}
+
+	std::ostringstream os;
+	for (auto const &family : families) {
+		os << "# TYPE " << family.first << " " << family.second.front()->type << "\n";
+		for (auto s : family.second) {
+			os << s->name;
+			if (!s->labels.empty()) {
+				os << "{";
+				for (size_t i = 0; i < s->labels.size(); i++) {
+					os << (i ? "," : "") << s->labels[i].first << "=\"" << escape(s->labels[i].second, false) << "\"";
+				}
+				os << "}";
+			}
+			os << " " << formatValue(s->value) << "\n";
+		}
+	}
+	return os.str();
+}
+
+std::string MetricsReport::json() const
+{
+	std::ostringstream os;
+	os << "[";
+	for (size_t i = 0; i < m_samples.size(); i++) {
+		auto const &s = m_samples[i];
+		os << (i ? "," : "") << "\n\t{\"name\": \"" << s.name << "\", \"type\": \"" << s.type << "\", \"labels\": {";
+		for (size_t j = 0; j < s.labels.size(); j++) {
+			os << (j ? ", " : "") << "\"" << s.labels[j].first << "\": \"" << escape(s.labels[j].second, true) << "\"";
+		}
+		os << "}, \"value\": " << formatValue(s.value) << "}";
+	}
+	os << "\n]\n";
+	return os.str();
+}
+
+
+const unsigned Metrics::ChunkSize;
+const unsigned Metrics::ChunkCount;
+const unsigned Metrics::MaxThreads;
+
+Metrics::~Metrics()
+{
+	for (auto &c : m_chunks) {
+		auto chunk = c.load();
+		if (!chunk) {
+			continue;
+		}
+		for (auto &s : chunk->stripes) {
+			delete s.load();
+		}
+		delete chunk;
+	}
+}
+
+Histogram Metrics::histogram(Series series) const
+{
+	Histogram h;
+	forEachStripe([&h, series](const Stripe &stripe) {
+		auto const &a = stripe.series[series];
+		if (h.m_buckets.empty()) {
+			h.m_buckets.resize(Histogram::BucketCount);
+		}
+		for (size_t i = 0; i < Histogram::BucketCount; i++) {
+			auto n = a.buckets[i].load(std::memory_order_relaxed);
+			h.m_buckets[i] += n;
+			h.m_count += n;
+		}
+		h.m_sum += a.sum.load(std::memory_order_relaxed);
+		h.m_max = std::max(h.m_max, a.max.load(std::memory_order_relaxed));
+	});
+	return h;
+}
+
+uint64_t Metrics::counter(Counter counter) const
+{
+	uint64_t n = 0;
+	forEachStripe([&n, counter](const Stripe &stripe) {
+		n += stripe.counters[counter].load(std::memory_order_relaxed);
+	});
+	return n;
+}
+
+void Metrics::report(MetricsReport &report, const std::string &prefix) const
+{
+	for (int s = 0; s < CompactionScan; s++) {
+		report.summary(prefix + "op_latency_ns", {{"op", seriesName(static_cast<Series>(s))}}, histogram(static_cast<Series>(s)));
+	}
+	report.summary(prefix + "compaction_scan_ids", {}, histogram(CompactionScan));
+	report.add(prefix + "duplicate_notes_total", "counter", {}, static_cast<double>(counter(DuplicateNotes)));
+	report.add(prefix + "compactions_total", "counter", {}, static_cast<double>(counter(Compactions)));
+}
+
+unsigned Metrics::threadSlot()
+{
+	static thread_local ThreadSlot slot;
+	return slot.slot;
+}
+
+Metrics::Stripe &Metrics::allocate(unsigned slot)
+{
+	auto &c = m_chunks[slot / ChunkSize];
+	auto chunk = c.load(std::memory_order_acquire);
+	if (!chunk) {
+		auto fresh = new Chunk();
+		if (c.compare_exchange_strong(chunk, fresh, std::memory_order_acq_rel)) {
+			chunk = fresh;
+		} else {
+			delete fresh; // another thread of the same chunk was faster
+		}
+	}
+	auto &s = chunk->stripes[slot % ChunkSize];
+	auto fresh = new Stripe();
+	Stripe *expected = nullptr;
+	if (!s.compare_exchange_strong(expected, fresh, std::memory_order_acq_rel)) {
+		delete fresh; // a thread sharing the slot (over MaxThreads) was faster
+		return *expected;
+	}
+	return *fresh;
+}
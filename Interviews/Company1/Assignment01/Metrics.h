@@ -0,0 +1,226 @@
+#pragma once
+
+// Martin Flaska - flegy@flegy.sk / https://www.linkedin.com/in/martinflaska
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+/** Log-linear (HDR style) histogram of non-negative integers
+ *
+ * Every power of 2 is split into 2^SubBits linear buckets, so any value is recorded with
+ * at most 1 / 2^SubBits relative error in constant memory, no matter the range.
+ */
+class Histogram
+{
+	friend class Metrics; // sums up its stripes
+
+public:
+	static const unsigned SubBits = 3;
+	static const size_t BucketCount = (64 - SubBits + 1) << SubBits;
+
+	static size_t bucketOf(uint64_t value)
+	{
+		if (value < (1u << SubBits)) {
+			return static_cast<size_t>(value);
+		}
+		unsigned shift = 63 - __builtin_clzll(value) - SubBits;
+		return ((shift + 1) << SubBits) | ((value >> shift) & ((1u << SubBits) - 1));
+	}
+	/** The smallest value of @bucket */
+	static uint64_t lowerBound(size_t bucket)
+	{
+		if (bucket < (1u << SubBits)) {
+			return bucket;
+		}
+		unsigned shift = static_cast<unsigned>(bucket >> SubBits) - 1;
+		return ((1ull << SubBits) | (bucket & ((1u << SubBits) - 1))) << shift;
+	}
+
+	void record(uint64_t value, uint64_t times = 1);
+	void merge(const Histogram &other);
+
+	uint64_t count() const { return m_count; }
+	uint64_t sum() const { return m_sum; }
+	uint64_t max() const { return m_max; }
+	/** Value at quantile @q in [0, 1] (upper bound of its bucket, at most max()) */
+	uint64_t quantile(double q) const;
+
+private:
+	std::vector<uint64_t> m_buckets; // allocated with the first value
+	uint64_t m_count = 0;
+	uint64_t m_sum = 0;
+	uint64_t m_max = 0;
+};
+
+
+/** Flat list of metric samples rendered as Prometheus text exposition format or JSON */
+class MetricsReport
+{
+public:
+	typedef std::vector<std::pair<std::string, std::string>> Labels;
+
+	void add(const std::string &name, const char *type, const Labels &labels, double value);
+	/** Quantiles, _sum and _count of @h as a Prometheus summary */
+	void summary(const std::string &name, const Labels &labels, const Histogram &h);
+
+	std::string prometheus() const;
+	std::string json() const;
+
+private:
+	struct Sample
+	{
+		std::string name;
+		const char *type;
+		Labels labels;
+		double value;
+	};
+
+	std::vector<Sample> m_samples;
+};
+
+
+/** Operation latencies and counters of a board
+ *
+ * Recording has to be cheap and lock-free also for const searches running concurrently, so
+ * every thread records into its own stripe (allocated on its first use) with relaxed atomic
+ * adds on cache lines no other thread writes to. Stripes are indexed by a slot a thread claims
+ * from a process wide registry and returns when it exits, so they stay per thread for up to
+ * MaxThreads running threads (more share stripes, still correct, just contended). Readers sum
+ * up the stripes.
+ *
+ * Instrumentation of the board is compiled in with STORYBOARD_METRICS only (see the macros
+ * below, off by default as timing costs two clock reads per operation), without it nothing
+ * gets recorded.
+ *
+ * @note Copies start empty.
+ */
+class Metrics
+{
+public:
+	/** Recorded distributions: latencies (ns) of the operations and other sizes */
+	enum Series {
+		AddNote, AddNotes, DeleteNote,
+		SearchByTitle, SearchByText, SearchByTag, SearchByTags, SearchByWords, SearchByPhrase,
+		CompactionScan, ///< ids scanned by a posting list compaction
+		SeriesCount
+	};
+	enum Counter {
+		DuplicateNotes, ///< notes not added as they were present already
+		Compactions,    ///< posting list compactions
+		CounterCount
+	};
+
+	/** Records the lifetime of the object into a latency series */
+	class Timer
+	{
+	public:
+		Timer(Metrics &metrics, Series series) : m_metrics(metrics), m_series(series), m_start(Clock::now()) {}
+		~Timer()
+		{
+			auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - m_start).count();
+			m_metrics.record(m_series, static_cast<uint64_t>(ns));
+		}
+
+	private:
+		Metrics &m_metrics;
+		Series m_series;
+		std::chrono::steady_clock::time_point m_start;
+	};
+
+	Metrics() = default;
+	Metrics(const Metrics &) : Metrics() {}
+	Metrics &operator=(const Metrics &) { return *this; }
+	~Metrics();
+
+	void record(Series series, uint64_t value)
+	{
+		auto &h = stripe().series[series];
+		h.buckets[Histogram::bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+		h.sum.fetch_add(value, std::memory_order_relaxed);
+		auto max = h.max.load(std::memory_order_relaxed);
+		while (value > max && !h.max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+		}
+	}
+	void add(Counter counter, uint64_t n = 1)
+	{
+		stripe().counters[counter].fetch_add(n, std::memory_order_relaxed);
+	}
+
+	/** Sum of all the stripes */
+	Histogram histogram(Series series) const;
+	uint64_t counter(Counter counter) const;
+
+	/** Add the series and counters to @report (samples prefixed with @prefix) */
+	void report(MetricsReport &report, const std::string &prefix) const;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+	static const unsigned ChunkSize = 64;
+	static const unsigned ChunkCount = 64;
+	static const unsigned MaxThreads = ChunkSize * ChunkCount;
+
+	struct AtomicHistogram
+	{
+		std::atomic<uint64_t> buckets[Histogram::BucketCount] = {};
+		std::atomic<uint64_t> sum{0};
+		std::atomic<uint64_t> max{0};
+	};
+	struct alignas(64) Stripe
+	{
+		AtomicHistogram series[SeriesCount];
+		std::atomic<uint64_t> counters[CounterCount] = {};
+	};
+	/** Stripes of ChunkSize consecutive slots, allocated once one of them records */
+	struct Chunk
+	{
+		std::atomic<Stripe*> stripes[ChunkSize] = {};
+	};
+
+	/** Slot of the calling thread, unique among the running threads (reused after a thread exits) */
+	static unsigned threadSlot();
+
+	Stripe &stripe()
+	{
+		auto slot = threadSlot() % MaxThreads;
+		auto chunk = m_chunks[slot / ChunkSize].load(std::memory_order_acquire);
+		auto s = chunk ? chunk->stripes[slot % ChunkSize].load(std::memory_order_acquire) : nullptr;
+		return s ? *s : allocate(slot);
+	}
+	Stripe &allocate(unsigned slot);
+	/** Call @f for every allocated stripe */
+	template<typename F>
+	void forEachStripe(F f) const
+	{
+		for (auto &c : m_chunks) {
+			auto chunk = c.load(std::memory_order_acquire);
+			if (!chunk) {
+				continue;
+			}
+			for (auto &s : chunk->stripes) {
+				auto stripe = s.load(std::memory_order_acquire);
+				if (stripe) {
+					f(*stripe);
+				}
+			}
+		}
+	}
+
+private:
+	std::atomic<Chunk*> m_chunks[ChunkCount] = {};
+};
+
+
+#ifdef STORYBOARD_METRICS
+#define STORYBOARD_TIME(metrics, series) Metrics::Timer metricsTimer(metrics, Metrics::series)
+#define STORYBOARD_RECORD(metrics, series, value) (metrics).record(Metrics::series, value)
+#define STORYBOARD_COUNT(metrics, counter, n) (metrics).add(Metrics::counter, n)
+#else
+#define STORYBOARD_TIME(metrics, series) ((void)0)
+#define STORYBOARD_RECORD(metrics, series, value) ((void)0)
+#define STORYBOARD_COUNT(metrics, counter, n) ((void)0)
+#endif
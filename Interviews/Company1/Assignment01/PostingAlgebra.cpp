@@ -0,0 +1,446 @@
+#include "PostingAlgebra.h"
+
+#include <algorithm>
+#include <iterator>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define POSTING_ALGEBRA_X86 1
+#include <immintrin.h>
+#endif
+
+
+namespace PostingAlgebra {
+
+namespace {
+
+// Galloping pays off once one list is this many times longer than the other
+const size_t GallopRatio = 32;
+
+/** First position >= @pos in @arr with arr[pos] >= @x, exponential search from @pos */
+size_t gallop(const NoteId *arr, size_t n, size_t pos, NoteId x)
+{
+	if (pos >= n || arr[pos] >= x) {
+		return pos;
+	}
+	size_t lo = pos; // arr[lo] < x
+	size_t step = 1;
+	size_t hi = lo + step;
+	while (hi < n && arr[hi] < x) {
+		lo = hi;
+		step *= 2;
+		hi = lo + step;
+	}
+	return std::lower_bound(arr + lo + 1, arr + std::min(hi, n), x) - arr;
+}
+
+/** a AND NOT b for a much shorter @b: copy the gaps between b items */
+void subtractGallopingLarge(const NoteId *a, size_t na, const NoteId *b, size_t nb, std::vector<NoteId> &out)
+{
+	size_t pos = 0;
+	for (size_t j = 0; j < nb && pos < na; j++) {
+		auto p = gallop(a, na, pos, b[j]);
+		out.insert(out.end(), a + pos, a + p);
+		pos = (p < na && a[p] == b[j]) ? p + 1 : p;
+	}
+	out.insert(out.end(), a + pos, a + na);
+}
+
+/** a OR b for a much shorter @b: copy runs of @a between b items */
+void uniteGalloping(const NoteId *a, size_t na, const NoteId *b, size_t nb, std::vector<NoteId> &out)
+{
+	size_t pos = 0;
+	for (size_t j = 0; j < nb; j++) {
+		auto p = gallop(a, na, pos, b[j]);
+		out.insert(out.end(), a + pos, a + p);
+		out.push_back(b[j]);
+		pos = (p < na && a[p] == b[j]) ? p + 1 : p;
+	}
+	out.insert(out.end(), a + pos, a + na);
+}
+
+/** a AND NOT b for a much shorter @a */
+void subtractGallopingSmall(const NoteId *a, size_t na, const NoteId *b, size_t nb, std::vector<NoteId> &out)
+{
+	size_t pos = 0;
+	for (size_t i = 0; i < na; i++) {
+		pos = gallop(b, nb, pos, a[i]);
+		if (pos >= nb || b[pos] != a[i]) {
+			out.push_back(a[i]);
+		}
+	}
+}
+
+void intersectScalar(const NoteId *a, size_t na, const NoteId *b, size_t nb, std::vector<NoteId> &out)
+{
+	std::set_intersection(a, a + na, b, b + nb, std::back_inserter(out));
+}
+
+void uniteScalar(const NoteId *a, size_t na, const NoteId *b, size_t nb, std::vector<NoteId> &out)
+{
+	std::set_union(a, a + na, b, b + nb, std::back_inserter(out));
+}
+
+void subtractScalar(const NoteId *a, size_t na, const NoteId *b, size_t nb, std::vector<NoteId> &out)
+{
+	std::set_difference(a, a + na, b, b + nb, std::back_inserter(out));
+}
+
+/** Scalar tail of a block subtraction, @matched marks items of the first a block already found in b */
+void subtractTail(const NoteId *a, size_t na, const NoteId *b, size_t nb, int matched, std::vector<NoteId> &out)
+{
+	size_t j = 0;
+	for (size_t i = 0; i < na; i++) {
+		if (i < 8 && ((matched >> i) & 1)) {
+			continue;
+		}
+		while (j < nb && b[j] < a[i]) {
+			j++;
+		}
+		if (j < nb && b[j] == a[i]) {
+			continue;
+		}
+		out.push_back(a[i]);
+	}
+}
+
+#ifdef POSTING_ALGEBRA_X86
+
+// The SIMD kernels compare a block of a against all rotations of a block of b (all-pairs),
+// ids are unique so every match is found exactly once. The block with the smaller last item
+// is consumed, the other stays for the next round.
+
+__attribute__((target("sse4.1")))
+int matchMaskSse(const NoteId *a, const NoteId *b)
+{
+	__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a));
+	__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b));
+	__m128i c = _mm_cmpeq_epi32(va, vb);
+	c = _mm_or_si128(c, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1))));
+	c = _mm_or_si128(c, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))));
+	c = _mm_or_si128(c, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3))));
+	return _mm_movemask_ps(_mm_castsi128_ps(c));
+}
+
+__attribute__((target("avx2")))
+int matchMaskAvx2(const NoteId *a, const NoteId *b)
+{
+	const __m256i rot = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+	__m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a));
+	__m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b));
+	__m256i c = _mm256_cmpeq_epi32(va, vb);
+	for (int r = 1; r < 8; r++) {
+		vb = _mm256_permutevar8x32_epi32(vb, rot);
+		c = _mm256_or_si256(c, _mm256_cmpeq_epi32(va, vb));
+	}
+	return _mm256_movemask_ps(_mm256_castsi256_ps(c));
+}
+
+template<size_t Width, int (*MatchMask)(const NoteId*, const NoteId*)>
+void intersectBlocks(const NoteId *a, size_t na, const NoteId *b, size_t nb, std::vector<NoteId> &out)
+{
+	size_t i = 0, j = 0;
+	auto na_ = na - na % Width;
+	auto nb_ = nb - nb % Width;
+	while (i < na_ && j < nb_) {
+		int mask = MatchMask(a + i, b + j);
+		while (mask) {
+			out.push_back(a[i + __builtin_ctz(mask)]);
+			mask &= mask - 1;
+		}
+		auto amax = a[i + Width - 1];
+		auto bmax = b[j + Width - 1];
+		if (amax <= bmax) {
+			i += Width;
+		}
+		if (bmax <= amax) {
+			j += Width;
+		}
+	}
+	intersectScalar(a + i, na - i, b + j, nb - j, out);
+}
+
+template<size_t Width, int (*MatchMask)(const NoteId*, const NoteId*)>
+void subtractBlocks(const NoteId *a, size_t na, const NoteId *b, size_t nb, std::vector<NoteId> &out)
+{
+	size_t i = 0, j = 0;
+	auto na_ = na - na % Width;
+	auto nb_ = nb - nb % Width;
+	int matched = 0; // items of the current a block found in b so far
+	while (i < na_ && j < nb_) {
+		matched |= MatchMask(a + i, b + j);
+		auto amax = a[i + Width - 1];
+		auto bmax = b[j + Width - 1];
+		if (amax <= bmax) {
+			for (size_t k = 0; k < Width; k++) {
+				if (!((matched >> k) & 1)) {
+					out.push_back(a[i + k]);
+				}
+			}
+			matched = 0;
+			i += Width;
+		}
+		if (bmax <= amax) {
+			j += Width;
+		}
+	}
+	subtractTail(a + i, na - i, b + j, nb - j, matched, out);
+}
+
+/** Merge two sorted vectors: @vmin gets the 4 smallest, @vmax the 4 largest items (sorted) */
+__attribute__((target("sse4.1")))
+inline void mergeSse(__m128i a, __m128i b, __m128i &vmin, __m128i &vmax)
+{
+	__m128i tmp = _mm_min_epu32(a, b);
+	vmax = _mm_max_epu32(a, b);
+	tmp = _mm_alignr_epi8(tmp, tmp, 4);
+	vmin = _mm_min_epu32(tmp, vmax);
+	vmax = _mm_max_epu32(tmp, vmax);
+	tmp = _mm_alignr_epi8(vmin, vmin, 4);
+	vmin = _mm_min_epu32(tmp, vmax);
+	vmax = _mm_max_epu32(tmp, vmax);
+	tmp = _mm_alignr_epi8(vmin, vmin, 4);
+	vmin = _mm_min_epu32(tmp, vmax);
+	vmax = _mm_max_epu32(tmp, vmax);
+	vmin = _mm_alignr_epi8(vmin, vmin, 4);
+}
+
+/** Appends sorted items skipping duplicates (an id can come from both lists) */
+class UniqueAppender
+{
+public:
+	explicit UniqueAppender(std::vector<NoteId> &out) : m_out(out) {}
+
+	void operator()(NoteId id)
+	{
+		if (!m_any || id != m_last) {
+			m_out.push_back(id);
+			m_last = id;
+			m_any = true;
+		}
+	}
+
+private:
+	std::vector<NoteId> &m_out;
+	NoteId m_last = 0;
+	bool m_any = false;
+};
+
+__attribute__((target("sse4.1")))
+void uniteSse(const NoteId *a, size_t na, const NoteId *b, size_t nb, std::vector<NoteId> &out)
+{
+	if (na < 4 || nb < 4) {
+		uniteScalar(a, na, b, nb, out);
+		return;
+	}
+
+	UniqueAppender append(out);
+	alignas(16) NoteId buf[4];
+	auto emit = [&](__m128i v) {
+		_mm_store_si128(reinterpret_cast<__m128i*>(buf), v);
+		for (auto id : buf) {
+			append(id);
+		}
+	};
+
+	__m128i vmin, vmax;
+	mergeSse(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a)),
+		_mm_loadu_si128(reinterpret_cast<const __m128i*>(b)), vmin, vmax);
+	emit(vmin);
+
+	size_t i = 4, j = 4;
+	auto na4 = na & ~size_t(3);
+	auto nb4 = nb & ~size_t(3);
+	while (i < na4 && j < nb4) {
+		__m128i next;
+		if (a[i] <= b[j]) {
+			next = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+			i += 4;
+		} else {
+			next = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + j));
+			j += 4;
+		}
+		mergeSse(next, vmax, vmin, vmax);
+		emit(vmin);
+	}
+
+	// Scalar 3-way merge of the rest: the pending maximums and both tails
+	_mm_store_si128(reinterpret_cast<__m128i*>(buf), vmax);
+	size_t k = 0;
+	while (k < 4 || i < na || j < nb) {
+		NoteId v;
+		if (k < 4 && (i >= na || buf[k] <= a[i]) && (j >= nb || buf[k] <= b[j])) {
+			v = buf[k++];
+		} else if (i < na && (j >= nb || a[i] <= b[j])) {
+			v = a[i++];
+		} else {
+			v = b[j++];
+		}
+		append(v);
+	}
+}
+
+void intersectSse(const NoteId *a, size_t na, const NoteId *b, size_t nb, std::vector<NoteId> &out)
+{
+	intersectBlocks<4, matchMaskSse>(a, na, b, nb, out);
+}
+
+void intersectAvx2(const NoteId *a, size_t na, const NoteId *b, size_t nb, std::vector<NoteId> &out)
+{
+	intersectBlocks<8, matchMaskAvx2>(a, na, b, nb, out);
+}
+
+void subtractSse(const NoteId *a, size_t na, const NoteId *b, size_t nb, std::vector<NoteId> &out)
+{
+	subtractBlocks<4, matchMaskSse>(a, na, b, nb, out);
+}
+
+void subtractAvx2(const NoteId *a, size_t na, const NoteId *b, size_t nb, std::vector<NoteId> &out)
+{
+	subtractBlocks<8, matchMaskAvx2>(a, na, b, nb, out);
+}
+
+#endif // POSTING_ALGEBRA_X86
+
+Kernel resolve(Kernel kernel)
+{
+	if (kernel == Kernel::Auto) {
+		static const Kernel best = bestKernel();
+		return best;
+	}
+	return isSupported(kernel) ? kernel : Kernel::Scalar;
+}
+
+} // anonymous ns
+
+
+Kernel bestKernel()
+{
+	if (isSupported(Kernel::Avx2)) {
+		return Kernel::Avx2;
+	}
+	if (isSupported(Kernel::Sse)) {
+		return Kernel::Sse;
+	}
+	return Kernel::Scalar;
+}
+
+bool isSupported(Kernel kernel)
+{
+	switch (kernel) {
+	case Kernel::Auto:
+	case Kernel::Scalar:
+		return true;
+#ifdef POSTING_ALGEBRA_X86
+	case Kernel::Sse:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse4.1");
+	case Kernel::Avx2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("sse4.1");
+#endif
+	default:
+		return false;
+	}
+}
+
+const char *kernelName(Kernel kernel)
+{
+	switch (kernel) {
+	case Kernel::Auto: return "auto";
+	case Kernel::Scalar: return "scalar";
+	case Kernel::Sse: return "sse4.1";
+	case Kernel::Avx2: return "avx2";
+	}
+	return "?";
+}
+
+void intersectGalloping(const NoteId *small, size_t ns, const NoteId *large, size_t nl, std::vector<NoteId> &out)
+{
+	size_t pos = 0;
+	for (size_t i = 0; i < ns && pos < nl; i++) {
+		pos = gallop(large, nl, pos, small[i]);
+		if (pos < nl && large[pos] == small[i]) {
+			out.push_back(small[i]);
+			pos++;
+		}
+	}
+}
+
+void intersect(const NoteId *a, size_t na, const NoteId *b, size_t nb, std::vector<NoteId> &out, Kernel kernel)
+{
+	if (na > nb) {
+		std::swap(a, b);
+		std::swap(na, nb);
+	}
+	if (na == 0) {
+		return;
+	}
+	if (na * GallopRatio < nb) {
+		intersectGalloping(a, na, b, nb, out);
+		return;
+	}
+	switch (resolve(kernel)) {
+#ifdef POSTING_ALGEBRA_X86
+	case Kernel::Avx2:
+		intersectAvx2(a, na, b, nb, out);
+		return;
+	case Kernel::Sse:
+		intersectSse(a, na, b, nb, out);
+		return;
+#endif
+	default:
+		intersectScalar(a, na, b, nb, out);
+	}
+}
+
+void unite(const NoteId *a, size_t na, const NoteId *b, size_t nb, std::vector<NoteId> &out, Kernel kernel)
+{
+	out.reserve(out.size() + na + nb);
+	if (na < nb) {
+		std::swap(a, b);
+		std::swap(na, nb);
+	}
+	if (nb * GallopRatio < na) {
+		uniteGalloping(a, na, b, nb, out);
+		return;
+	}
+	switch (resolve(kernel)) {
+#ifdef POSTING_ALGEBRA_X86
+	case Kernel::Avx2:
+	case Kernel::Sse:
+		uniteSse(a, na, b, nb, out);
+		return;
+#endif
+	default:
+		uniteScalar(a, na, b, nb, out);
+	}
+}
+
+void subtract(const NoteId *a, size_t na, const NoteId *b, size_t nb, std::vector<NoteId> &out, Kernel kernel)
+{
+	if (na == 0) {
+		return;
+	}
+	if (nb * GallopRatio < na) {
+		subtractGallopingLarge(a, na, b, nb, out);
+		return;
+	}
+	if (na * GallopRatio < nb) {
+		subtractGallopingSmall(a, na, b, nb, out);
+		return;
+	}
+	switch (resolve(kernel)) {
+#ifdef POSTING_ALGEBRA_X86
+	case Kernel::Avx2:
+		subtractAvx2(a, na, b, nb, out);
+		return;
+	case Kernel::Sse:
+		subtractSse(a, na, b, nb, out);
+		return;
+#endif
+	default:
+		subtractScalar(a, na, b, nb, out);
+	}
+}
+
+} // PostingAlgebra ns
@@ -0,0 +1,67 @@
+#pragma once
+
+// Martin Flaska - flegy@flegy.sk / https://www.linkedin.com/in/martinflaska
+
+#include <cstddef>
+#include <vector>
+
+#include "PostingIndex.h"
+
+
+/** Set operations over sorted lists of unique note ids
+ *
+ * Results are appended to @out (which must not alias the inputs) and are sorted and unique.
+ * Lists of very different sizes are intersected/subtracted by galloping (exponential) search
+ * in the longer one, otherwise a merge kernel is used. SIMD kernels are picked at runtime,
+ * the scalar one is always available.
+ */
+namespace PostingAlgebra {
+
+enum class Kernel {
+	Auto,   ///< best one supported by the CPU
+	Scalar,
+	Sse,    ///< SSE4.1, 4 ids per step
+	Avx2    ///< AVX2, 8 ids per step (union uses the SSE4.1 merge network)
+};
+
+/** Best kernel supported by this CPU */
+Kernel bestKernel();
+bool isSupported(Kernel kernel);
+const char *kernelName(Kernel kernel);
+
+/** a AND b */
+void intersect(const NoteId *a, size_t na, const NoteId *b, size_t nb, std::vector<NoteId> &out,
+	Kernel kernel = Kernel::Auto);
+/** a OR b */
+void unite(const NoteId *a, size_t na, const NoteId *b, size_t nb, std::vector<NoteId> &out,
+	Kernel kernel = Kernel::Auto);
+/** a AND NOT b */
+void subtract(const NoteId *a, size_t na, const NoteId *b, size_t nb, std::vector<NoteId> &out,
+	Kernel kernel = Kernel::Auto);
+
+/** Galloping intersection, @small should be (much) shorter than @large */
+void intersectGalloping(const NoteId *small, size_t ns, const NoteId *large, size_t nl, std::vector<NoteId> &out);
+
+/** Vector overloads, any allocator (e.g. pmr posting lists) */
+template<typename AllocA, typename AllocB>
+void intersect(const std::vector<NoteId, AllocA> &a, const std::vector<NoteId, AllocB> &b, std::vector<NoteId> &out,
+	Kernel kernel = Kernel::Auto)
+{
+	intersect(a.data(), a.size(), b.data(), b.size(), out, kernel);
+}
+
+template<typename AllocA, typename AllocB>
+void unite(const std::vector<NoteId, AllocA> &a, const std::vector<NoteId, AllocB> &b, std::vector<NoteId> &out,
+	Kernel kernel = Kernel::Auto)
+{
+	unite(a.data(), a.size(), b.data(), b.size(), out, kernel);
+}
+
+template<typename AllocA, typename AllocB>
+void subtract(const std::vector<NoteId, AllocA> &a, const std::vector<NoteId, AllocB> &b, std::vector<NoteId> &out,
+	Kernel kernel = Kernel::Auto)
+{
+	subtract(a.data(), a.size(), b.data(), b.size(), out, kernel);
+}
+
+} // PostingAlgebra ns
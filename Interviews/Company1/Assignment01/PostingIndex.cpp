@@ -0,0 +1,88 @@
+#include "PostingIndex.h"
+
+
+const PostingList *HashPostingMap::find(SymbolId key) const
+{
+	if (m_size == 0) {
+		return nullptr;
+	}
+	auto const &slot = m_slots[probe(key)];
+	return slot.key == key ? &slot.list : nullptr;
+}
+
+PostingList *HashPostingMap::find(SymbolId key)
+{
+	return const_cast<PostingList*>(static_cast<const HashPostingMap*>(this)->find(key));
+}
+
+PostingList &HashPostingMap::get(SymbolId key)
+{
+	// keep load factor <= 0.75
+	if ((m_size + 1) * 4 > m_slots.size() * 3) {
+		grow();
+	}
+	auto &slot = m_slots[probe(key)];
+	if (slot.key != key) {
+		slot.key = key;
+		m_size++;
+	}
+	return slot.list;
+}
+
+void HashPostingMap::erase(SymbolId key)
+{
+	if (m_size == 0) {
+		return;
+	}
+	auto mask = m_slots.size() - 1;
+	auto hole = probe(key);
+	if (m_slots[hole].key != key) {
+		return;
+	}
+	m_slots[hole].key = StringPool::npos;
+	m_slots[hole].list.reset();
+	m_size--;
+
+	// Backward shift: move following entries of the cluster into the hole if it is
+	// on their probe path
+	for (auto i = (hole + 1) & mask; m_slots[i].key != StringPool::npos; i = (i + 1) & mask) {
+		auto home = slotOf(m_slots[i].key);
+		// is @home cyclically outside of (hole, i] ?
+		bool movable = hole <= i ? (home <= hole || home > i) : (home <= hole && home > i);
+		if (movable) {
+			m_slots[hole].key = m_slots[i].key;
+			m_slots[hole].list = std::move(m_slots[i].list);
+			m_slots[i].key = StringPool::npos;
+			m_slots[i].list.reset();
+			hole = i;
+		}
+	}
+}
+
+size_t HashPostingMap::probe(SymbolId key) const
+{
+	auto mask = m_slots.size() - 1;
+	auto i = slotOf(key);
+	while (m_slots[i].key != StringPool::npos && m_slots[i].key != key) {
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+void HashPostingMap::grow()
+{
+	std::pmr::vector<Slot> old(m_slots.get_allocator());
+	old.swap(m_slots);
+	m_slots.resize(old.empty() ? 16 : old.size() * 2);
+	m_shift = 64;
+	for (auto n = m_slots.size(); n > 1; n >>= 1) {
+		m_shift--;
+	}
+	for (auto &slot : old) {
+		if (slot.key != StringPool::npos) {
+			auto &dst = m_slots[probe(slot.key)];
+			dst.key = slot.key;
+			dst.list = std::move(slot.list);
+		}
+	}
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+// Martin Flaska - flegy@flegy.sk / https://www.linkedin.com/in/martinflaska
+
+#include <cstdint>
+#include <map>
+#include <memory_resource>
+#include <vector>
+
+#include "StringPool.h"
+
+
+/** Stable note handle
+ *
+ * Ids are assigned in increasing order and never reused, so a handle of a deleted note can not
+ * silently refer to another note later. The only exception is Storyboard::compactIds(), which
+ * renumbers the live notes and invalidates all the handles taken before.
+ */
+typedef uint32_t NoteId;
+
+/** Sorted note ids of a single key
+ *
+ * Ids of deleted notes are not erased right away, deletion only counts them in @dead. Once more
+ * than a half of the list is dead the owner compacts it, so a delete is amortized O(1) with no
+ * scanning. Readers skip ids of deleted notes.
+ *
+ * Allocator aware, so pmr containers hand their memory resource down to the ids.
+ */
+struct PostingList
+{
+	typedef std::pmr::polymorphic_allocator<NoteId> allocator_type;
+
+	PostingList() = default;
+	explicit PostingList(const allocator_type &alloc) : ids(alloc) {}
+	PostingList(const PostingList &other, const allocator_type &alloc) : ids(other.ids, alloc), dead(other.dead) {}
+	PostingList(PostingList &&other, const allocator_type &alloc) : ids(std::move(other.ids), alloc), dead(other.dead) {}
+	PostingList(const PostingList &) = default;
+	PostingList(PostingList &&) = default;
+	PostingList &operator=(const PostingList &) = default;
+	PostingList &operator=(PostingList &&) = default;
+
+	std::pmr::vector<NoteId> ids;
+	uint32_t dead = 0;
+
+	/** Drop all the ids and their memory (keeps the memory resource) */
+	void reset()
+	{
+		ids.clear();
+		ids.shrink_to_fit();
+		dead = 0;
+	}
+
+	/** Number of live ids */
+	size_t size() const { return ids.size() - dead; }
+	bool empty() const { return ids.size() == dead; }
+	bool needsCompaction() const { return dead * 2 > ids.size(); }
+};
+
+/** Key dictionary used by a PostingIndex */
+enum class IndexKind {
+	Ordered, ///< std::map (red-black tree)
+	Hash     ///< open addressing hash table
+};
+
+
+/** Open addressing (linear probing) hash table: SymbolId -> PostingList
+ *
+ * Symbol ids are dense integers already, so a multiplicative hash spreads them well enough.
+ * Erase uses backward shift deletion, hence no tombstones and probe sequences stay short.
+ */
+class HashPostingMap
+{
+public:
+	explicit HashPostingMap(std::pmr::memory_resource *memory = std::pmr::get_default_resource()) : m_slots(memory) {}
+
+	const PostingList *find(SymbolId key) const;
+	PostingList *find(SymbolId key);
+	/** Return posting list of @key (inserting an empty one if needed) */
+	PostingList &get(SymbolId key);
+	void erase(SymbolId key);
+	size_t size() const { return m_size; }
+
+	template<typename F>
+	void forEach(F f) const
+	{
+		for (auto const &slot : m_slots) {
+			if (slot.key != StringPool::npos) {
+				f(slot.key, slot.list);
+			}
+		}
+	}
+
+private:
+	struct Slot
+	{
+		typedef std::pmr::polymorphic_allocator<Slot> allocator_type;
+
+		Slot() = default;
+		explicit Slot(const allocator_type &alloc) : list(alloc) {}
+		Slot(const Slot &other, const allocator_type &alloc) : key(other.key), list(other.list, alloc) {}
+		Slot(Slot &&other, const allocator_type &alloc) : key(other.key), list(std::move(other.list), alloc) {}
+		Slot(const Slot &) = default;
+		Slot(Slot &&) = default;
+		Slot &operator=(const Slot &) = default;
+		Slot &operator=(Slot &&) = default;
+
+		SymbolId key = StringPool::npos;
+		PostingList list;
+	};
+
+	size_t slotOf(SymbolId key) const { return (key * 0x9E3779B97F4A7C15ull) >> m_shift; }
+	size_t probe(SymbolId key) const; ///< slot of @key or the empty slot where it belongs
+	void grow();
+
+private:
+	std::pmr::vector<Slot> m_slots; // capacity is a power of 2
+	size_t m_size = 0;
+	unsigned m_shift = 64;
+};
+
+
+/** Exact match index: interned key -> sorted posting list of note ids
+ *
+ * The key dictionary is selectable (ordered tree or hash table), the posting lists are always
+ * contiguous vectors, so scans are cache friendly with either of them.
+ */
+class PostingIndex
+{
+public:
+	explicit PostingIndex(IndexKind kind = IndexKind::Hash, std::pmr::memory_resource *memory = std::pmr::get_default_resource())
+		: m_kind(kind), m_ordered(memory), m_hash(memory) {}
+
+	IndexKind kind() const { return m_kind; }
+
+	const PostingList *find(SymbolId key) const
+	{
+		if (m_kind == IndexKind::Hash) {
+			return m_hash.find(key);
+		}
+		auto it = m_ordered.find(key);
+		return it == m_ordered.end() ? nullptr : &it->second;
+	}
+	PostingList *find(SymbolId key)
+	{
+		return const_cast<PostingList*>(static_cast<const PostingIndex*>(this)->find(key));
+	}
+	PostingList &get(SymbolId key) { return m_kind == IndexKind::Hash ? m_hash.get(key) : m_ordered[key]; }
+	void erase(SymbolId key)
+	{
+		if (m_kind == IndexKind::Hash) {
+			m_hash.erase(key);
+		} else {
+			m_ordered.erase(key);
+		}
+	}
+
+	/** Number of distinct keys */
+	size_t size() const { return m_kind == IndexKind::Hash ? m_hash.size() : m_ordered.size(); }
+
+	template<typename F>
+	void forEach(F f) const
+	{
+		if (m_kind == IndexKind::Hash) {
+			m_hash.forEach(f);
+		} else {
+			for (auto const &kv : m_ordered) {
+				f(kv.first, kv.second);
+			}
+		}
+	}
+
+private:
+	IndexKind m_kind;
+	std::pmr::map<SymbolId, PostingList> m_ordered;
+	HashPostingMap m_hash;
+};
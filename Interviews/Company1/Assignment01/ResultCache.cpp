@@ -0,0 +1,86 @@
+#include "ResultCache.h"
+
+
+ResultCache &ResultCache::operator=(const ResultCache &other)
+{
+	if (this != &other) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_capacity = other.m_capacity;
+		m_index.clear();
+		m_entries.clear();
+		m_stats = Stats();
+	}
+	return *this;
+}
+
+ResultCache::Value ResultCache::find(Field field, std::string_view key)
+{
+	auto k = makeKey(field, key);
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto it = m_index.find(k);
+	if (it == m_index.end()) {
+		m_stats.misses++;
+		return nullptr;
+	}
+	m_stats.hits++;
+	m_entries.splice(m_entries.begin(), m_entries, it->second);
+	return it->second->second;
+}
+
+void ResultCache::insert(Field field, std::string_view key, Value value)
+{
+	auto k = makeKey(field, key);
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto it = m_index.find(k);
+	if (it != m_index.end()) {
+		// computed concurrently by another reader
+		it->second->second = std::move(value);
+		m_entries.splice(m_entries.begin(), m_entries, it->second);
+		return;
+	}
+	if (m_entries.size() >= m_capacity) {
+		m_index.erase(m_entries.back().first);
+		m_entries.pop_back();
+		m_stats.evictions++;
+	}
+	m_entries.emplace_front(std::move(k), std::move(value));
+	m_index.emplace(m_entries.front().first, m_entries.begin());
+}
+
+void ResultCache::invalidate(Field field, std::string_view key)
+{
+	auto k = makeKey(field, key);
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto it = m_index.find(k);
+	if (it != m_index.end()) {
+		auto entry = it->second;
+		m_index.erase(it);
+		m_entries.erase(entry);
+		m_stats.invalidations++;
+	}
+}
+
+void ResultCache::clear()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_stats.invalidations += m_entries.size();
+	m_index.clear();
+	m_entries.clear();
+}
+
+ResultCache::Stats ResultCache::stats() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto stats = m_stats;
+	stats.size = m_entries.size();
+	return stats;
+}
+
+std::string ResultCache::makeKey(Field field, std::string_view key)
+{
+	std::string k;
+	k.reserve(key.size() + 1);
+	k.push_back(static_cast<char>('0' + field));
+	k.append(key);
+	return k;
+}
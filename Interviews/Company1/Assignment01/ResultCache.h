@@ -0,0 +1,67 @@
+#pragma once
+
+// Martin Flaska - flegy@flegy.sk / https://www.linkedin.com/in/martinflaska
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+struct Note;
+
+
+/** Bounded LRU cache of materialized single key search results
+ *
+ * Entries are keyed by (field, key) and dropped exactly when a note with the key is added or
+ * deleted, so a hit is always up to date. Searches of a board are const and may run
+ * concurrently, hence the cache has its own lock.
+ *
+ * @note Copies get the capacity but no entries.
+ */
+class ResultCache
+{
+public:
+	enum Field { Title, Text, Tag };
+	typedef std::shared_ptr<const std::set<Note>> Value;
+
+	struct Stats
+	{
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t invalidations = 0; ///< entries dropped by modifications
+		uint64_t evictions = 0;     ///< entries dropped to make room
+		size_t size = 0;
+	};
+
+	/** @param capacity Max number of entries, 0 disables the cache */
+	explicit ResultCache(size_t capacity = 0) : m_capacity(capacity) {}
+	ResultCache(const ResultCache &other) : m_capacity(other.m_capacity) {}
+	ResultCache &operator=(const ResultCache &other);
+
+	bool enabled() const { return m_capacity != 0; }
+
+	/** Cached result or nullptr (counted as a hit / miss) */
+	Value find(Field field, std::string_view key);
+	void insert(Field field, std::string_view key, Value value);
+	/** Drop the entry of @key (if any) */
+	void invalidate(Field field, std::string_view key);
+	void clear();
+
+	Stats stats() const;
+
+private:
+	typedef std::list<std::pair<std::string, Value>> Entries;
+
+	static std::string makeKey(Field field, std::string_view key);
+
+private:
+	size_t m_capacity;
+	mutable std::mutex m_mutex;
+	Entries m_entries; // most recently used first
+	std::unordered_map<std::string_view, Entries::iterator> m_index; // views of the entry keys
+	Stats m_stats;
+};
@@ -0,0 +1,189 @@
+#include "ShardedStoryboard.h"
+
+#include <algorithm>
+#include <future>
+#include <iterator>
+#include <mutex>
+#include <thread>
+
+
+namespace {
+
+unsigned defaultShards(unsigned shards)
+{
+	return shards ? shards : std::max(1u, std::thread::hardware_concurrency());
+}
+
+/** Iterator over notes of a vector of pointers (feeds Storyboard::addNotes without copies) */
+class NotePtrIterator
+{
+public:
+	typedef std::forward_iterator_tag iterator_category;
+	typedef Note value_type;
+	typedef std::ptrdiff_t difference_type;
+	typedef const Note *pointer;
+	typedef const Note &reference;
+
+	explicit NotePtrIterator(const Note * const *pos) : m_pos(pos) {}
+
+	const Note &operator*() const { return **m_pos; }
+	NotePtrIterator &operator++() { ++m_pos; return *this; }
+	bool operator!=(const NotePtrIterator &other) const { return m_pos != other.m_pos; }
+
+private:
+	const Note * const *m_pos;
+};
+
+std::vector<Note> materialize(const Storyboard::Result &result)
+{
+	std::vector<Note> notes;
+	notes.reserve(result.size());
+	for (auto const &n : result) {
+		notes.push_back(n.toNote());
+	}
+	return notes;
+}
+
+/** Waits for all the pending @futures when destroyed
+ *
+ * The pool tasks refer to locals of the submitting function, so it must not return (or throw) while
+ * any of them is still queued or running.
+ */
+template<typename T>
+class FutureGuard
+{
+public:
+	explicit FutureGuard(std::vector<std::future<T>> &futures) : m_futures(futures) {}
+	~FutureGuard()
+	{
+		for (auto &f : m_futures) {
+			if (f.valid()) {
+				f.wait();
+			}
+		}
+	}
+
+private:
+	std::vector<std::future<T>> &m_futures;
+};
+
+} // anonymous ns
+
+ShardedStoryboard::ShardedStoryboard(unsigned shards, const Storyboard::Options &options)
+	: m_pool(std::max(1u, defaultShards(shards) - 1)) // Note: the caller queries one shard itself
+{
+	shards = defaultShards(shards);
+	m_shards.reserve(shards);
+	for (unsigned i = 0; i < shards; i++) {
+		m_shards.emplace_back(new Shard(options));
+	}
+}
+
+void ShardedStoryboard::addNote(const Note &note)
+{
+	auto &shard = *m_shards[shardOf(note)];
+	std::lock_guard<std::shared_timed_mutex> lock(shard.mutex);
+	shard.board.addNote(note);
+}
+
+void ShardedStoryboard::deleteNote(const Note &note)
+{
+	auto &shard = *m_shards[shardOf(note)];
+	std::lock_guard<std::shared_timed_mutex> lock(shard.mutex);
+	shard.board.deleteNote(note);
+	// Note: no note ids leave the shards, so they can be renumbered any time
+	if (shard.board.needsIdCompaction()) {
+		shard.board.compactIds();
+	}
+}
+
+size_t ShardedStoryboard::addNotes(const std::vector<Note> &notes)
+{
+	std::vector<std::vector<const Note*>> parts(m_shards.size());
+	for (auto const &n : notes) {
+		parts[shardOf(n)].push_back(&n);
+	}
+	auto load = [this, &parts](size_t i) {
+		auto &shard = *m_shards[i];
+		std::lock_guard<std::shared_timed_mutex> lock(shard.mutex);
+		auto const &part = parts[i];
+		return shard.board.addNotes(NotePtrIterator(part.data()), NotePtrIterator(part.data() + part.size()));
+	};
+	std::vector<std::future<size_t>> loaded;
+	FutureGuard<size_t> guard(loaded);
+	for (size_t i = 1; i < m_shards.size(); i++) {
+		loaded.push_back(m_pool.submit([&load, i]() { return load(i); }));
+	}
+	size_t added = load(0);
+	for (auto &f : loaded) {
+		added += f.get();
+	}
+	return added;
+}
+
+template<typename F>
+ShardedStoryboard::NoteSet ShardedStoryboard::fanOut(F f) const
+{
+	auto query = [this, &f](size_t i) {
+		auto const &shard = *m_shards[i];
+		std::shared_lock<std::shared_timed_mutex> lock(shard.mutex);
+		return materialize(f(shard.board));
+	};
+	std::vector<std::future<std::vector<Note>>> parts;
+	FutureGuard<std::vector<Note>> guard(parts);
+	for (size_t i = 1; i < m_shards.size(); i++) {
+		parts.push_back(m_pool.submit([&query, i]() { return query(i); }));
+	}
+	auto first = query(0);
+	// Note: shards are disjoint, no dedup needed
+	NoteSet result(std::make_move_iterator(first.begin()), std::make_move_iterator(first.end()));
+	for (auto &p : parts) {
+		auto notes = p.get();
+		result.insert(std::make_move_iterator(notes.begin()), std::make_move_iterator(notes.end()));
+	}
+	return result;
+}
+
+using NoteSet = ShardedStoryboard::NoteSet;
+
+NoteSet ShardedStoryboard::searchByTitle(const std::string &title) const
+{
+	return fanOut([&title](const Storyboard &sb) { return sb.searchByTitle(title); });
+}
+
+NoteSet ShardedStoryboard::searchByText(const std::string &text) const
+{
+	return fanOut([&text](const Storyboard &sb) { return sb.searchByText(text); });
+}
+
+NoteSet ShardedStoryboard::searchByTag(const std::string &tag) const
+{
+	return fanOut([&tag](const Storyboard &sb) { return sb.searchByTag(tag); });
+}
+
+NoteSet ShardedStoryboard::searchByTag(const std::set<std::string> &tags) const
+{
+	return fanOut([&tags](const Storyboard &sb) { return sb.searchByTag(tags); });
+}
+
+NoteSet ShardedStoryboard::searchByTags(const Storyboard::TagQuery &query) const
+{
+	return fanOut([&query](const Storyboard &sb) { return sb.searchByTags(query); });
+}
+
+bool ShardedStoryboard::contains(const Note &note) const
+{
+	auto const &shard = *m_shards[shardOf(note)];
+	std::shared_lock<std::shared_timed_mutex> lock(shard.mutex);
+	return shard.board.findNote(note) != Storyboard::InvalidNoteId;
+}
+
+size_t ShardedStoryboard::size() const
+{
+	size_t n = 0;
+	for (auto const &shard : m_shards) {
+		std::shared_lock<std::shared_timed_mutex> lock(shard->mutex);
+		n += shard->board.size();
+	}
+	return n;
+}
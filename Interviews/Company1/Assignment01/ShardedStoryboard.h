@@ -0,0 +1,76 @@
+#pragma once
+
+// Martin Flaska - flegy@flegy.sk / https://www.linkedin.com/in/martinflaska
+
+#include <memory>
+#include <shared_mutex>
+#include <vector>
+
+#include "Storyboard.h"
+#include "ThreadPool.h"
+
+
+/** Storyboard hash partitioned over independent shards
+ *
+ * Every note lives in exactly one shard chosen by its content hash, so writes lock the owning
+ * shard only and shards stay small (cache friendly). Lookups can not be routed (all of them
+ * search by a single field), so they fan out to all the shards on a thread pool and the
+ * (disjoint) shard results are merged.
+ *
+ * Thread safe, every shard has its own reader/writer lock.
+ */
+class ShardedStoryboard
+{
+public:
+	typedef Storyboard::NoteSet NoteSet;
+
+	/** @param shards Number of shards, 0 means std::thread::hardware_concurrency()
+	 *  @param options Options of every shard
+	 */
+	explicit ShardedStoryboard(unsigned shards = 0, const Storyboard::Options &options = Storyboard::Options());
+
+	ShardedStoryboard(const ShardedStoryboard &) = delete;
+	ShardedStoryboard &operator=(const ShardedStoryboard &) = delete;
+
+	void addNote(const Note &note);
+	void deleteNote(const Note &note);
+	/** Bulk load, shards are loaded in parallel
+	 * @return Number of added notes
+	 */
+	size_t addNotes(const std::vector<Note> &notes);
+
+	/** Lookup methods, queried shards in parallel
+	 *
+	 * @{
+	 */
+	NoteSet searchByTitle(const std::string &title) const;
+	NoteSet searchByText(const std::string &text) const;
+	NoteSet searchByTag(const std::string &tag) const;
+	NoteSet searchByTag(const std::set<std::string> &tags) const;
+	NoteSet searchByTags(const Storyboard::TagQuery &query) const;
+	/* @} */
+
+	bool contains(const Note &note) const;
+	size_t size() const;
+
+	size_t shardCount() const { return m_shards.size(); }
+	/** Shard owning @note */
+	size_t shardOf(const Note &note) const { return note.hash() % m_shards.size(); }
+
+private:
+	struct Shard
+	{
+		explicit Shard(const Storyboard::Options &options) : board(options) {}
+
+		Storyboard board;
+		mutable std::shared_timed_mutex mutex;
+	};
+
+	/** Run @f(const Storyboard &) -> Storyboard::Result on all the shards and merge the results */
+	template<typename F>
+	NoteSet fanOut(F f) const;
+
+private:
+	std::vector<std::unique_ptr<Shard>> m_shards;
+	mutable ThreadPool m_pool;
+};
@@ -1,5 +1,12 @@
 #include "Storyboard.h"
 
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+
+#include "PostingAlgebra.h"
+
 
 bool Note::operator==(const Note &note) const
 {
@@ -17,95 +24,795 @@ bool Note::operator<(const Note &note) const
 	;
 }
 
+Fingerprint Note::fingerprint() const
+{
+	// Note: tags are combined order independently, so a NoteRecord (tags in symbol order)
+	//       gets the same fingerprint
+	auto fp = Fingerprint::of(title, 1);
+	fp += Fingerprint::of(text, 2);
+	for (auto const &tag : tags) {
+		fp += Fingerprint::of(tag, 3);
+	}
+	return fp;
+}
+
+size_t Note::hash() const
+{
+	return fingerprint().lo;
+}
+
+
+const NoteId Storyboard::InvalidNoteId;
+
+Storyboard::Storyboard()
+	: Storyboard(Options())
+{
+}
+
+Storyboard::Storyboard(const Options &options)
+	: m_arena(options.memory ? ArenaKind::None : options.arena)
+	, m_strings(options.memory ? options.memory : m_arena.resource())
+	, m_notes(m_strings.resource())
+	, m_fingerprints(m_strings.resource())
+	, m_titleMap(options.titleIndex, m_strings.resource())
+	, m_textMap(options.textIndex, m_strings.resource())
+	, m_tagsMap(options.tagIndex, m_strings.resource())
+	, m_tokenIndexEnabled(options.textTokenIndex)
+	, m_keyTriesEnabled(options.keyTries)
+	, m_cache(options.resultCache)
+{
+}
 
-void Storyboard::addNote(const Note &note)
+NoteId Storyboard::addNote(const Note &note)
 {
-	auto ret = m_notes.insert(note);
-	if (!ret.second) {
-		return; // no insertion / duplicate
+	STORYBOARD_TIME(m_metrics, AddNote);
+	auto fp = note.fingerprint();
+	auto existing = findNote(note, fp);
+	if (existing != InvalidNoteId) {
+		STORYBOARD_COUNT(m_metrics, DuplicateNotes, 1);
+		return existing; // no insertion / duplicate
 	}
-	auto it = ret.first;
-	m_titleMap.insert({it->title, it});
-	m_textMap.insert({it->text, it});
+
+	auto id = static_cast<NoteId>(m_notes.size());
+	auto &rec = m_notes.emplace_back();
+	internNote(note, rec);
+	m_fingerprints.insert(fp, id);
+
+	// Ids grow monotonically, so appending keeps all posting lists sorted
+	m_titleMap.get(rec.title).ids.push_back(id);
+	m_textMap.get(rec.text).ids.push_back(id);
 	// Any Note item can be represented by all or even single its tag.
-	// Further optimization can be done if there is need to have plenty of tags for
-	// a Note.
-	for (auto tag : it->tags) {
-		m_tagsMap.insert({tag, it});
+	for (auto tag : rec.tags) {
+		m_tagsMap.get(tag).ids.push_back(id);
+	}
+	m_noteCount++;
+	if (m_tokenIndexEnabled) {
+		m_tokenIndex.add(id, note.text);
 	}
+	if (m_keyTriesEnabled) {
+		m_titleKeys.insert(note.title);
+		for (auto const &tag : note.tags) {
+			m_tagKeys.insert(tag);
+		}
+	}
+	m_feed.publish(ChangeEvent::Added, id, [&note]() { return note; });
+	invalidateCached(note);
+	return id;
 }
 
-void Storyboard::deleteNote(const Note &note)
+void Storyboard::internNote(const Note &note, NoteRecord &rec)
 {
-	removeNoteMapItems(m_titleMap, note, note.title);
-	removeNoteMapItems(m_textMap, note, note.text);
+	rec.title = m_strings.intern(note.title);
+	rec.text = m_strings.intern(note.text);
+	auto sym = rec.tags.resize(note.tags.size(), m_strings.resource());
 	for (auto const &tag : note.tags) {
-		removeNoteMapItems(m_tagsMap, note, tag);
+		*sym++ = m_strings.intern(tag);
+	}
+	rec.tags.sort();
+}
+
+Fingerprint Storyboard::fingerprint(const NoteRecord &rec) const
+{
+	auto fp = Fingerprint::of(m_strings.str(rec.title), 1);
+	fp += Fingerprint::of(m_strings.str(rec.text), 2);
+	for (auto tag : rec.tags) {
+		fp += Fingerprint::of(m_strings.str(tag), 3);
+	}
+	return fp;
+}
+
+namespace {
+
+/** Sort @v on up to @threads threads: sort chunks in parallel, then merge them pairwise */
+template<typename T, typename Less>
+void parallelSort(std::vector<T> &v, Less less, unsigned threads)
+{
+	const size_t minChunk = 1 << 14;
+	size_t chunks = std::max<size_t>(1, std::min<size_t>(threads, v.size() / minChunk));
+	if (chunks <= 1) {
+		std::sort(v.begin(), v.end(), less);
+		return;
+	}
+
+	std::vector<size_t> bounds;
+	for (size_t i = 0; i <= chunks; i++) {
+		bounds.push_back(v.size() * i / chunks);
+	}
+	std::vector<std::thread> workers;
+	for (size_t i = 0; i < chunks; i++) {
+		workers.emplace_back([&v, &bounds, less, i]() {
+			std::sort(v.begin() + bounds[i], v.begin() + bounds[i + 1], less);
+		});
+	}
+	for (auto &w : workers) {
+		w.join();
+	}
+
+	// merge neighbouring runs, the merges of one level run in parallel
+	for (size_t width = 1; width < chunks; width *= 2) {
+		workers.clear();
+		for (size_t i = 0; i + width < chunks; i += 2 * width) {
+			auto first = bounds[i];
+			auto mid = bounds[i + width];
+			auto last = bounds[std::min(i + 2 * width, chunks)];
+			workers.emplace_back([&v, less, first, mid, last]() {
+				std::inplace_merge(v.begin() + first, v.begin() + mid, v.begin() + last, less);
+			});
+		}
+		for (auto &w : workers) {
+			w.join();
+		}
+	}
+}
+
+} // anonymous ns
+
+size_t Storyboard::bulkLoad(std::vector<const Note*> &notes, unsigned threads)
+{
+	STORYBOARD_TIME(m_metrics, AddNotes);
+	threads = std::max(1u, threads);
+
+	// Dedupe by sorting (fingerprint, position) pairs: integer sort, notes are compared on
+	// equal fingerprints only, and the input order is kept
+	std::vector<Fingerprint> fps(notes.size());
+	std::vector<std::pair<Fingerprint, size_t>> keys(notes.size());
+	auto hashNotes = [&notes, &fps, &keys](size_t first, size_t last) {
+		for (size_t i = first; i < last; i++) {
+			fps[i] = notes[i]->fingerprint();
+			keys[i] = {fps[i], i};
+		}
+	};
+	{
+		std::vector<std::thread> workers;
+		for (unsigned t = 1; t < threads; t++) {
+			workers.emplace_back(hashNotes, notes.size() * t / threads, notes.size() * (t + 1) / threads);
+		}
+		hashNotes(0, notes.size() / threads);
+		for (auto &w : workers) {
+			w.join();
+		}
+	}
+	parallelSort(keys, std::less<std::pair<Fingerprint, size_t>>(), threads);
+	std::vector<bool> duplicate(notes.size(), false);
+	for (size_t i = 0; i < keys.size(); ) {
+		size_t j = i + 1;
+		for (; j < keys.size() && keys[j].first == keys[i].first; j++) {
+			// equal hashes: compare with all the earlier (kept) notes of the group
+			for (size_t k = i; k < j; k++) {
+				if (!duplicate[keys[k].second] && *notes[keys[k].second] == *notes[keys[j].second]) {
+					duplicate[keys[j].second] = true;
+					break;
+				}
+			}
+		}
+		i = j;
+	}
+	size_t kept = 0;
+	for (size_t i = 0; i < notes.size(); i++) {
+		if (!duplicate[i] && (m_noteCount == 0 || findNote(*notes[i], fps[i]) == InvalidNoteId)) {
+			fps[kept] = fps[i];
+			notes[kept++] = notes[i];
+		}
+	}
+	STORYBOARD_COUNT(m_metrics, DuplicateNotes, notes.size() - kept);
+	notes.resize(kept);
+	if (notes.empty()) {
+		return 0;
+	}
+
+	// Intern strings and create the records, ids are handed out in order
+	auto firstId = static_cast<NoteId>(m_notes.size());
+	m_notes.reserve(m_notes.size() + notes.size());
+	m_strings.reserve(2 * notes.size()); // titles and texts are mostly unique
+	m_fingerprints.reserve(m_noteCount + notes.size());
+	std::vector<SymbolId> titles, texts, tags;
+	std::vector<NoteId> ids, tagIds;
+	titles.reserve(notes.size());
+	texts.reserve(notes.size());
+	ids.reserve(notes.size());
+	for (auto note : notes) {
+		auto id = static_cast<NoteId>(m_notes.size());
+		auto &rec = m_notes.emplace_back();
+		internNote(*note, rec);
+		m_fingerprints.insert(fps[id - firstId], id);
+
+		titles.push_back(rec.title);
+		texts.push_back(rec.text);
+		ids.push_back(id);
+		for (auto tag : rec.tags) {
+			tags.push_back(tag);
+			tagIds.push_back(id);
+		}
+	}
+	m_noteCount += notes.size();
+	for (size_t i = 0; i < notes.size(); i++) {
+		m_feed.publish(ChangeEvent::Added, firstId + static_cast<NoteId>(i), [&notes, i]() { return *notes[i]; });
+		invalidateCached(*notes[i]);
+	}
+
+	// Every index is an independent structure, so they can be built concurrently
+	std::vector<std::function<void()>> tasks = {
+		[&]() { appendPostings(m_titleMap, titles, ids); },
+		[&]() { appendPostings(m_textMap, texts, ids); },
+		[&]() { appendPostings(m_tagsMap, tags, tagIds); },
+	};
+	if (m_tokenIndexEnabled) {
+		tasks.push_back([&]() {
+			for (size_t i = 0; i < notes.size(); i++) {
+				m_tokenIndex.add(firstId + static_cast<NoteId>(i), notes[i]->text);
+			}
+		});
 	}
+	if (m_keyTriesEnabled) {
+		tasks.push_back([&]() {
+			for (auto note : notes) {
+				m_titleKeys.insert(note->title);
+			}
+		});
+		tasks.push_back([&]() {
+			for (auto note : notes) {
+				for (auto const &tag : note->tags) {
+					m_tagKeys.insert(tag);
+				}
+			}
+		});
+	}
+	// Arenas are not thread safe
+	if (threads == 1 || m_strings.resource() != std::pmr::get_default_resource()) {
+		for (auto &task : tasks) {
+			task();
+		}
+	} else {
+		std::vector<std::thread> workers;
+		for (size_t i = 0; i < tasks.size(); i++) {
+			if (workers.size() + 1 < threads) {
+				workers.emplace_back(tasks[i]);
+			} else {
+				tasks[i]();
+			}
+		}
+		for (auto &w : workers) {
+			w.join();
+		}
+	}
+
+	return notes.size();
+}
+
+void Storyboard::appendPostings(PostingIndex &index, const std::vector<SymbolId> &keys, const std::vector<NoteId> &ids)
+{
+	// Counting sort by key: ids of every key form one sorted run
+	std::vector<uint32_t> offsets(m_strings.idBound() + 1, 0);
+	for (auto key : keys) {
+		offsets[key + 1]++;
+	}
+	for (size_t i = 1; i < offsets.size(); i++) {
+		offsets[i] += offsets[i - 1];
+	}
+	std::vector<NoteId> runs(ids.size());
+	{
+		auto pos = offsets;
+		for (size_t i = 0; i < keys.size(); i++) {
+			runs[pos[keys[i]]++] = ids[i];
+		}
+	}
+
+	for (SymbolId key = 0; key + 1 < offsets.size(); key++) {
+		auto first = offsets[key];
+		auto last = offsets[key + 1];
+		if (first != last) {
+			auto &list = index.get(key).ids;
+			list.insert(list.end(), runs.begin() + first, runs.begin() + last);
+		}
+	}
+}
+
+void Storyboard::deleteNote(const Note &note)
+{
+	auto id = findNote(note);
+	if (id != InvalidNoteId) {
+		deleteNote(id);
+	}
+}
+
+void Storyboard::deleteNote(NoteId id)
+{
+	STORYBOARD_TIME(m_metrics, DeleteNote);
+	if (!contains(id)) {
+		return; // not existing note
+	}
+
+	m_fingerprints.erase(fingerprint(m_notes[id]), id);
+	m_feed.publish(ChangeEvent::Removed, id, [this, id]() { return note(id); });
+
+	// Mark the note deleted first, index compaction relies on it
+	auto rec = std::move(m_notes[id]);
+	m_notes[id].title = m_notes[id].text = StringPool::npos;
+	m_noteCount--;
+
+	removeNoteMapItems(m_titleMap, rec.title);
+	removeNoteMapItems(m_textMap, rec.text);
+	for (auto tag : rec.tags) {
+		removeNoteMapItems(m_tagsMap, tag);
+	}
+	if (m_tokenIndexEnabled) {
+		m_tokenIndex.remove(std::string(m_strings.str(rec.text)), [this](NoteId id) { return contains(id); });
+	}
+	if (m_keyTriesEnabled) {
+		m_titleKeys.erase(m_strings.str(rec.title));
+		for (auto tag : rec.tags) {
+			m_tagKeys.erase(m_strings.str(tag));
+		}
+	}
+	if (m_cache.enabled()) {
+		m_cache.invalidate(ResultCache::Title, m_strings.str(rec.title));
+		m_cache.invalidate(ResultCache::Text, m_strings.str(rec.text));
+		for (auto tag : rec.tags) {
+			m_cache.invalidate(ResultCache::Tag, m_strings.str(tag));
+		}
+	}
+
+	m_strings.release(rec.title);
+	m_strings.release(rec.text);
+	for (auto tag : rec.tags) {
+		m_strings.release(tag);
+	}
+}
+
+size_t Storyboard::compactIds()
+{
+	auto slots = m_notes.size();
+	if (m_noteCount == slots) {
+		return 0;
+	}
+
+	// Live notes move down in order, so the old -> new id mapping is monotonic
+	std::vector<NoteId> newIds(slots, InvalidNoteId);
+	NoteId next = 0;
+	for (NoteId id = 0; id < slots; id++) {
+		if (m_notes[id].alive()) {
+			newIds[id] = next;
+			if (next != id) {
+				m_notes[next] = std::move(m_notes[id]);
+			}
+			next++;
+		}
+	}
+	m_notes.resize(next);
+	m_notes.shrink_to_fit();
 
-	m_notes.erase(note);
+	auto alive = [&newIds](NoteId id) { return newIds[id] != InvalidNoteId; };
+	auto map = [&newIds](NoteId id) { return newIds[id]; };
+	for (auto index : {&m_titleMap, &m_textMap, &m_tagsMap}) {
+		std::vector<SymbolId> keys;
+		keys.reserve(index->size());
+		index->forEach([&keys](SymbolId key, const PostingList &) { keys.push_back(key); });
+		for (auto key : keys) {
+			auto &list = *index->find(key);
+			auto &ids = list.ids;
+			ids.erase(std::remove_if(ids.begin(), ids.end(), [&alive](NoteId id) { return !alive(id); }), ids.end());
+			std::transform(ids.begin(), ids.end(), ids.begin(), map);
+			list.dead = 0;
+		}
+	}
+	m_fingerprints.renumber(map);
+	if (m_tokenIndexEnabled) {
+		m_tokenIndex.renumber(alive, map);
+	}
+	STORYBOARD_COUNT(m_metrics, Compactions, 1);
+	return slots - next;
+}
+
+NoteId Storyboard::findNote(const Note &note) const
+{
+	return findNote(note, note.fingerprint());
+}
+
+NoteId Storyboard::findNote(const Note &note, const Fingerprint &fp) const
+{
+	// Strings are compared on a fingerprint match only (i.e. for a duplicate or a collision)
+	return m_fingerprints.find(fp, [this, &note](NoteId id) {
+		auto const &rec = m_notes[id];
+		if (rec.tags.size() != note.tags.size() || m_strings.str(rec.title) != note.title
+			|| m_strings.str(rec.text) != note.text) {
+			return false;
+		}
+		for (auto const &tag : note.tags) {
+			auto sym = m_strings.find(tag);
+			if (sym == StringPool::npos || !std::binary_search(rec.tags.begin(), rec.tags.end(), sym)) {
+				return false;
+			}
+		}
+		return true;
+	}, InvalidNoteId);
+}
+
+Note Storyboard::note(NoteId id) const
+{
+	auto const &rec = m_notes[id];
+	Note n;
+	n.title = m_strings.str(rec.title);
+	n.text = m_strings.str(rec.text);
+	for (auto tag : rec.tags) {
+		n.tags.emplace(m_strings.str(tag));
+	}
+	return n;
+}
+
+std::string Storyboard::stats(StatsFormat format) const
+{
+	MetricsReport report;
+	report.add("storyboard_notes", "gauge", {}, static_cast<double>(m_noteCount));
+	report.add("storyboard_note_slots", "gauge", {}, static_cast<double>(m_notes.size()));
+	report.add("storyboard_strings", "gauge", {}, static_cast<double>(m_strings.size()));
+	if (m_tokenIndexEnabled) {
+		report.add("storyboard_words", "gauge", {}, static_cast<double>(m_tokenIndex.size()));
+	}
+
+	const size_t hotKeys = 10;
+	const std::pair<const char*, const PostingIndex*> indexes[] = {
+		{"title", &m_titleMap}, {"text", &m_textMap}, {"tag", &m_tagsMap},
+	};
+	for (auto const &index : indexes) {
+		MetricsReport::Labels labels = {{"index", index.first}};
+		Histogram lengths;
+		size_t ids = 0, dead = 0;
+		std::vector<std::pair<size_t, SymbolId>> sizes;
+		index.second->forEach([&](SymbolId key, const PostingList &list) {
+			lengths.record(list.size());
+			ids += list.ids.size();
+			dead += list.dead;
+			sizes.emplace_back(list.size(), key);
+		});
+		report.add("storyboard_index_keys", "gauge", labels, static_cast<double>(index.second->size()));
+		report.add("storyboard_index_ids", "gauge", labels, static_cast<double>(ids));
+		report.add("storyboard_index_dead_ids", "gauge", labels, static_cast<double>(dead));
+		report.summary("storyboard_posting_list_length", labels, lengths);
+
+		auto top = sizes.begin() + std::min(hotKeys, sizes.size());
+		std::partial_sort(sizes.begin(), top, sizes.end(), std::greater<std::pair<size_t, SymbolId>>());
+		for (auto it = sizes.begin(); it != top; ++it) {
+			report.add("storyboard_hot_key_notes", "gauge", {{"index", index.first}, {"key", std::string(m_strings.str(it->second))}},
+				static_cast<double>(it->first));
+		}
+	}
+#ifdef STORYBOARD_METRICS
+	m_metrics.report(report, "storyboard_");
+#endif
+	return format == StatsFormat::Json ? report.json() : report.prometheus();
 }
 
 using NoteSet = Storyboard::NoteSet;
 
-NoteSet Storyboard::searchByTitle(const std::string &title) const
+NoteSet Storyboard::notes() const
+{
+	NoteSet s;
+	for (NoteId id = 0; id < m_notes.size(); id++) {
+		if (m_notes[id].alive()) {
+			s.insert(note(id));
+		}
+	}
+	return s;
+}
+
+using Result = Storyboard::Result;
+
+Result Storyboard::searchByTitle(const std::string &title) const
 {
+	STORYBOARD_TIME(m_metrics, SearchByTitle);
 	return searchHelper(m_titleMap, title);
 }
 
-NoteSet Storyboard::searchByText(const std::string &text) const
+Result Storyboard::searchByText(const std::string &text) const
 {
+	STORYBOARD_TIME(m_metrics, SearchByText);
 	return searchHelper(m_textMap, text);
 }
 
-NoteSet Storyboard::searchByTag(const std::string &tag) const
+Result Storyboard::searchByTag(const std::string &tag) const
 {
+	STORYBOARD_TIME(m_metrics, SearchByTag);
 	return searchHelper(m_tagsMap, tag);
 }
 
-NoteSet Storyboard::searchByTag(const std::set<std::string> &tags) const
+Result Storyboard::searchByTitle(const std::string &title, size_t limit, Cursor &cursor) const
 {
-	NoteSet s;
+	return pageHelper(m_titleMap, title, limit, cursor);
+}
 
-	for (auto const &tag : tags) {
-		auto s2 = searchByTag(tag);
-		// set::merge is not available until c++17...
-		for (auto const &t : s2) {
-			s.insert(t);
-		}
+Result Storyboard::searchByText(const std::string &text, size_t limit, Cursor &cursor) const
+{
+	return pageHelper(m_textMap, text, limit, cursor);
+}
+
+Result Storyboard::searchByTag(const std::string &tag, size_t limit, Cursor &cursor) const
+{
+	return pageHelper(m_tagsMap, tag, limit, cursor);
+}
+
+std::shared_ptr<const NoteSet> Storyboard::notesByTitle(const std::string &title) const
+{
+	return cachedSearch(ResultCache::Title, m_titleMap, title);
+}
+
+std::shared_ptr<const NoteSet> Storyboard::notesByText(const std::string &text) const
+{
+	return cachedSearch(ResultCache::Text, m_textMap, text);
+}
+
+std::shared_ptr<const NoteSet> Storyboard::notesByTag(const std::string &tag) const
+{
+	return cachedSearch(ResultCache::Tag, m_tagsMap, tag);
+}
+
+Result Storyboard::searchByTag(const std::set<std::string> &tags) const
+{
+	if (tags.size() == 1) {
+		return searchByTag(*tags.begin());
 	}
+	STORYBOARD_TIME(m_metrics, SearchByTags);
+	auto ids = unitePostings(m_tagsMap, tags);
+	dropDeleted(ids);
+	return Result(this, std::move(ids));
+}
 
-	return s;
+Result Storyboard::searchByWords(const std::string &words) const
+{
+	if (!m_tokenIndexEnabled) {
+		throw std::logic_error("Text token index is disabled");
+	}
+	STORYBOARD_TIME(m_metrics, SearchByWords);
+	auto ids = m_tokenIndex.matchAll(TokenIndex::tokenize(words));
+	dropDeleted(ids);
+	return Result(this, std::move(ids));
+}
+
+Result Storyboard::searchByPhrase(const std::string &phrase) const
+{
+	if (!m_tokenIndexEnabled) {
+		throw std::logic_error("Text token index is disabled");
+	}
+	STORYBOARD_TIME(m_metrics, SearchByPhrase);
+	auto ids = m_tokenIndex.matchPhrase(TokenIndex::tokenize(phrase));
+	dropDeleted(ids);
+	return Result(this, std::move(ids));
+}
+
+const KeyTrie &Storyboard::titleKeys() const
+{
+	if (!m_keyTriesEnabled) {
+		throw std::logic_error("Key tries are disabled");
+	}
+	return m_titleKeys;
 }
 
-using StringNoteMap = Storyboard::StringNoteMap;
+const KeyTrie &Storyboard::tagKeys() const
+{
+	if (!m_keyTriesEnabled) {
+		throw std::logic_error("Key tries are disabled");
+	}
+	return m_tagKeys;
+}
 
-NoteSet Storyboard::searchHelper(const StringNoteMap &map, const std::string &str) const
+Result Storyboard::searchByTags(const TagQuery &query) const
 {
-	auto range = map.equal_range(str); // Note: log complexity
-	if (range.first == map.end()) {
-		return NoteSet(); // none
+	STORYBOARD_TIME(m_metrics, SearchByTags);
+	if (query.allOf.empty() && query.anyOf.empty()) {
+		return Result();
+	}
+
+	std::vector<NoteId> ids;
+	std::vector<NoteId> tmp;
+	bool first = true;
+
+	if (!query.allOf.empty()) {
+		std::vector<const PostingList*> lists;
+		for (auto const &tag : query.allOf) {
+			auto list = postings(m_tagsMap, tag);
+			if (!list) {
+				return Result(); // unknown tag -> nothing has all of them
+			}
+			lists.push_back(list);
+		}
+		// smallest first, so the intermediate result is as short as possible
+		std::sort(lists.begin(), lists.end(), [](const PostingList *a, const PostingList *b) {
+			return a->ids.size() < b->ids.size();
+		});
+		ids.assign(lists[0]->ids.begin(), lists[0]->ids.end());
+		for (size_t i = 1; i < lists.size() && !ids.empty(); i++) {
+			tmp.clear();
+			PostingAlgebra::intersect(ids, lists[i]->ids, tmp);
+			ids.swap(tmp);
+		}
+		first = false;
+	}
+
+	if (!query.anyOf.empty()) {
+		auto any = unitePostings(m_tagsMap, query.anyOf);
+		if (first) {
+			ids.swap(any);
+		} else {
+			tmp.clear();
+			PostingAlgebra::intersect(ids, any, tmp);
+			ids.swap(tmp);
+		}
 	}
+
+	for (auto const &tag : query.noneOf) {
+		auto list = postings(m_tagsMap, tag);
+		if (list && !ids.empty()) {
+			tmp.clear();
+			PostingAlgebra::subtract(ids, list->ids, tmp);
+			ids.swap(tmp);
+		}
+	}
+
+	dropDeleted(ids);
+	return Result(this, std::move(ids));
+}
+
+std::vector<NoteId> Storyboard::unitePostings(const PostingIndex &index, const std::set<std::string> &keys) const
+{
+	std::vector<const PostingList*> lists;
+	for (auto const &key : keys) {
+		auto list = postings(index, key);
+		if (list) {
+			lists.push_back(list);
+		}
+	}
+	// shortest lists first, the long ones are merged into the accumulated result only once
+	std::sort(lists.begin(), lists.end(), [](const PostingList *a, const PostingList *b) {
+		return a->ids.size() < b->ids.size();
+	});
+
+	std::vector<NoteId> ids;
+	std::vector<NoteId> tmp;
+	for (auto list : lists) {
+		tmp.clear();
+		PostingAlgebra::unite(ids, list->ids, tmp);
+		ids.swap(tmp);
+	}
+	return ids;
+}
+
+void Storyboard::dropDeleted(std::vector<NoteId> &ids) const
+{
+	ids.erase(std::remove_if(ids.begin(), ids.end(), [this](NoteId id) { return !contains(id); }), ids.end());
+}
+
+bool Result::contains(const Note &note) const
+{
+	return m_board && contains(m_board->findNote(note));
+}
+
+NoteSet Result::toNoteSet() const
+{
 	NoteSet s;
-	for (auto it = range.first; it != range.second; it++) {
-		s.insert(*(it->second));
+	for (auto const &n : *this) {
+		s.insert(n.toNote());
 	}
 	return s;
 }
 
-void Storyboard::removeNoteMapItems(StringNoteMap &map,  const Note &note, const std::string &str)
+std::vector<NoteId> Result::ids() const
 {
-	auto range = map.equal_range(str); // Note: log complexity
-	if (range.first != map.end()) {
-		for (auto it = range.first; it != range.second; ) {
-			auto n = *(it->second);
-			if (n == note) {
-				it = map.erase(it);
-			} else {
-				it++;
-			}
+	std::vector<NoteId> v;
+	v.reserve(m_size);
+	for (auto it = begin(); it != end(); ++it) {
+		v.push_back(it.id());
+	}
+	return v;
+}
+
+const PostingList *Storyboard::postings(const PostingIndex &index, const std::string &str) const
+{
+	auto sym = m_strings.find(str); // Note: hash lookup, the indexes compare integers only
+	if (sym == StringPool::npos) {
+		return nullptr;
+	}
+	return index.find(sym);
+}
+
+Result Storyboard::searchHelper(const PostingIndex &index, const std::string &str) const
+{
+	auto list = postings(index, str);
+	if (!list) {
+		return Result(); // none
+	}
+	return Result(this, *list);
+}
+
+std::shared_ptr<const NoteSet> Storyboard::cachedSearch(ResultCache::Field field, const PostingIndex &index,
+	const std::string &key) const
+{
+	if (m_cache.enabled()) {
+		if (auto hit = m_cache.find(field, key)) {
+			return hit;
 		}
 	}
+	auto notes = std::make_shared<const NoteSet>(searchHelper(index, key).toNoteSet());
+	if (m_cache.enabled()) {
+		m_cache.insert(field, key, notes);
+	}
+	return notes;
+}
+
+void Storyboard::invalidateCached(const Note &note)
+{
+	if (m_cache.enabled()) {
+		m_cache.invalidate(ResultCache::Title, note.title);
+		m_cache.invalidate(ResultCache::Text, note.text);
+		for (auto const &tag : note.tags) {
+			m_cache.invalidate(ResultCache::Tag, tag);
+		}
+	}
+}
+
+Result Storyboard::pageHelper(const PostingIndex &index, const std::string &str, size_t limit, Cursor &cursor) const
+{
+	std::vector<NoteId> ids;
+	auto list = postings(index, str);
+	if (!list) {
+		cursor.done = true;
+		return Result();
+	}
+	auto last = list->ids.end();
+	auto it = std::lower_bound(list->ids.begin(), last, cursor.next);
+	for (; it != last && ids.size() < limit; ++it) {
+		if (contains(*it)) {
+			ids.push_back(*it);
+		}
+	}
+	// Note: trailing dead ids are skipped now rather than on the next call, so done is exact
+	while (it != last && !contains(*it)) {
+		++it;
+	}
+	cursor.done = it == last;
+	if (it != last) {
+		cursor.next = *it;
+	} else if (!list->ids.empty()) {
+		cursor.next = std::max(cursor.next, list->ids.back() + 1);
+	}
+	return Result(this, std::move(ids));
+}
+
+void Storyboard::removeNoteMapItems(PostingIndex &index, SymbolId key)
+{
+	auto list = index.find(key);
+	if (!list) {
+		return;
+	}
+	list->dead++;
+	if (list->empty()) {
+		index.erase(key); // the key symbol may be recycled by the string pool
+	} else if (list->needsCompaction()) {
+		// amortized: at least ids.size() / 2 deletions happened since the last compaction
+		auto &ids = list->ids;
+		STORYBOARD_RECORD(m_metrics, CompactionScan, ids.size());
+		STORYBOARD_COUNT(m_metrics, Compactions, 1);
+		ids.erase(std::remove_if(ids.begin(), ids.end(), [this](NoteId id) { return !contains(id); }), ids.end());
+		list->dead = 0;
+	}
 }
 
 
@@ -141,6 +848,22 @@ std::ostream& operator<<(std::ostream &os, const Storyboard::NoteSet &notes)
 	return os;
 }
 
+// debug/testing purpose only
+std::ostream& operator<<(std::ostream &os, const Storyboard::Result &notes)
+{
+	if (notes.empty()) {
+		os << "{}";
+		return os;
+	}
+
+	os << "{" << std::endl;
+	for (auto const &n : notes) {
+		os << "\t" << n.toNote() << std::endl;
+	}
+	os << "}";
+	return os;
+}
+
 // debug/testing purpose only
 std::ostream& operator<<(std::ostream &os, const Storyboard &sb)
 {
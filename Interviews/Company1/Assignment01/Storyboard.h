@@ -28,13 +28,29 @@
 
 // Martin Flaska - flegy@flegy.sk / https://www.linkedin.com/in/martinflaska
 
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
 #include <list>
 #include <map>
 #include <memory>
 #include <set>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "Arena.h"
+#include "ChangeFeed.h"
+#include "Fingerprint.h"
+#include "KeyTrie.h"
+#include "Metrics.h"
+#include "PostingIndex.h"
+#include "ResultCache.h"
+#include "StringPool.h"
+#include "TagSet.h"
+#include "TokenIndex.h"
 
 
 struct Note
@@ -45,64 +61,395 @@ struct Note
 
 	bool operator==(const Note &note) const;
 	bool operator<(const Note &note) const;
+	/** 128 bit content fingerprint (all the fields) */
+	Fingerprint fingerprint() const;
+	/** Content hash (all the fields) */
+	size_t hash() const;
 };
 
-
 class Storyboard
 {
+	struct NoteRecord;
+	friend class MappedStoryboard; // snapshot writer
+
 public:
-	void addNote(const Note &note);
+	static const NoteId InvalidNoteId = static_cast<NoteId>(-1);
+
+	/** Index backend per searchable field */
+	struct Options
+	{
+		IndexKind titleIndex = IndexKind::Hash;
+		IndexKind textIndex = IndexKind::Hash;
+		IndexKind tagIndex = IndexKind::Hash;
+		/** Keep a word index of note texts (needed by searchByWords/searchByPhrase) */
+		bool textTokenIndex = false;
+		/** Keep tries of title and tag keys (needed by titleKeys/tagKeys) */
+		bool keyTries = false;
+		/** Max number of results kept by notesByTitle/notesByText/notesByTag, 0 disables the cache */
+		size_t resultCache = 0;
+		/** Arena owned by the board for the strings, notes and field indexes */
+		ArenaKind arena = ArenaKind::None;
+		/** External memory resource used instead of the arena, must outlive the board
+		 *  (the word index and the key tries always use the default resource)
+		 */
+		std::pmr::memory_resource *memory = nullptr;
+	};
+
+	Storyboard();
+	explicit Storyboard(const Options &options);
+
+	/** Add a note
+	 * @return Id of the (new or already existing) note
+	 */
+	NoteId addNote(const Note &note);
+
+	/** Bulk load
+	 *
+	 * Sorts and dedupes the input, interns all the strings and then builds every index from
+	 * sorted runs (one reserve + append per posting list) instead of note by note inserts.
+	 * Index construction and sorting run on up to @threads threads (index construction runs
+	 * on a single one with an arena or a custom memory resource, those are not thread safe).
+	 *
+	 * @return Number of added notes (duplicates and already present notes are skipped)
+	 *
+	 * @{
+	 */
+	template<typename It>
+	size_t addNotes(It first, It last, unsigned threads = 1)
+	{
+		std::vector<const Note*> notes;
+		for (; first != last; ++first) {
+			notes.push_back(&*first);
+		}
+		return bulkLoad(notes, threads);
+	}
+	size_t addNotes(const std::vector<Note> &notes, unsigned threads = 1)
+	{
+		return addNotes(notes.begin(), notes.end(), threads);
+	}
+	/* @} */
 	void deleteNote(const Note &note);
+	/** Delete note by id, O(1) per index entry of the note */
+	void deleteNote(NoteId id);
+
+	/** Reclaim the slots of deleted notes by renumbering the live notes to 0 .. size() - 1
+	 *
+	 * Deleted notes keep their (empty) record and id until this is called, so under churn the
+	 * board grows with every note ever added. Live notes keep their relative order, hence every
+	 * posting list stays sorted and is rewritten in a single pass, the cost is O(slots + index
+	 * entries).
+	 * @note All the NoteIds, NoteRefs, Results and Cursors taken before are invalidated (their ids
+	 *       may refer to other notes now), as are the ids of change events published before.
+	 * @return Number of reclaimed slots
+	 */
+	size_t compactIds();
+	/** More than a half of the note slots belong to deleted notes, i.e. compactIds() is due
+	 *  (calling it then keeps deletes amortized O(1))
+	 */
+	bool needsIdCompaction() const { return (m_notes.size() - m_noteCount) * 2 > m_notes.size(); }
 
 	typedef std::set<Note> NoteSet;
 
- 	NoteSet searchByTitle(const std::string &title) const;
-	NoteSet searchByText(const std::string &text) const;
-	NoteSet searchByTag(const std::string &tag) const;
+	class Result;
+
+	/** Lightweight reference to a note stored in the board
+	 *
+	 * Strings are returned as views into the string pool, nothing is copied.
+	 * @note Valid until the board is modified.
+	 */
+	class NoteRef
+	{
+	public:
+		NoteRef(const Storyboard *board, NoteId id) : m_board(board), m_id(id) {}
+
+		NoteId id() const { return m_id; }
+		std::string_view title() const { return m_board->m_strings.str(record().title); }
+		std::string_view text() const { return m_board->m_strings.str(record().text); }
+		size_t tagCount() const { return record().tags.size(); }
+		std::string_view tag(size_t i) const { return m_board->m_strings.str(record().tags[i]); }
+
+		Note toNote() const { return m_board->note(m_id); }
+
+	private:
+		const NoteRecord &record() const { return m_board->m_notes[m_id]; }
+
+	private:
+		const Storyboard *m_board;
+		NoteId m_id;
+	};
+
+	/** Search results
+	 *
+	 * Single key lookups are a view of the index posting list itself, so a query costs
+	 * a lookup plus a walk over note ids and does not allocate. Results combined from several
+	 * keys own a sorted vector of note ids (still no note copies).
+	 *
+	 * @note Valid until the board is modified. Use toNoteSet() to get an owning copy.
+	 */
+	class Result
+	{
+	public:
+		/** Walks note ids, ids of deleted notes (not compacted yet) are skipped */
+		class const_iterator
+		{
+		public:
+			typedef std::forward_iterator_tag iterator_category;
+			typedef NoteRef value_type;
+			typedef std::ptrdiff_t difference_type;
+			typedef const NoteRef *pointer;
+			typedef NoteRef reference;
+
+			const_iterator(const Storyboard *board, const NoteId *pos, const NoteId *last)
+				: m_board(board), m_pos(pos), m_last(last) { skipDead(); }
+
+			NoteRef operator*() const { return NoteRef(m_board, *m_pos); }
+			NoteId id() const { return *m_pos; }
+			const_iterator &operator++() { ++m_pos; skipDead(); return *this; }
+			const_iterator operator++(int) { auto it = *this; ++(*this); return it; }
+			bool operator==(const const_iterator &other) const { return m_pos == other.m_pos; }
+			bool operator!=(const const_iterator &other) const { return m_pos != other.m_pos; }
+
+		private:
+			void skipDead()
+			{
+				while (m_pos != m_last && !m_board->contains(*m_pos)) {
+					++m_pos;
+				}
+			}
+
+		private:
+			const Storyboard *m_board;
+			const NoteId *m_pos;
+			const NoteId *m_last;
+		};
+
+		Result() = default;
+		Result(const Storyboard *board, const PostingList &list)
+			: m_board(board), m_first(list.ids.data()), m_last(list.ids.data() + list.ids.size())
+			, m_size(list.size()) {}
+		/** @param ids Sorted ids of live notes */
+		Result(const Storyboard *board, std::vector<NoteId> &&ids)
+			: m_board(board), m_size(ids.size()), m_owned(std::move(ids)) {}
+
+		const_iterator begin() const { return const_iterator(m_board, first(), last()); }
+		const_iterator end() const { return const_iterator(m_board, last(), last()); }
+		size_t size() const { return m_size; }
+		bool empty() const { return m_size == 0; }
+
+		bool contains(NoteId id) const { return std::binary_search(first(), last(), id) && m_board->contains(id); }
+		bool contains(const Note &note) const;
+
+		/** Explicitly materialize the result */
+		NoteSet toNoteSet() const;
+		std::vector<NoteId> ids() const;
+
+	private:
+		const NoteId *first() const { return m_owned.empty() ? m_first : m_owned.data(); }
+		const NoteId *last() const { return m_owned.empty() ? m_last : m_owned.data() + m_owned.size(); }
+
+	private:
+		const Storyboard *m_board = nullptr;
+		const NoteId *m_first = nullptr;
+		const NoteId *m_last = nullptr;
+		size_t m_size = 0;
+		std::vector<NoteId> m_owned; ///< combined results only
+	};
+
+	Result searchByTitle(const std::string &title) const;
+	Result searchByText(const std::string &text) const;
+	Result searchByTag(const std::string &tag) const;
+
+	/** Position of a paged search
+	 *
+	 * Pages list notes in id order and the cursor keeps the id to continue from, so resuming
+	 * is a binary search in the posting list and no skipped entries are walked again. The cursor
+	 * stays valid when the board is modified: deleted notes are skipped and notes added later
+	 * come last (ids are not reused until compactIds(), which invalidates cursors).
+	 */
+	struct Cursor
+	{
+		NoteId next = 0; ///< the lowest note id of the next page
+		bool done = false; ///< the last page has been returned (notes added later are still found)
+	};
+
+	/** Next page of up to @limit notes, @cursor is advanced past them
+	 *
+	 * Memory is bounded by @limit, the page owns its ids.
+	 * @{
+	 */
+	Result searchByTitle(const std::string &title, size_t limit, Cursor &cursor) const;
+	Result searchByText(const std::string &text, size_t limit, Cursor &cursor) const;
+	Result searchByTag(const std::string &tag, size_t limit, Cursor &cursor) const;
+	/* @} */
+
+	/** Materialized single key search results
+	 *
+	 * With Options::resultCache hot keys are served from an LRU cache, an entry is dropped
+	 * when a note with its key is added or deleted. The result is shared with the cache.
+	 * @{
+	 */
+	std::shared_ptr<const NoteSet> notesByTitle(const std::string &title) const;
+	std::shared_ptr<const NoteSet> notesByText(const std::string &text) const;
+	std::shared_ptr<const NoteSet> notesByTag(const std::string &tag) const;
+	/* @} */
+	/** Hit / miss counters of the result cache */
+	ResultCache::Stats cacheStats() const { return m_cache.stats(); }
 
 	// Convenient method to allow search for multiple / non-identical tags
-	// Note: For simplicity, there is no check for identical tags
-	//       but the returned value is ok anyway.
-	template<typename... Args>
-	NoteSet searchByTag(const std::string &tag, Args... args) const
+	template<typename... Args, typename = std::enable_if_t<(std::is_convertible<Args, std::string>::value && ...)>>
+	Result searchByTag(const std::string &tag, Args... args) const
 	{
-		auto s = searchByTag(tag);
-		auto s2 = searchByTag(args...);
-		// set::merge is not available until c++17...
-		for (auto const &t : s2) {
-			s.insert(t);
-		}
-		return s;
+		return searchByTag(std::set<std::string>{tag, args...});
 	}
 
-	NoteSet searchByTag(const std::set<std::string> &tags) const;
+	/** Notes having any of @tags */
+	Result searchByTag(const std::set<std::string> &tags) const;
+
+	/** Full text search, only available with Options::textTokenIndex
+	 *
+	 * Words are matched case insensitively, punctuation is ignored.
+	 * @throw std::logic_error if the token index is disabled
+	 *
+	 * @{
+	 */
+	/** Notes containing all the words of @words (in any order) */
+	Result searchByWords(const std::string &words) const;
+	/** Notes containing the words of @phrase next to each other */
+	Result searchByPhrase(const std::string &phrase) const;
+	/* @} */
+
+	/** Title / tag keys with their note counts, only available with Options::keyTries
+	 *
+	 * Answers prefix, lexicographic range and top-k by note count queries (autocomplete)
+	 * without scanning the notes; the keys found can be passed to searchByTitle/searchByTag.
+	 * @throw std::logic_error if the key tries are disabled
+	 *
+	 * @{
+	 */
+	const KeyTrie &titleKeys() const;
+	const KeyTrie &tagKeys() const;
+	/* @} */
+
+	/** Boolean tag query
+	 *
+	 * Matches notes having all of @allOf, at least one of @anyOf and none of @noneOf. Empty
+	 * @allOf / @anyOf do not restrict the result, but at least one of them must be given
+	 * (there is no "all notes" query).
+	 */
+	struct TagQuery
+	{
+		std::set<std::string> allOf;  ///< AND
+		std::set<std::string> anyOf;  ///< OR
+		std::set<std::string> noneOf; ///< AND NOT
+	};
+
+	/** Evaluate @query over the sorted tag posting lists (smallest list first for AND) */
+	Result searchByTags(const TagQuery &query) const;
+
+	/** Subscribe to added / removed note events of notes having any of @tags (all if empty)
+	 *
+	 * Sequence numbers increase by one with every change of the board, events of other notes
+	 * are filtered out here. A subscriber which lets @capacity events pile up overflows and
+	 * has to rescan the board (at sequence()) and subscribe again.
+	 * @note Subscribing is a modification of the board (the same thread safety rules apply),
+	 *       the subscription itself can be polled from any thread.
+	 */
+	ChangeFeed::Subscription subscribe(const std::set<std::string> &tags = {}, size_t capacity = 4096)
+	{
+		return m_feed.subscribe(tags, capacity);
+	}
+	/** Sequence number of the last change */
+	uint64_t sequence() const { return m_feed.sequence(); }
+
+	/** Find id of @note by its fingerprint, strings are compared on a match only
+	 * @return Note id or InvalidNoteId if there is no such note
+	 */
+	NoteId findNote(const Note &note) const;
+	bool contains(NoteId id) const { return id < m_notes.size() && m_notes[id].alive(); }
+	/** Materialize a note (the board itself keeps only interned strings) */
+	Note note(NoteId id) const;
+	size_t size() const { return m_noteCount; }
+
+	enum class StatsFormat { Prometheus, Json };
+
+	/** Monitoring data
+	 *
+	 * Index sizes, posting list length distributions and the largest posting lists (hot keys)
+	 * of every field index, plus operation latency histograms and counters when built with
+	 * STORYBOARD_METRICS. The indexes are walked, so the cost is O(number of keys).
+	 */
+	std::string stats(StatsFormat format = StatsFormat::Prometheus) const;
 
 	// debug/testing purpose only
-	const NoteSet & notes() const { return m_notes; }
-	using StringNoteMap = std::multimap<std::string, NoteSet::const_iterator>;
+	NoteSet notes() const;
 
 private:
-	NoteSet searchHelper(const StringNoteMap &map, const std::string &str) const;
-
-	/** helper method to remove all @map items related to @note
+	/** Compact note representation
 	 *
-	 * @Note std::erase_if could be used for c++20 with the same predicate for all maps...
+	 * All the strings are kept in the string pool, so a note costs a few symbol ids only
+	 * no matter how long its title and text are. Small tag sets are stored inline.
 	 */
-	void removeNoteMapItems(StringNoteMap &map,  const Note &note, const std::string &str);
+	struct NoteRecord
+	{
+		SymbolId title = StringPool::npos;
+		SymbolId text = StringPool::npos;
+		TagSet tags;
+
+		bool alive() const { return title != StringPool::npos; }
+	};
+
+	/** Intern strings of @note into @rec */
+	void internNote(const Note &note, NoteRecord &rec);
+	/** Same as Note::fingerprint() of the note */
+	Fingerprint fingerprint(const NoteRecord &rec) const;
+	NoteId findNote(const Note &note, const Fingerprint &fp) const;
 
-	// To have variadic searchByTag
-	NoteSet searchByTag() const { return NoteSet();	}
+	Result searchHelper(const PostingIndex &index, const std::string &str) const;
+	std::shared_ptr<const NoteSet> cachedSearch(ResultCache::Field field, const PostingIndex &index, const std::string &key) const;
+	/** Drop cached results of the @note keys */
+	void invalidateCached(const Note &note);
+	Result pageHelper(const PostingIndex &index, const std::string &str, size_t limit, Cursor &cursor) const;
+	const PostingList *postings(const PostingIndex &index, const std::string &str) const;
+
+	size_t bulkLoad(std::vector<const Note*> &notes, unsigned threads);
+	/** Append @ids to the @index posting lists of @keys (ids sorted, keys[i] belongs to ids[i]) */
+	void appendPostings(PostingIndex &index, const std::vector<SymbolId> &keys, const std::vector<NoteId> &ids);
+
+	/** Union of all the @keys posting lists (ids of deleted notes included) */
+	std::vector<NoteId> unitePostings(const PostingIndex &index, const std::set<std::string> &keys) const;
+	/** Remove ids of deleted notes */
+	void dropDeleted(std::vector<NoteId> &ids) const;
+
+	/** helper method to drop a deleted note from the @index posting list of @key
+	 *
+	 * The note must be already marked as deleted in m_notes. Its id is only counted as dead,
+	 * the list gets compacted once most of it is dead.
+	 */
+	void removeNoteMapItems(PostingIndex &index, SymbolId key);
 
 private:
-	NoteSet m_notes;
-	// maps value to note set item
-	StringNoteMap m_titleMap;
-	StringNoteMap m_textMap;
-	StringNoteMap m_tagsMap;
+	Arena m_arena; // Note: first, it must outlive all the containers allocating from it
+	StringPool m_strings;
+	std::pmr::vector<NoteRecord> m_notes; // index is NoteId, deleted notes stay as empty records until compactIds()
+	FingerprintIndex m_fingerprints; // content fingerprint -> live note, duplicate detection
+	size_t m_noteCount = 0;
+	// maps interned value to ids of notes
+	PostingIndex m_titleMap;
+	PostingIndex m_textMap;
+	PostingIndex m_tagsMap;
+	bool m_tokenIndexEnabled;
+	TokenIndex m_tokenIndex; // empty unless enabled
+	bool m_keyTriesEnabled;
+	KeyTrie m_titleKeys; // empty unless enabled
+	KeyTrie m_tagKeys;
+	ChangeFeed m_feed;
+	mutable ResultCache m_cache; // filled by const searches
+	mutable Metrics m_metrics; // recorded by const searches too
 };
 
 
 // debug/testing purpose only
 std::ostream& operator<< (std::ostream &os, const Note &n);
 std::ostream& operator<<(std::ostream &os, const Storyboard::NoteSet &notes);
+std::ostream& operator<<(std::ostream &os, const Storyboard::Result &notes);
 std::ostream& operator<<(std::ostream &os, const Storyboard &sb);
@@ -0,0 +1,90 @@
+#include "StringPool.h"
+
+const SymbolId StringPool::npos;
+
+
+StringPool::StringPool(std::pmr::memory_resource *memory)
+	: m_entries(memory)
+	, m_free(memory)
+	, m_lookup(memory)
+{
+}
+
+StringPool::StringPool(const StringPool &other)
+	: m_entries(other.m_entries)
+	, m_free(other.m_free)
+{
+	rebuildLookup();
+}
+
+StringPool &StringPool::operator=(const StringPool &other)
+{
+	if (this != &other) {
+		m_entries = other.m_entries;
+		m_free = other.m_free;
+		rebuildLookup();
+	}
+	return *this;
+}
+
+StringPool &StringPool::operator=(StringPool &&other)
+{
+	// Note: with different memory resources the entries are moved one by one, so short
+	//       (inline) strings change their address and the lookup must be rebuilt
+	m_entries = std::move(other.m_entries);
+	m_free = std::move(other.m_free);
+	rebuildLookup();
+	other.m_lookup.clear();
+	return *this;
+}
+
+SymbolId StringPool::intern(const std::string &str)
+{
+	auto it = m_lookup.find(str);
+	if (it != m_lookup.end()) {
+		m_entries[it->second].refs++;
+		return it->second;
+	}
+
+	SymbolId id;
+	if (!m_free.empty()) {
+		id = m_free.back();
+		m_free.pop_back();
+		m_entries[id].str.assign(str);
+		m_entries[id].refs = 1;
+	} else {
+		id = static_cast<SymbolId>(m_entries.size());
+		// Note: Entry is not allocator aware, the string has to get the resource explicitly
+		m_entries.push_back({std::pmr::string(str, m_entries.get_allocator()), 1});
+	}
+	m_lookup.insert({m_entries[id].str, id});
+	return id;
+}
+
+void StringPool::release(SymbolId id)
+{
+	auto &e = m_entries[id];
+	if (--e.refs > 0) {
+		return;
+	}
+	m_lookup.erase(e.str);
+	e.str.clear();
+	e.str.shrink_to_fit(); // give the memory back, not just clear()
+	m_free.push_back(id);
+}
+
+SymbolId StringPool::find(const std::string &str) const
+{
+	auto it = m_lookup.find(str);
+	return it == m_lookup.end() ? npos : it->second;
+}
+
+void StringPool::rebuildLookup()
+{
+	m_lookup.clear();
+	for (SymbolId id = 0; id < m_entries.size(); id++) {
+		if (m_entries[id].refs > 0) {
+			m_lookup.insert({m_entries[id].str, id});
+		}
+	}
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+// Martin Flaska - flegy@flegy.sk / https://www.linkedin.com/in/martinflaska
+
+#include <cstdint>
+#include <deque>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+typedef uint32_t SymbolId;
+
+/** Reference counted string interner
+ *
+ * Every distinct string is stored exactly once and is represented by a small dense SymbolId.
+ * Ids of released strings are recycled.
+ *
+ * @note Strings live in a deque so their addresses are stable and the lookup table can refer
+ *       to them instead of keeping its own copy of every key.
+ * @note All the memory (strings included) comes from the given memory resource. Copies use
+ *       the default resource, like std::pmr containers do.
+ */
+class StringPool
+{
+public:
+	static const SymbolId npos = static_cast<SymbolId>(-1);
+
+	explicit StringPool(std::pmr::memory_resource *memory = std::pmr::get_default_resource());
+	StringPool(const StringPool &other);
+	StringPool(StringPool &&other) = default;
+	StringPool &operator=(const StringPool &other);
+	StringPool &operator=(StringPool &&other);
+
+	/** Return id of @str (adding it if needed) and take a reference to it */
+	SymbolId intern(const std::string &str);
+	/** Take another reference to an already interned string */
+	void retain(SymbolId id) { m_entries[id].refs++; }
+	/** Drop a reference; the string is freed once nobody uses it */
+	void release(SymbolId id);
+
+	/** Lookup without interning
+	 * @return Id of @str or npos if @str is not in the pool
+	 */
+	SymbolId find(const std::string &str) const;
+
+	std::string_view str(SymbolId id) const { return m_entries[id].str; }
+
+	/** Prepare for @count more strings (avoids rehashing during bulk loads) */
+	void reserve(size_t count) { m_lookup.reserve(m_lookup.size() + count); }
+
+	std::pmr::memory_resource *resource() const { return m_entries.get_allocator().resource(); }
+
+	/** Number of live strings */
+	size_t size() const { return m_lookup.size(); }
+	/** All the ids handed out so far are below this bound */
+	size_t idBound() const { return m_entries.size(); }
+
+private:
+	struct Entry
+	{
+		std::pmr::string str;
+		uint32_t refs;
+	};
+
+	void rebuildLookup();
+
+private:
+	std::pmr::deque<Entry> m_entries; // index is SymbolId
+	std::pmr::vector<SymbolId> m_free;
+	std::pmr::unordered_map<std::string_view, SymbolId> m_lookup; // keys point into m_entries
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+// Martin Flaska - flegy@flegy.sk / https://www.linkedin.com/in/martinflaska
+
+#include <algorithm>
+#include <cstdint>
+#include <memory_resource>
+
+#include "StringPool.h"
+
+
+/** Sorted set of tag symbols with small set optimization
+ *
+ * Up to InlineCapacity tags are stored in the object itself (notes carry a few tags only), so
+ * a note record needs no extra allocation and its tags are on the same cache line. Larger sets
+ * go to a block allocated from the given memory resource; the block remembers the resource,
+ * hence the set itself stays small.
+ *
+ * @note Copies allocate from the default resource, like std::pmr containers do.
+ */
+class TagSet
+{
+public:
+	static const size_t InlineCapacity = 6;
+
+	TagSet() = default;
+	~TagSet() { clear(); }
+
+	TagSet(const TagSet &other) { copy(other); }
+	TagSet(TagSet &&other) noexcept { steal(other); }
+	TagSet &operator=(const TagSet &other)
+	{
+		if (this != &other) {
+			clear();
+			copy(other);
+		}
+		return *this;
+	}
+	TagSet &operator=(TagSet &&other) noexcept
+	{
+		if (this != &other) {
+			clear();
+			steal(other);
+		}
+		return *this;
+	}
+
+	/** Make room for @n tags (content is undefined), fill them in and sort()
+	 * @return Pointer to the tags
+	 */
+	SymbolId *resize(size_t n, std::pmr::memory_resource *memory)
+	{
+		clear();
+		if (n > InlineCapacity) {
+			auto block = static_cast<Block*>(memory->allocate(blockSize(n), alignof(Block)));
+			block->memory = memory;
+			m_heap = block;
+		}
+		m_size = static_cast<uint32_t>(n);
+		return data();
+	}
+	void sort() { std::sort(data(), data() + m_size); }
+	void clear()
+	{
+		if (m_size > InlineCapacity) {
+			m_heap->memory->deallocate(m_heap, blockSize(m_size), alignof(Block));
+		}
+		m_size = 0;
+	}
+
+	size_t size() const { return m_size; }
+	bool empty() const { return m_size == 0; }
+	const SymbolId *begin() const { return const_cast<TagSet*>(this)->data(); }
+	const SymbolId *end() const { return begin() + m_size; }
+	SymbolId operator[](size_t i) const { return begin()[i]; }
+
+	bool operator==(const TagSet &other) const { return std::equal(begin(), end(), other.begin(), other.end()); }
+	bool operator!=(const TagSet &other) const { return !(*this == other); }
+
+private:
+	struct Block
+	{
+		std::pmr::memory_resource *memory;
+		// SymbolId ids[] follow
+	};
+
+	static size_t blockSize(size_t n) { return sizeof(Block) + n * sizeof(SymbolId); }
+
+	SymbolId *data() { return m_size > InlineCapacity ? reinterpret_cast<SymbolId*>(m_heap + 1) : m_inline; }
+
+	void copy(const TagSet &other)
+	{
+		std::copy(other.begin(), other.end(), resize(other.size(), std::pmr::get_default_resource()));
+	}
+	void steal(TagSet &other)
+	{
+		m_size = other.m_size;
+		if (m_size > InlineCapacity) {
+			m_heap = other.m_heap;
+		} else {
+			std::copy(other.m_inline, other.m_inline + m_size, m_inline);
+		}
+		other.m_size = 0;
+	}
+
+private:
+	uint32_t m_size = 0;
+	union
+	{
+		SymbolId m_inline[InlineCapacity];
+		Block *m_heap;
+	};
+};
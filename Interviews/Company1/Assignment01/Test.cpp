@@ -1,7 +1,23 @@
 #include "Test.h"
+#include "ConcurrentStoryboard.h"
+#include "DurableStoryboard.h"
+#include "MappedStoryboard.h"
+#include "PostingAlgebra.h"
+#include "ShardedStoryboard.h"
 #include "Storyboard.h"
+#include "WriteAheadLog.h"
 
+#include <atomic>
 #include <cassert>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <memory_resource>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+#include <sys/resource.h>
 
 namespace {
 
@@ -28,20 +44,20 @@ void testAddNote()
 
 	sb.addNote(note1);
 	assert(sb.notes().size() == 1);
-	auto notes = sb.searchByTag("t1");
+	auto notes = sb.searchByTag("t1").toNoteSet();
 	assert(notes.size() == 1);
 	assert(notes.find(note1) != notes.end());
 
 	sb.addNote(note2);
 	assert(sb.notes().size() == 2);
-	notes = sb.searchByTag("t1");
+	notes = sb.searchByTag("t1").toNoteSet();
 	assert(notes.size() == 2);
 	assert(notes.find(note1) != notes.end());
 	assert(notes.find(note2) != notes.end());
 
 	sb.addNote(note3);
 	assert(sb.notes().size() == 3);
-	notes = sb.searchByTag("t1");
+	notes = sb.searchByTag("t1").toNoteSet();
 	assert(notes.size() == 3);
 	assert(notes.find(note1) != notes.end());
 	assert(notes.find(note2) != notes.end());
@@ -63,7 +79,7 @@ void testDeleteNote()
 
 	sb.deleteNote(note2);
 	assert(sb.notes().size() == 2);
-	auto notes = sb.searchByTag("t1");
+	auto notes = sb.searchByTag("t1").toNoteSet();
 	assert(notes.size() == 2);
 	assert(notes.find(note2) == notes.end());
 	assert(notes.find(note1) != notes.end());
@@ -72,7 +88,7 @@ void testDeleteNote()
 
 	sb.deleteNote(note1);
 	assert(sb.notes().size() == 1);
-	notes = sb.searchByTag("t1");
+	notes = sb.searchByTag("t1").toNoteSet();
 	assert(notes.size() == 1);
 	assert(notes.find(note2) == notes.end());
 	assert(notes.find(note1) == notes.end());
@@ -80,7 +96,7 @@ void testDeleteNote()
 
 	sb.deleteNote(note3);
 	assert(sb.notes().size() == 0);
-	notes = sb.searchByTag("t1");
+	notes = sb.searchByTag("t1").toNoteSet();
 	assert(notes.size() == 0);
 	assert(notes.find(note2) == notes.end());
 	assert(notes.find(note1) == notes.end());
@@ -100,7 +116,7 @@ void testSearchByTitle()
 	sb.addNote(note3);
 	assert(sb.notes().size() == 3);
 
-	auto notes = sb.searchByTitle(note2.title);
+	auto notes = sb.searchByTitle(note2.title).toNoteSet();
 	assert(notes.size() == 1);
 	assert(notes.find(note2) != notes.end());
 
@@ -109,7 +125,7 @@ void testSearchByTitle()
 	sb.addNote(note4);
 	assert(sb.notes().size() == 4);
 
-	notes = sb.searchByTitle(note2.title);
+	notes = sb.searchByTitle(note2.title).toNoteSet();
 	assert(notes.size() == 2);
 	assert(notes.find(note2) != notes.end());
 	assert(notes.find(note4) != notes.end());
@@ -128,7 +144,7 @@ void testSearchByText()
 	sb.addNote(note3);
 	assert(sb.notes().size() == 3);
 
-	auto notes = sb.searchByText(note3.text);
+	auto notes = sb.searchByText(note3.text).toNoteSet();
 	assert(notes.size() == 1);
 	assert(notes.find(note3) != notes.end());
 
@@ -137,7 +153,7 @@ void testSearchByText()
 	sb.addNote(note4);
 	assert(sb.notes().size() == 4);
 
-	notes = sb.searchByText(note3.text);
+	notes = sb.searchByText(note3.text).toNoteSet();
 	assert(notes.size() == 2);
 	assert(notes.find(note3) != notes.end());
 	assert(notes.find(note4) != notes.end());
@@ -156,7 +172,7 @@ void testSearchByTag()
 	sb.addNote(note3);
 	assert(sb.notes().size() == 3);
 
-	auto notes = sb.searchByTag("t2");
+	auto notes = sb.searchByTag("t2").toNoteSet();
 	assert(notes.size() == 1);
 	assert(notes.find(note2) != notes.end());
 
@@ -166,25 +182,1250 @@ void testSearchByTag()
 	sb.addNote(note4);
 	assert(sb.notes().size() == 4);
 
-	notes = sb.searchByTag("t2");
+	notes = sb.searchByTag("t2").toNoteSet();
 	assert(notes.size() == 2);
 	assert(notes.find(note2) != notes.end());
 	assert(notes.find(note4) != notes.end());
 
 	////////////////////////////
 	// test overloaded versions
-	notes = sb.searchByTag("t3", "t1");
+	notes = sb.searchByTag("t3", "t1").toNoteSet();
 	assert(notes.size() == 2);
 	assert(notes.find(note1) != notes.end());
 	assert(notes.find(note3) != notes.end());
 
-	notes = sb.searchByTag({"t1", "t3", "t4"});
+	notes = sb.searchByTag({"t1", "t3", "t4"}).toNoteSet();
 	assert(notes.size() == 3);
 	assert(notes.find(note1) != notes.end());
 	assert(notes.find(note3) != notes.end());
 	assert(notes.find(note4) != notes.end());
 }
 
+void testNoteIds()
+{
+	Storyboard sb;
+
+	Note note1 = {"Note 1", "desc", {"t1", "t2"}};
+	Note note2 = {"Note 2", "desc", {"t2"}};
+
+	auto id1 = sb.addNote(note1);
+	auto id2 = sb.addNote(note2);
+	assert(id1 != id2);
+	assert(sb.addNote(note1) == id1); // duplicate
+	assert(sb.findNote(note2) == id2);
+	assert(sb.note(id1) == note1);
+	assert(sb.findNote({"Note 1", "desc", {"t1"}}) == Storyboard::InvalidNoteId);
+
+	sb.deleteNote(note1);
+	assert(!sb.contains(id1));
+	assert(sb.contains(id2));
+	assert(sb.size() == 1);
+	assert(sb.searchByTag("t1").empty());
+
+	// ids are not reused
+	auto id3 = sb.addNote(note1);
+	assert(id3 != id1 && id3 != id2);
+	assert(sb.note(id3) == note1);
+}
+
+void testSearchResult()
+{
+	Storyboard sb;
+
+	Note note1 = {"Note 1", "desc 1", {"t1", "t2"}};
+	Note note2 = {"Note 2", "desc 2", {"t2"}};
+	auto id1 = sb.addNote(note1);
+	auto id2 = sb.addNote(note2);
+
+	auto res = sb.searchByTag("t2");
+	assert(res.size() == 2);
+	assert(res.contains(id1) && res.contains(id2));
+	assert(res.contains(note2));
+
+	// results refer to the board data, no copies
+	auto it = res.begin();
+	assert(it.id() == id1);
+	assert((*it).title().data() == (*sb.searchByTitle("Note 1").begin()).title().data());
+	assert((*it).toNote() == note1);
+	assert((*it).tagCount() == 2);
+	++it;
+	assert((*it).text() == note2.text);
+	assert(++it == res.end());
+
+	assert(sb.searchByTitle("none").empty());
+	assert(sb.searchByTag(std::set<std::string>{"t1", "none"}).size() == 1);
+
+	auto owning = sb.searchByTag("t1", "t2").toNoteSet();
+	assert(owning.size() == 2);
+	assert(owning.count(note1) == 1 && owning.count(note2) == 1);
+}
+
+void testIndexBackends()
+{
+	Storyboard::Options ordered;
+	ordered.titleIndex = ordered.textIndex = ordered.tagIndex = IndexKind::Ordered;
+	Storyboard::Options hashed;
+	hashed.titleIndex = hashed.textIndex = hashed.tagIndex = IndexKind::Hash;
+	Storyboard sb1(ordered), sb2(hashed);
+
+	// enough keys to force rehashing and cluster shifts on erase
+	for (int i = 0; i < 2000; i++) {
+		Note n = {"Note " + std::to_string(i % 300), "desc " + std::to_string(i), {"t" + std::to_string(i % 97)}};
+		assert(sb1.addNote(n) == sb2.addNote(n));
+		if (i % 3 == 0) {
+			Note old = {"Note " + std::to_string(i / 2 % 300), "desc " + std::to_string(i / 2), {"t" + std::to_string(i / 2 % 97)}};
+			sb1.deleteNote(old);
+			sb2.deleteNote(old);
+		}
+	}
+	assert(sb1.size() == sb2.size());
+
+	for (int i = 0; i < 300; i++) {
+		auto title = "Note " + std::to_string(i);
+		assert(sb1.searchByTitle(title).ids() == sb2.searchByTitle(title).ids());
+	}
+	for (int i = 0; i < 97; i++) {
+		auto tag = "t" + std::to_string(i);
+		assert(sb1.searchByTag(tag).ids() == sb2.searchByTag(tag).ids());
+	}
+	for (int i = 0; i < 2000; i++) {
+		auto text = "desc " + std::to_string(i);
+		assert(sb1.searchByText(text).ids() == sb2.searchByText(text).ids());
+	}
+}
+
+void testDeleteNoteById()
+{
+	Storyboard sb;
+
+	std::vector<NoteId> ids;
+	for (int i = 0; i < 100; i++) {
+		ids.push_back(sb.addNote({"Note " + std::to_string(i), "desc", {"hot", "t" + std::to_string(i % 2)}}));
+	}
+	assert(sb.searchByTag("hot").size() == 100);
+
+	// delete every note except multiples of 10 -> posting lists get compacted on the way
+	for (int i = 0; i < 100; i++) {
+		if (i % 10 != 0) {
+			sb.deleteNote(ids[i]);
+		}
+	}
+	sb.deleteNote(ids[1]); // already deleted
+	sb.deleteNote(Storyboard::InvalidNoteId);
+	assert(sb.size() == 10);
+
+	auto hot = sb.searchByTag("hot");
+	assert(hot.size() == 10);
+	size_t n = 0;
+	for (auto const &note : hot) {
+		assert(note.id() % 10 == 0);
+		n++;
+	}
+	assert(n == 10);
+	assert(!hot.contains(ids[5]));
+	assert(sb.searchByTag("t1").empty());
+	assert(sb.searchByTag("t0").size() == 10);
+	assert(sb.searchByText("desc").ids() == hot.ids());
+	assert(sb.searchByTitle("Note 5").empty());
+}
+
+/** Counts bytes allocated through it */
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+	size_t allocated = 0;
+	size_t live = 0;
+
+private:
+	void *do_allocate(size_t bytes, size_t alignment) override
+	{
+		allocated += bytes;
+		live += bytes;
+		return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+	}
+	void do_deallocate(void *p, size_t bytes, size_t alignment) override
+	{
+		live -= bytes;
+		std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+	}
+	bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+};
+
+void testArenas()
+{
+	auto fill = [](Storyboard &sb) {
+		for (int i = 0; i < 1000; i++) {
+			sb.addNote({"Note " + std::to_string(i % 100), "Some long enough text to be allocated " + std::to_string(i),
+				{"t" + std::to_string(i % 7), "t" + std::to_string(i % 11)}});
+		}
+		for (int i = 0; i < 1000; i += 3) {
+			sb.deleteNote({"Note " + std::to_string(i % 100), "Some long enough text to be allocated " + std::to_string(i),
+				{"t" + std::to_string(i % 7), "t" + std::to_string(i % 11)}});
+		}
+	};
+	Storyboard reference;
+	fill(reference);
+
+	for (auto arena : {ArenaKind::Monotonic, ArenaKind::Pool}) {
+		for (auto index : {IndexKind::Hash, IndexKind::Ordered}) {
+			Storyboard::Options options;
+			options.arena = arena;
+			options.titleIndex = options.textIndex = options.tagIndex = index;
+			Storyboard sb(options);
+			fill(sb);
+			assert(sb.notes() == reference.notes());
+			assert(sb.searchByTag("t3").toNoteSet() == reference.searchByTag("t3").toNoteSet());
+
+			// Copies use the default resource and do not depend on the original board
+			std::unique_ptr<Storyboard> copy;
+			{
+				Storyboard tmp(options);
+				fill(tmp);
+				copy.reset(new Storyboard(tmp));
+				Storyboard assigned;
+				assigned = tmp;
+				assert(assigned.notes() == reference.notes());
+			}
+			assert(copy->notes() == reference.notes());
+			copy->addNote({"New", "note", {"t3"}});
+			assert(copy->searchByTag("t3").size() == reference.searchByTag("t3").size() + 1);
+		}
+	}
+
+	// Everything but the word index goes through a custom resource
+	CountingResource counting;
+	{
+		Storyboard::Options options;
+		options.memory = &counting;
+		Storyboard sb(options);
+		fill(sb);
+		sb.addNotes(std::vector<Note>{{"Bulk", "loaded", {"t1"}}}, 4);
+		assert(counting.allocated > 0);
+		assert(sb.searchByTag("t1").size() == reference.searchByTag("t1").size() + 1);
+	}
+	assert(counting.live == 0);
+}
+
+void testCompactIds()
+{
+	Storyboard::Options options;
+	options.textTokenIndex = true;
+	Storyboard sb(options);
+	for (int i = 0; i < 100; i++) {
+		sb.addNote({"Note " + std::to_string(i), "word " + std::to_string(i % 3), {"hot", "t" + std::to_string(i % 2)}});
+	}
+	for (NoteId id = 1; id < 100; id += 2) {
+		sb.deleteNote(id);
+	}
+	assert(sb.needsIdCompaction() == false); // exactly a half
+	sb.deleteNote(0);
+	assert(sb.needsIdCompaction());
+
+	// live notes keep their order: old id 2k becomes k - 1
+	assert(sb.compactIds() == 51);
+	assert(sb.compactIds() == 0);
+	assert(sb.size() == 49);
+	for (NoteId id = 0; id < 49; id++) {
+		assert(sb.note(id).title == "Note " + std::to_string(2 * id + 2));
+		assert(sb.findNote(sb.note(id)) == id);
+	}
+	assert(!sb.contains(49));
+	auto hot = sb.searchByTag("hot").ids();
+	assert(hot.size() == 49 && hot.front() == 0 && hot.back() == 48 && std::is_sorted(hot.begin(), hot.end()));
+	assert(sb.searchByTag("t1").empty());
+	assert(sb.searchByTitle("Note 4").ids() == std::vector<NoteId>{1});
+	assert(sb.searchByWords("word 1").size() == 16); // Note: ids 4, 10, .., 94
+	assert(sb.addNote(sb.note(5)) == 5);
+	assert(sb.addNote({"New", "word 1", {"hot"}}) == 49);
+	assert(sb.searchByTag("hot").ids().back() == 49);
+	sb.deleteNote(7);
+	assert(sb.searchByTitle("Note 16").empty());
+
+	// Churn: memory of a board with a steady number of notes stays bounded
+	CountingResource memory;
+	options.memory = &memory;
+	Storyboard churn(options);
+	const int live = 100;
+	size_t warm = 0;
+	for (int round = 0; round < 50; round++) {
+		std::vector<Note> notes;
+		for (int i = 0; i < live; i++) {
+			auto n = std::to_string(round * live + i);
+			notes.push_back({"Title " + n, "text " + n, {"tag " + n, "common"}});
+			churn.addNote(notes.back());
+		}
+		for (auto const &note : notes) {
+			churn.deleteNote(note); // Note: by content, compactIds() renumbers the remaining notes
+			if (churn.needsIdCompaction()) {
+				churn.compactIds();
+			}
+		}
+		assert(churn.size() == 0);
+		if (round == 4) {
+			warm = memory.live;
+		}
+	}
+	assert(churn.stats().find("storyboard_note_slots 0\n") != std::string::npos);
+	assert(memory.live <= warm);
+}
+
+void testTagSets()
+{
+	// Inline and heap allocated tag sets
+	Storyboard sb;
+	std::vector<Note> notes;
+	for (size_t n : {size_t(0), size_t(1), TagSet::InlineCapacity, TagSet::InlineCapacity + 1, size_t(20)}) {
+		Note note = {"Tags " + std::to_string(n), "text", {}};
+		for (size_t i = 0; i < n; i++) {
+			note.tags.insert("tag " + std::to_string(i));
+		}
+		notes.push_back(note);
+		sb.addNote(note);
+	}
+	assert(sb.size() == notes.size());
+	for (auto const &n : notes) {
+		auto id = sb.findNote(n);
+		assert(id != Storyboard::InvalidNoteId);
+		assert(sb.note(id) == n);
+		// One tag less or more is another note
+		if (!n.tags.empty()) {
+			Note fewer = n;
+			fewer.tags.erase(fewer.tags.begin());
+			assert(sb.findNote(fewer) == Storyboard::InvalidNoteId);
+		}
+		Note more = n;
+		more.tags.insert("tag 0");
+		more.tags.insert("tag 19");
+		assert(more == n || sb.findNote(more) == Storyboard::InvalidNoteId);
+	}
+	assert(sb.searchByTag("tag 19").size() == 1);
+	assert(sb.searchByTag("tag 0").size() == 4);
+
+	Storyboard copy(sb);
+	sb.deleteNote(notes[4]);
+	assert(sb.searchByTag("tag 19").empty());
+	assert(copy.searchByTag("tag 19").size() == 1);
+	assert(copy.notes().size() == notes.size());
+
+	TagSet a;
+	auto p = a.resize(10, std::pmr::get_default_resource());
+	for (SymbolId i = 0; i < 10; i++) {
+		p[i] = 10 - i;
+	}
+	a.sort();
+	assert(a.size() == 10 && a[0] == 1 && a[9] == 10);
+	TagSet b(a), c;
+	assert(b == a);
+	c = std::move(b);
+	assert(c == a && b.empty());
+	c.resize(1, std::pmr::get_default_resource())[0] = 1;
+	assert(c != a && c.size() == 1);
+}
+
+void testFingerprints()
+{
+	Note a = {"title", "text", {"t1", "t2"}};
+	assert(a.fingerprint() == Note(a).fingerprint());
+	assert(a.fingerprint() != Note({"text", "title", {"t1", "t2"}}).fingerprint());
+	assert(a.fingerprint() != Note({"title", "text", {"t1"}}).fingerprint());
+	assert(a.fingerprint() != Note({"title", "text", {"t1", "t2", ""}}).fingerprint());
+	assert(Fingerprint::of("") != Fingerprint::of("", 1));
+	assert(Fingerprint::of("0123456789abcdefX") != Fingerprint::of("0123456789abcdefY"));
+
+	// Board fingerprints survive symbol recycling (tags get other symbol ids and order)
+	Storyboard sb;
+	sb.addNote({"x", "y", {"b"}});
+	sb.addNote({"x", "z", {"a"}});
+	sb.deleteNote({"x", "y", {"b"}});
+	auto id = sb.addNote({"x", "y", {"c", "b", "a"}});
+	assert(sb.addNote({"x", "y", {"a", "b", "c"}}) == id);
+	assert(sb.size() == 2);
+	sb.deleteNote(id);
+	assert(sb.findNote({"x", "y", {"a", "b", "c"}}) == Storyboard::InvalidNoteId);
+	assert(sb.findNote({"x", "z", {"a"}}) != Storyboard::InvalidNoteId);
+
+	// Colliding fingerprints are told apart by the match callback
+	FingerprintIndex index;
+	Fingerprint fp{1, 2};
+	for (NoteId i = 0; i < 100; i++) {
+		index.insert(fp, i);
+		index.insert({i, i}, 1000 + i);
+	}
+	assert(index.size() == 200);
+	assert(index.find(fp, [](NoteId id) { return id == 42; }, Storyboard::InvalidNoteId) == 42);
+	index.erase(fp, 42);
+	assert(index.find(fp, [](NoteId id) { return id == 42; }, Storyboard::InvalidNoteId) == Storyboard::InvalidNoteId);
+	assert(index.find(fp, [](NoteId id) { return id == 43; }, Storyboard::InvalidNoteId) == 43);
+	for (NoteId i = 0; i < 100; i++) {
+		auto found = index.find({i, i}, [](NoteId) { return true; }, Storyboard::InvalidNoteId);
+		assert(found == 1000 + i);
+	}
+}
+
+void testPostingAlgebra()
+{
+	using namespace PostingAlgebra;
+
+	std::mt19937 rng(1);
+	auto randomList = [&rng](size_t n, NoteId universe) {
+		std::vector<NoteId> v;
+		std::uniform_int_distribution<NoteId> dist(0, universe);
+		for (size_t i = 0; i < n; i++) {
+			v.push_back(dist(rng));
+		}
+		std::sort(v.begin(), v.end());
+		v.erase(std::unique(v.begin(), v.end()), v.end());
+		return v;
+	};
+
+	const Kernel kernels[] = {Kernel::Auto, Kernel::Scalar, Kernel::Sse, Kernel::Avx2};
+	const size_t sizes[][2] = {{0, 10}, {3, 5}, {17, 33}, {100, 100}, {1000, 997}, {10, 5000}, {5000, 7}};
+	for (auto const &sz : sizes) {
+		for (int round = 0; round < 5; round++) {
+			auto a = randomList(sz[0], 3 * (sz[0] + sz[1]));
+			auto b = randomList(sz[1], 3 * (sz[0] + sz[1]));
+			std::vector<NoteId> expAnd, expOr, expNot;
+			std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expAnd));
+			std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expOr));
+			std::set_difference(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expNot));
+
+			for (auto k : kernels) {
+				std::vector<NoteId> out;
+				intersect(a, b, out, k);
+				assert(out == expAnd);
+				out.clear();
+				unite(a, b, out, k);
+				assert(out == expOr);
+				out.clear();
+				subtract(a, b, out, k);
+				assert(out == expNot);
+			}
+		}
+	}
+}
+
+void testSearchByTags()
+{
+	Storyboard sb;
+
+	Note note1 = {"Note 1", "desc", {"a", "b"}};
+	Note note2 = {"Note 2", "desc", {"a", "b", "c"}};
+	Note note3 = {"Note 3", "desc", {"a", "c"}};
+	Note note4 = {"Note 4", "desc", {"d"}};
+	auto id1 = sb.addNote(note1);
+	auto id2 = sb.addNote(note2);
+	auto id3 = sb.addNote(note3);
+	auto id4 = sb.addNote(note4);
+
+	Storyboard::TagQuery q;
+	q.allOf = {"a", "b"};
+	assert(sb.searchByTags(q).ids() == std::vector<NoteId>({id1, id2}));
+
+	q.noneOf = {"c"};
+	assert(sb.searchByTags(q).ids() == std::vector<NoteId>({id1}));
+
+	q = Storyboard::TagQuery();
+	q.anyOf = {"b", "d"};
+	assert(sb.searchByTags(q).ids() == std::vector<NoteId>({id1, id2, id4}));
+
+	q.allOf = {"c"};
+	assert(sb.searchByTags(q).ids() == std::vector<NoteId>({id2}));
+
+	q = Storyboard::TagQuery();
+	q.allOf = {"a", "unknown"};
+	assert(sb.searchByTags(q).empty());
+
+	q = Storyboard::TagQuery();
+	q.noneOf = {"a"};
+	assert(sb.searchByTags(q).empty()); // no positive term
+
+	sb.deleteNote(id2);
+	q = Storyboard::TagQuery();
+	q.allOf = {"a"};
+	q.anyOf = {"b", "c"};
+	assert(sb.searchByTags(q).ids() == std::vector<NoteId>({id1, id3}));
+}
+
+void testSearchByWords()
+{
+	Storyboard::Options options;
+	options.textTokenIndex = true;
+	Storyboard sb(options);
+
+	auto id1 = sb.addNote({"Note 1", "Implement a unit test for the class Traceplayer.", {"t"}});
+	auto id2 = sb.addNote({"Note 2", "Unit test of the spark core; test it well", {"t"}});
+	auto id3 = sb.addNote({"Note 3", "Test the unit, then the class.", {"t"}});
+
+	assert(sb.searchByWords("traceplayer").ids() == std::vector<NoteId>({id1}));
+	assert(sb.searchByWords("UNIT Test").ids() == std::vector<NoteId>({id1, id2, id3}));
+	assert(sb.searchByWords("class test").ids() == std::vector<NoteId>({id1, id3}));
+	assert(sb.searchByWords("missing test").empty());
+
+	assert(sb.searchByPhrase("unit test").ids() == std::vector<NoteId>({id1, id2}));
+	assert(sb.searchByPhrase("test the unit").ids() == std::vector<NoteId>({id3}));
+	assert(sb.searchByPhrase("the class").ids() == std::vector<NoteId>({id1, id3}));
+	assert(sb.searchByPhrase("class the").empty());
+
+	sb.deleteNote(id1);
+	assert(sb.searchByWords("traceplayer").empty());
+	assert(sb.searchByPhrase("unit test").ids() == std::vector<NoteId>({id2}));
+	sb.deleteNote(id2);
+	auto id4 = sb.addNote({"Note 4", "unit test again", {"t"}});
+	assert(sb.searchByPhrase("unit test").ids() == std::vector<NoteId>({id4}));
+
+	Storyboard plain;
+	try {
+		plain.searchByWords("test");
+		assert(false); // should not be called if an exception is thrown
+	}
+	catch (const std::logic_error &e) {
+		// this is expected
+	}
+}
+
+void testPagedSearch()
+{
+	Storyboard sb;
+	std::vector<NoteId> ids;
+	for (int i = 0; i < 10; i++) {
+		ids.push_back(sb.addNote({"Note " + std::to_string(i), "desc", {"t", "t" + std::to_string(i % 2)}}));
+	}
+
+	Storyboard::Cursor cursor;
+	auto page = sb.searchByTag("t", 4, cursor);
+	assert(page.ids() == std::vector<NoteId>(ids.begin(), ids.begin() + 4));
+	assert(!cursor.done);
+
+	// modifications between pages: deleted notes are skipped, new ones come last
+	sb.deleteNote(ids[4]);
+	sb.deleteNote(ids[1]);
+	auto id = sb.addNote({"Note 10", "desc", {"t"}});
+	page = sb.searchByTag("t", 4, cursor);
+	assert(page.ids() == std::vector<NoteId>({ids[5], ids[6], ids[7], ids[8]}));
+	page = sb.searchByTag("t", 4, cursor);
+	assert(page.ids() == std::vector<NoteId>({ids[9], id}));
+	assert(cursor.done);
+	assert(sb.searchByTag("t", 4, cursor).empty());
+
+	// exact end of the results
+	Storyboard::Cursor odd;
+	assert(sb.searchByTag("t1", 4, odd).size() == 4); // 3, 5, 7, 9
+	assert(odd.done);
+	assert(sb.searchByTag("t1", 3, odd).empty());
+
+	Storyboard::Cursor title;
+	assert(sb.searchByTitle("Note 3", 10, title).ids() == std::vector<NoteId>({ids[3]}));
+	assert(title.done);
+	Storyboard::Cursor none;
+	assert(sb.searchByText("missing", 10, none).empty());
+	assert(none.done);
+
+	size_t pages = 0, found = 0;
+	for (Storyboard::Cursor c; !c.done; pages++) {
+		found += sb.searchByText("desc", 3, c).size();
+	}
+	assert(pages == 3 && found == sb.size());
+}
+
+void testChangeFeed()
+{
+	Storyboard sb;
+	sb.addNote({"Before", "x", {"t1"}});
+	auto all = sb.subscribe();
+	auto tagged = sb.subscribe({"t2"});
+	auto start = sb.sequence();
+
+	auto id1 = sb.addNote({"Note 1", "x", {"t1"}});
+	auto id2 = sb.addNote({"Note 2", "x", {"t1", "t2"}});
+	sb.addNote({"Note 2", "x", {"t1", "t2"}}); // duplicate, no change
+	sb.deleteNote(id2);
+	sb.addNotes(std::vector<Note>{{"Note 3", "x", {"t2"}}});
+	assert(sb.sequence() == start + 4);
+
+	ChangeEvent e;
+	std::vector<std::pair<ChangeEvent::Kind, NoteId>> events;
+	uint64_t sequence = start;
+	while (all.poll(e)) {
+		assert(e.sequence == ++sequence);
+		events.push_back({e.kind, e.id});
+	}
+	assert(events.size() == 4);
+	assert(events[0] == std::make_pair(ChangeEvent::Added, id1));
+	assert(events[2] == std::make_pair(ChangeEvent::Removed, id2));
+	assert(e.note->title == "Note 3");
+
+	assert(tagged.poll(e) && e.id == id2 && e.kind == ChangeEvent::Added);
+	assert(tagged.poll(e) && e.id == id2 && e.kind == ChangeEvent::Removed && e.note->title == "Note 2");
+	assert(tagged.poll(e) && e.note->title == "Note 3");
+	assert(!tagged.poll(e) && !tagged.overflowed());
+
+	// a slow subscriber overflows, the writer does not wait for it
+	auto slow = sb.subscribe({}, 2);
+	for (int i = 0; i < 5; i++) {
+		sb.addNote({"Slow " + std::to_string(i), "x", {}});
+	}
+	int received = 0;
+	while (slow.poll(e)) {
+		received++;
+	}
+	assert(received == 2 && slow.overflowed());
+
+	// copies have no subscribers, the board going away ends the stream
+	while (all.poll(e)) {
+	}
+	Storyboard copy = sb;
+	copy.addNote({"Copy", "x", {}});
+	assert(copy.sequence() == sb.sequence() + 1);
+	assert(!all.poll(e) && !all.overflowed());
+	auto board = std::make_unique<Storyboard>();
+	auto orphan = board->subscribe();
+	board.reset();
+	assert(!orphan.poll(e) && orphan.overflowed());
+
+	// concurrent consumer
+	const int noteCount = 20000;
+	Storyboard live;
+	auto sub = live.subscribe({"even"}, 256);
+	std::thread consumer([&sub]() {
+		ChangeEvent e;
+		uint64_t last = 0;
+		int count = 0;
+		while (count < noteCount / 2 && !sub.overflowed()) {
+			if (sub.poll(e)) {
+				assert(e.sequence > last && e.note->tags.count("even"));
+				last = e.sequence;
+				count++;
+			} else {
+				std::this_thread::yield();
+			}
+		}
+		while (sub.poll(e)) {
+			count++;
+		}
+		assert(count == noteCount / 2 || sub.overflowed());
+	});
+	for (int i = 0; i < noteCount; i++) {
+		live.addNote({"Note " + std::to_string(i), "x", {i % 2 ? "odd" : "even"}});
+	}
+	consumer.join();
+}
+
+void testResultCache()
+{
+	Storyboard::Options options;
+	options.resultCache = 2;
+	Storyboard sb(options);
+	sb.addNote({"Note 1", "desc", {"t1", "t2"}});
+	sb.addNote({"Note 2", "desc", {"t2"}});
+
+	auto t2 = sb.notesByTag("t2");
+	assert(*t2 == sb.searchByTag("t2").toNoteSet());
+	assert(sb.notesByTag("t2") == t2); // the very same set
+	sb.notesByTitle("Note 1");
+	auto stats = sb.cacheStats();
+	assert(stats.hits == 1 && stats.misses == 2 && stats.size == 2);
+
+	// only the keys of the modified note are dropped
+	sb.addNote({"Note 3", "other", {"t3"}});
+	assert(sb.notesByTag("t2") == t2);
+	auto id = sb.addNote({"Note 4", "desc", {"t2"}});
+	assert(sb.cacheStats().invalidations == 1);
+	assert(sb.notesByTag("t2")->size() == 3);
+	sb.deleteNote(id);
+	assert(sb.notesByTag("t2")->size() == 2);
+	assert(sb.notesByText("desc")->size() == 2);
+
+	// LRU eviction: "Note 1" title is the oldest entry
+	stats = sb.cacheStats();
+	assert(stats.size == 2 && stats.evictions == 1);
+	assert(sb.notesByTag("missing")->empty());
+
+	Storyboard copy = sb;
+	assert(copy.cacheStats().size == 0);
+	assert(*copy.notesByTag("t2") == *sb.notesByTag("t2"));
+
+	Storyboard plain;
+	plain.addNote({"Note 1", "desc", {"t1"}});
+	assert(plain.notesByTag("t1")->size() == 1);
+	assert(plain.cacheStats().misses == 0); // disabled
+}
+
+void testMetrics()
+{
+	// buckets keep the relative error within 1 / 2^SubBits
+	for (uint64_t v : {0ull, 7ull, 8ull, 100ull, 12345ull, 1ull << 40, ~0ull}) {
+		auto b = Histogram::bucketOf(v);
+		assert(Histogram::lowerBound(b) <= v);
+		assert(b + 1 == Histogram::BucketCount || Histogram::lowerBound(b + 1) > v);
+		assert(v - Histogram::lowerBound(b) <= v / 8);
+	}
+	Histogram h;
+	for (uint64_t v = 1; v <= 1000; v++) {
+		h.record(v);
+	}
+	assert(h.count() == 1000 && h.sum() == 500500 && h.max() == 1000);
+	assert(h.quantile(0.5) >= 500 && h.quantile(0.5) <= 500 * 9 / 8);
+	assert(h.quantile(1) == 1000);
+
+	Storyboard sb;
+	sb.addNote({"Note 1", "desc", {"hot", "t1"}});
+	sb.addNote({"Note 2", "desc", {"hot"}});
+	sb.addNote({"Note 2", "desc", {"hot"}});
+	sb.searchByTag("hot");
+
+	auto text = sb.stats();
+	assert(text.find("# TYPE storyboard_notes gauge\nstoryboard_notes 2\n") != std::string::npos);
+	assert(text.find("storyboard_index_keys{index=\"tag\"} 2\n") != std::string::npos);
+	assert(text.find("storyboard_hot_key_notes{index=\"tag\",key=\"hot\"} 2\n") != std::string::npos);
+	assert(text.find("storyboard_posting_list_length{index=\"tag\",quantile=\"0.99\"} 2\n") != std::string::npos);
+	auto json = sb.stats(Storyboard::StatsFormat::Json);
+	assert(json.find("{\"name\": \"storyboard_notes\", \"type\": \"gauge\", \"labels\": {}, \"value\": 2}") != std::string::npos);
+#ifdef STORYBOARD_METRICS
+	assert(text.find("storyboard_op_latency_ns_count{op=\"addNote\"} 3\n") != std::string::npos);
+	assert(text.find("storyboard_op_latency_ns_count{op=\"searchByTag\"} 1\n") != std::string::npos);
+	assert(text.find("storyboard_duplicate_notes_total 1\n") != std::string::npos);
+
+	// readers on other threads record into their own stripes, also more of them than cores
+	std::vector<std::thread> readers;
+	for (int t = 0; t < 16; t++) {
+		readers.emplace_back([&sb]() {
+			for (int i = 0; i < 1000; i++) {
+				sb.searchByTitle("Note 1");
+			}
+		});
+	}
+	for (auto &r : readers) {
+		r.join();
+	}
+	assert(sb.stats().find("storyboard_op_latency_ns_count{op=\"searchByTitle\"} 16000\n") != std::string::npos);
+	Storyboard copy = sb;
+	assert(copy.stats().find("storyboard_op_latency_ns_count{op=\"searchByTitle\"} 0\n") != std::string::npos);
+#endif
+
+	// the largest value wins also when threads record concurrently
+	Metrics metrics;
+	std::vector<std::thread> recorders;
+	for (int t = 0; t < 12; t++) {
+		recorders.emplace_back([&metrics, t]() {
+			for (uint64_t v = 0; v < 1000; v++) {
+				metrics.record(Metrics::AddNote, v * 12 + t);
+				metrics.add(Metrics::Compactions);
+			}
+		});
+	}
+	for (auto &r : recorders) {
+		r.join();
+	}
+	assert(metrics.histogram(Metrics::AddNote).count() == 12000);
+	assert(metrics.histogram(Metrics::AddNote).max() == 11999);
+	assert(metrics.counter(Metrics::Compactions) == 12000);
+
+	// large and fractional values are printed in full
+	MetricsReport report;
+	report.add("big_total", "counter", {}, 1234567.0);
+	report.add("ns_sum", "counter", {}, 123456789012345.0);
+	report.add("ratio", "gauge", {}, 0.1);
+	auto exposition = report.prometheus();
+	assert(exposition.find("big_total 1234567\n") != std::string::npos);
+	assert(exposition.find("ns_sum 123456789012345\n") != std::string::npos);
+	assert(std::stod(exposition.substr(exposition.find("\nratio ") + 7)) == 0.1);
+	assert(report.json().find("\"value\": 1234567}") != std::string::npos);
+
+	Storyboard tricky;
+	tricky.addNote({"a", "b", {"quote \" and \\ and\nline"}});
+	assert(tricky.stats().find("key=\"quote \\\" and \\\\ and\\nline\"") != std::string::npos);
+}
+
+void testKeyTries()
+{
+	Storyboard::Options options;
+	options.keyTries = true;
+	Storyboard sb(options);
+
+	sb.addNote({"Test Traceplayer", "a", {"unit test", "testing"}});
+	sb.addNote({"Test Trace", "b", {"testing"}});
+	sb.addNote({"Tests", "c", {"testing", "spark core"}});
+	auto id = sb.addNote({"Review", "d", {"unit test", "review"}});
+
+	typedef std::vector<KeyTrie::Entry> Entries;
+	assert(sb.titleKeys().withPrefix("Test").size() == 3);
+	assert(sb.titleKeys().withPrefix("Test T") == Entries({{"Test Trace", 1}, {"Test Traceplayer", 1}}));
+	assert(sb.titleKeys().withPrefix("Test", 1) == Entries({{"Test Trace", 1}}));
+	assert(sb.titleKeys().withPrefix("Tesx").empty());
+	assert(sb.tagKeys().range("spark", "unit test") == Entries({{"spark core", 1}, {"testing", 3}}));
+	assert(sb.tagKeys().top(2) == Entries({{"testing", 3}, {"unit test", 2}}));
+	assert(sb.tagKeys().top(5, "u") == Entries({{"unit test", 2}}));
+
+	sb.deleteNote(id);
+	assert(sb.tagKeys().count("unit test") == 1);
+	assert(sb.tagKeys().count("review") == 0);
+	assert(sb.titleKeys().withPrefix("R").empty());
+	assert(sb.titleKeys().size() == 3);
+
+	// against a sorted map, with splits and merges of the trie edges
+	KeyTrie trie;
+	std::map<std::string, size_t> expected;
+	std::mt19937 rng(7);
+	for (int i = 0; i < 20000; i++) {
+		std::string key(rng() % 6, 'a');
+		for (auto &c : key) {
+			c = static_cast<char>('a' + rng() % 3);
+		}
+		if (rng() % 3 == 0) {
+			if (expected.count(key) && --expected[key] == 0) {
+				expected.erase(key);
+			}
+			trie.erase(key);
+		} else {
+			expected[key]++;
+			trie.insert(key);
+		}
+	}
+	Entries all;
+	for (auto const &e : expected) {
+		all.push_back({e.first, e.second});
+	}
+	assert(trie.size() == expected.size());
+	assert(trie.withPrefix("") == all);
+	Entries ranged;
+	for (auto it = expected.lower_bound("ab"); it != expected.lower_bound("bca"); ++it) {
+		ranged.push_back({it->first, it->second});
+	}
+	assert(trie.range("ab", "bca") == ranged);
+	auto best = all;
+	std::stable_sort(best.begin(), best.end(), [](const KeyTrie::Entry &a, const KeyTrie::Entry &b) {
+		return a.count > b.count;
+	});
+	best.resize(10);
+	assert(trie.top(10) == best);
+
+	// UTF-8 keys sort by their bytes as std::string does
+	KeyTrie utf8;
+	for (auto key : {"b", "été", "a", "école", "z"}) {
+		utf8.insert(key);
+	}
+	assert(utf8.withPrefix("") == Entries({{"a", 1}, {"b", 1}, {"z", 1}, {"école", 1}, {"été", 1}}));
+	assert(utf8.withPrefix("", 2) == Entries({{"a", 1}, {"b", 1}}));
+	assert(utf8.range("a", "c") == Entries({{"a", 1}, {"b", 1}}));
+	assert(utf8.range("c", "éd") == Entries({{"z", 1}, {"école", 1}}));
+	assert(utf8.withPrefix("é") == Entries({{"école", 1}, {"été", 1}}));
+	assert(utf8.count("été") == 1);
+
+	// bulk load fills the tries as well
+	Storyboard bulk(options);
+	bulk.addNotes(std::vector<Note>{{"Test Trace", "b", {"testing"}}, {"Tests", "c", {"testing"}}}, 2);
+	assert(bulk.tagKeys().top(1) == Entries({{"testing", 2}}));
+
+	Storyboard plain;
+	try {
+		plain.titleKeys();
+		assert(false); // should not be called if an exception is thrown
+	}
+	catch (const std::logic_error &e) {
+		// this is expected
+	}
+}
+
+void testAddNotes()
+{
+	std::vector<Note> notes;
+	for (int i = 0; i < 50000; i++) {
+		notes.push_back({"Note " + std::to_string(i % 1000), "desc " + std::to_string(i % 20000),
+			{"t" + std::to_string(i % 7), "t" + std::to_string(i % 11)}});
+	}
+	notes.push_back(notes[0]); // duplicate
+
+	Storyboard::Options options;
+	options.textTokenIndex = true;
+	Storyboard single(options), bulk(options), parallel(options);
+	for (auto const &n : notes) {
+		single.addNote(n);
+	}
+	assert(bulk.addNotes(notes) == single.size());
+	assert(parallel.addNotes(notes.begin(), notes.end(), 4) == single.size());
+	assert(bulk.size() == single.size());
+	assert(bulk.addNotes(notes) == 0); // all already present
+
+	for (auto const &tag : {"t0", "t3", "t10"}) {
+		assert(bulk.searchByTag(tag).toNoteSet() == single.searchByTag(tag).toNoteSet());
+		assert(parallel.searchByTag(tag).toNoteSet() == single.searchByTag(tag).toNoteSet());
+	}
+	assert(bulk.searchByTitle("Note 7").toNoteSet() == single.searchByTitle("Note 7").toNoteSet());
+	assert(bulk.searchByText("desc 123").toNoteSet() == single.searchByText("desc 123").toNoteSet());
+	assert(parallel.searchByWords("123").toNoteSet() == single.searchByWords("123").toNoteSet());
+
+	// bulk load into a non-empty board and regular updates afterwards
+	Storyboard sb;
+	auto id = sb.addNote(notes[1]);
+	assert(sb.addNotes(std::vector<Note>(notes.begin(), notes.begin() + 10)) == 9);
+	assert(sb.findNote(notes[1]) == id);
+	sb.deleteNote(notes[2]);
+	assert(sb.size() == 9);
+	assert(sb.searchByText(notes[2].text).empty());
+}
+
+void testConcurrentStoryboard()
+{
+	ConcurrentStoryboard sb;
+	const int noteCount = 2000;
+	std::atomic<bool> done{false};
+
+	// Readers must always see a consistent board: every note tagged "even" has an even number
+	// in its title and the number of those notes never decreases.
+	auto reader = [&sb, &done]() {
+		size_t last = 0;
+		while (!done.load()) {
+			auto n = sb.read([](const Storyboard &board) {
+				auto res = board.searchByTag("even");
+				for (auto const &note : res) {
+					assert(std::stoi(std::string(note.title().substr(5))) % 2 == 0);
+				}
+				return res.size();
+			});
+			assert(n >= last);
+			last = n;
+		}
+	};
+	std::vector<std::thread> readers;
+	for (int i = 0; i < 3; i++) {
+		readers.emplace_back(reader);
+	}
+
+	for (int i = 0; i < noteCount; i++) {
+		sb.addNote({"Note " + std::to_string(i), "desc", {i % 2 ? "odd" : "even"}});
+		if (i % 2) {
+			sb.deleteNote({"Note " + std::to_string(i), "desc", {"odd"}});
+		}
+	}
+	done = true;
+	for (auto &t : readers) {
+		t.join();
+	}
+
+	assert(sb.size() == noteCount / 2);
+	assert(sb.searchByTag("even").size() == noteCount / 2);
+	assert(sb.searchByTag("odd").empty());
+	assert(sb.searchByTitle("Note 2").size() == 1);
+}
+
+/** Fails the @failAt-th allocation (counted from 1, 0 never fails) */
+class FailingResource : public std::pmr::memory_resource
+{
+public:
+	size_t failAt = 0;
+
+private:
+	void *do_allocate(size_t bytes, size_t alignment) override
+	{
+		if (failAt != 0 && --failAt == 0) {
+			throw std::bad_alloc();
+		}
+		return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+	}
+	void do_deallocate(void *p, size_t bytes, size_t alignment) override
+	{
+		std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+	}
+	bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+};
+
+void testConcurrentStoryboard_failedWrite()
+{
+	FailingResource memory;
+	Storyboard::Options options;
+	options.memory = &memory;
+	ConcurrentStoryboard sb(options);
+	const Note kept{"Kept", "text", {"tag"}};
+	sb.addNote(kept);
+
+	// Fail every allocation of a write in turn, the first or the second board may be hit
+	bool added = false;
+	for (size_t n = 1; !added; n++) {
+		const Note note{"Note " + std::to_string(n), "text " + std::to_string(n), {"tag", "t" + std::to_string(n)}};
+		memory.failAt = n;
+		try {
+			sb.addNote(note);
+			added = true;
+		} catch (const std::bad_alloc &) {
+		}
+		memory.failAt = 0;
+
+		// Both boards have to be equal: a write publishes the other one
+		auto size = sb.size();
+		auto tagged = sb.searchByTag("tag");
+		sb.addNote(kept); // no change, just swaps the boards
+		assert(sb.size() == size);
+		assert(sb.searchByTag("tag") == tagged);
+		assert(tagged.count(kept) == 1);
+		if (size == 2) {
+			assert(tagged.count(note) == 1);
+			sb.deleteNote(note);
+		}
+		assert(sb.size() == 1);
+	}
+}
+
+void testShardedStoryboard()
+{
+	ShardedStoryboard sb(4);
+	Storyboard reference;
+	std::vector<Note> notes;
+	for (int i = 0; i < 500; i++) {
+		notes.push_back({"Note " + std::to_string(i % 50), "desc " + std::to_string(i), {"t" + std::to_string(i % 7), "all"}});
+	}
+	notes.push_back(notes[0]); // duplicate
+
+	assert(sb.addNotes(notes) == 500);
+	reference.addNotes(notes);
+	assert(sb.size() == 500);
+	for (auto const &n : notes) {
+		assert(sb.contains(n));
+	}
+	// Notes got spread over the shards
+	std::set<size_t> used;
+	for (auto const &n : notes) {
+		used.insert(sb.shardOf(n));
+	}
+	assert(used.size() == sb.shardCount());
+
+	assert(sb.searchByTag("all").size() == 500);
+	assert(sb.searchByTag("t3") == reference.searchByTag("t3").toNoteSet());
+	assert(sb.searchByTitle("Note 7") == reference.searchByTitle("Note 7").toNoteSet());
+	assert(sb.searchByText("desc 42") == reference.searchByText("desc 42").toNoteSet());
+	assert(sb.searchByTag(std::set<std::string>{"t1", "t2"}) == reference.searchByTag("t1", "t2").toNoteSet());
+	Storyboard::TagQuery q;
+	q.allOf = {"all", "t5"};
+	q.noneOf = {"t5"};
+	assert(sb.searchByTags(q).empty());
+
+	sb.addNote({"New", "desc", {"new"}});
+	assert(sb.searchByTag("new").size() == 1);
+	sb.deleteNote({"New", "desc", {"new"}});
+	sb.deleteNote(notes[0]);
+	assert(sb.size() == 499);
+	assert(sb.searchByTag("new").empty());
+	assert(!sb.contains(notes[0]));
+
+	// Concurrent writers and readers
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; t++) {
+		threads.emplace_back([&sb, t]() {
+			for (int i = 0; i < 100; i++) {
+				sb.addNote({"Thread " + std::to_string(t), std::to_string(i), {"threads"}});
+				sb.searchByTag("threads");
+			}
+		});
+	}
+	for (auto &t : threads) {
+		t.join();
+	}
+	assert(sb.searchByTag("threads").size() == 400);
+}
+
+void testMappedStoryboard()
+{
+	const std::string path = "/tmp/storyboard_test.snapshot";
+	Storyboard sb;
+	for (int i = 0; i < 300; i++) {
+		sb.addNote({"Note " + std::to_string(i % 30), "desc " + std::to_string(i), {"t" + std::to_string(i % 7), "all"}});
+	}
+	sb.addNote({"Same", "Same", {"Same"}});
+	sb.deleteNote({"Note 0", "desc 0", {"t0", "all"}});
+	sb.deleteNote({"Note 1", "desc 1", {"t1", "all"}});
+	MappedStoryboard::save(sb, path);
+
+	MappedStoryboard mapped(path);
+	assert(mapped.size() == sb.size());
+	assert(mapped.searchByTitle("Note 3").toNoteSet() == sb.searchByTitle("Note 3").toNoteSet());
+	assert(mapped.searchByText("desc 42").toNoteSet() == sb.searchByText("desc 42").toNoteSet());
+	assert(mapped.searchByText("desc 0").empty());
+	assert(mapped.searchByTag("all").size() == 298);
+	assert(mapped.searchByTag("Same").size() == 1);
+	assert(mapped.searchByTitle("Same").size() == 1);
+	assert(mapped.searchByTag("desc 5").empty());
+	assert(mapped.searchByTag("missing").empty());
+	assert(mapped.searchByTag(std::set<std::string>{"t1", "t2"}).toNoteSet() == sb.searchByTag("t1", "t2").toNoteSet());
+	Storyboard::TagQuery q;
+	q.allOf = {"all", "t3"};
+	q.anyOf = {"t3", "t4"};
+	q.noneOf = {"t4"};
+	assert(mapped.searchByTags(q).toNoteSet() == sb.searchByTags(q).toNoteSet());
+	assert(mapped.findNote({"Note 5", "desc 5", {"t5", "all"}}) != Storyboard::InvalidNoteId);
+	assert(mapped.findNote({"Note 1", "desc 1", {"t1", "all"}}) == Storyboard::InvalidNoteId);
+	assert(mapped.findNote({"Note 5", "desc 5", {"t5"}}) == Storyboard::InvalidNoteId);
+
+	// A board rebuilt from the snapshot is the same board
+	Storyboard loaded;
+	loaded.addNotes(mapped.notes());
+	assert(loaded.notes() == sb.notes());
+
+	// Moved mapping stays valid
+	MappedStoryboard moved(std::move(mapped));
+	assert(moved.searchByTag("all").size() == 298);
+
+	// A failed save keeps the previous snapshot and leaves no temporary file behind
+	{
+		rlimit limit;
+		getrlimit(RLIMIT_FSIZE, &limit);
+		rlimit small = limit;
+		small.rlim_cur = 1024;
+		auto handler = std::signal(SIGXFSZ, SIG_IGN);
+		setrlimit(RLIMIT_FSIZE, &small);
+		bool failed = false;
+		try {
+			MappedStoryboard::save(sb, path);
+		} catch (const std::runtime_error &) {
+			failed = true;
+		}
+		setrlimit(RLIMIT_FSIZE, &limit);
+		std::signal(SIGXFSZ, handler);
+		assert(failed);
+		std::FILE *f = std::fopen((path + ".tmp").c_str(), "rb");
+		assert(!f);
+		assert(MappedStoryboard(path).size() == sb.size());
+	}
+
+	bool thrown = false;
+	try {
+		MappedStoryboard bad("/tmp/storyboard_test.missing");
+	} catch (const std::runtime_error &) {
+		thrown = true;
+	}
+	assert(thrown);
+	std::remove(path.c_str());
+}
+
+void testDurableStoryboard()
+{
+	const std::string dir = "/tmp/storyboard_test.durable";
+	std::system(("rm -rf " + dir).c_str());
+	DurableStoryboard::Options options;
+	options.compactBytes = 0;
+
+	{
+		DurableStoryboard sb(dir, options);
+		assert(sb.size() == 0);
+		for (int i = 0; i < 100; i++) {
+			sb.addNote({"Note " + std::to_string(i), "desc", {"t" + std::to_string(i % 3)}});
+		}
+		sb.deleteNote({"Note 0", "desc", {"t0"}});
+		assert(sb.size() == 99);
+	}
+	{
+		// Replays the log
+		DurableStoryboard sb(dir, options);
+		assert(sb.recoveredRecords() == 101);
+		assert(sb.size() == 99);
+		assert(sb.searchByTag("t1").size() == 33);
+		assert(sb.searchByTitle("Note 0").empty());
+
+		// Snapshot + new segment
+		sb.checkpoint();
+		sb.addNote({"After", "checkpoint", {"t1"}});
+		sb.deleteNote({"Note 1", "desc", {"t1"}});
+	}
+	{
+		DurableStoryboard sb(dir, options);
+		assert(sb.recoveredRecords() == 2);
+		assert(sb.size() == 99);
+		assert(sb.searchByTag("t1").size() == 33);
+		assert(sb.searchByTitle("After").size() == 1);
+	}
+
+	// Torn record at the end of the log (crash during a write) is dropped
+	{
+		std::FILE *f = std::fopen((dir + "/wal.0000000002").c_str(), "ab");
+		assert(f);
+		const char garbage[] = {7, 0, 0, 0, 1, 2};
+		std::fwrite(garbage, 1, sizeof(garbage), f);
+		std::fclose(f);
+
+		DurableStoryboard sb(dir, options);
+		assert(sb.recoveredRecords() == 2);
+		sb.addNote({"After", "crash", {"t2"}});
+	}
+	{
+		DurableStoryboard sb(dir, options);
+		assert(sb.recoveredRecords() == 3);
+		assert(sb.size() == 100);
+	}
+
+	// Background compaction, concurrent group committed writers
+	options.compactBytes = 4096;
+	{
+		DurableStoryboard sb(dir, options);
+		std::vector<std::thread> writers;
+		for (int t = 0; t < 4; t++) {
+			writers.emplace_back([&sb, t]() {
+				for (int i = 0; i < 200; i++) {
+					sb.addNote({"Thread " + std::to_string(t), std::to_string(i), {"threads"}});
+				}
+			});
+		}
+		for (auto &w : writers) {
+			w.join();
+		}
+		assert(sb.searchByTag("threads").size() == 800);
+	}
+	{
+		DurableStoryboard sb(dir, options);
+		assert(sb.size() == 900);
+		assert(sb.recoveredRecords() < 800); // most of the log got compacted
+	}
+	std::system(("rm -rf " + dir).c_str());
+}
+
+void testWriteAheadLogFailure()
+{
+	// A write failing half way (file size limit) must not be reported durable, nor anything after it
+	const std::string path = "/tmp/storyboard_test.wal";
+	std::remove(path.c_str());
+	rlimit limit;
+	getrlimit(RLIMIT_FSIZE, &limit);
+	auto handler = std::signal(SIGXFSZ, SIG_IGN);
+	{
+		WriteAheadLog wal(path);
+		wal.waitDurable(wal.append(WriteAheadLog::RecordType::AddNote, {"Good", "record", {"t"}}));
+		auto good = wal.end();
+
+		rlimit small = limit;
+		small.rlim_cur = good + 16;
+		setrlimit(RLIMIT_FSIZE, &small);
+		auto torn = wal.append(WriteAheadLog::RecordType::AddNote, {"Torn", std::string(1000, 'x'), {"t"}});
+		bool thrown = false;
+		try {
+			wal.waitDurable(torn);
+		} catch (const std::runtime_error &) {
+			thrown = true;
+		}
+		assert(thrown);
+		setrlimit(RLIMIT_FSIZE, &limit);
+
+		// Writing works again, but the log stays failed
+		thrown = false;
+		try {
+			wal.append(WriteAheadLog::RecordType::AddNote, {"After", "failure", {"t"}});
+		} catch (const std::runtime_error &) {
+			thrown = true;
+		}
+		assert(thrown);
+		thrown = false;
+		try {
+			wal.flush();
+		} catch (const std::runtime_error &) {
+			thrown = true;
+		}
+		assert(thrown);
+		wal.waitDurable(good); // still durable
+	}
+	std::signal(SIGXFSZ, handler);
+
+	std::vector<std::string> titles;
+	WriteAheadLog::replay(path, [&titles](WriteAheadLog::RecordType, const Note &note) { titles.push_back(note.title); });
+	assert(titles == std::vector<std::string>({"Good"}));
+	std::remove(path.c_str());
+}
+
 } // anonymous ns
 
 void test()
@@ -196,6 +1437,29 @@ void test()
 	testSearchByTitle();
 	testSearchByText();
 	testSearchByTag();
+	testNoteIds();
+	testSearchResult();
+	testDeleteNoteById();
+	testIndexBackends();
+	testArenas();
+	testCompactIds();
+	testTagSets();
+	testFingerprints();
+	testPostingAlgebra();
+	testSearchByTags();
+	testSearchByWords();
+	testPagedSearch();
+	testKeyTries();
+	testChangeFeed();
+	testResultCache();
+	testMetrics();
+	testAddNotes();
+	testConcurrentStoryboard();
+	testConcurrentStoryboard_failedWrite();
+	testShardedStoryboard();
+	testMappedStoryboard();
+	testDurableStoryboard();
+	testWriteAheadLogFailure();
 	std::cout << "All tests passed." << std::endl;
 }
 
@@ -0,0 +1,56 @@
+#pragma once
+
+// Martin Flaska - flegy@flegy.sk / https://www.linkedin.com/in/martinflaska
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/** Fixed size pool of worker threads with a shared FIFO task queue
+ *
+ * @note Tasks must not wait for other tasks of the same pool (no nested fan-out).
+ */
+class ThreadPool
+{
+public:
+	/** @param threads Number of workers, 0 means std::thread::hardware_concurrency() */
+	explicit ThreadPool(unsigned threads = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	size_t size() const { return m_workers.size(); }
+
+	/** Run @f on a worker, the returned future gets its result (or exception) */
+	template<typename F>
+	auto submit(F f) -> std::future<decltype(f())>
+	{
+		typedef decltype(f()) R;
+		// std::function needs a copyable callable, hence the shared_ptr
+		auto task = std::make_shared<std::packaged_task<R()>>(std::move(f));
+		auto future = task->get_future();
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_tasks.push_back([task]() { (*task)(); });
+		}
+		m_cv.notify_one();
+		return future;
+	}
+
+private:
+	void run();
+
+private:
+	std::vector<std::thread> m_workers;
+	std::deque<std::function<void()>> m_tasks;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	bool m_stop = false;
+};
@@ -0,0 +1,131 @@
+#include "TokenIndex.h"
+
+#include <algorithm>
+#include <cctype>
+#include <utility>
+
+#include "PostingAlgebra.h"
+
+
+std::vector<std::string> TokenIndex::tokenize(const std::string &text)
+{
+	std::vector<std::string> tokens;
+	std::string token;
+	for (unsigned char c : text) {
+		if (std::isalnum(c) || c >= 0x80) {
+			token += static_cast<char>(std::tolower(c));
+		} else if (!token.empty()) {
+			tokens.push_back(std::move(token));
+			token.clear();
+		}
+	}
+	if (!token.empty()) {
+		tokens.push_back(std::move(token));
+	}
+	return tokens;
+}
+
+void TokenIndex::add(NoteId id, const std::string &text)
+{
+	// (word, position) pairs grouped by word
+	std::vector<std::pair<SymbolId, uint32_t>> occurrences;
+	uint32_t pos = 0;
+	for (auto const &token : tokenize(text)) {
+		occurrences.push_back({m_tokens.intern(token), pos++});
+	}
+	std::sort(occurrences.begin(), occurrences.end());
+
+	for (size_t i = 0; i < occurrences.size(); ) {
+		auto sym = occurrences[i].first;
+		if (sym >= m_postings.size()) {
+			m_postings.resize(sym + 1);
+		}
+		auto &list = m_postings[sym];
+		list.ids.push_back(id); // ids grow monotonically -> the list stays sorted
+		for (; i < occurrences.size() && occurrences[i].first == sym; i++) {
+			list.positions.push_back(occurrences[i].second);
+		}
+		list.offsets.push_back(static_cast<uint32_t>(list.positions.size()));
+	}
+}
+
+std::vector<NoteId> TokenIndex::matchAll(const std::vector<std::string> &words) const
+{
+	auto lists = lookup(words);
+	if (lists.empty()) {
+		return {};
+	}
+	auto ids = lists[0]->ids;
+	std::vector<NoteId> tmp;
+	for (size_t i = 1; i < lists.size() && !ids.empty(); i++) {
+		tmp.clear();
+		PostingAlgebra::intersect(ids, lists[i]->ids, tmp);
+		ids.swap(tmp);
+	}
+	return ids;
+}
+
+std::vector<NoteId> TokenIndex::matchPhrase(const std::vector<std::string> &words) const
+{
+	auto candidates = matchAll(words);
+	if (words.size() < 2 || candidates.empty()) {
+		return candidates;
+	}
+
+	std::vector<const Postings*> lists;
+	for (auto const &word : words) {
+		lists.push_back(&m_postings[m_tokens.find(word)]);
+	}
+
+	// positions of @id in the word @k list
+	auto positionsOf = [&lists](size_t k, NoteId id) {
+		auto const &l = *lists[k];
+		auto i = std::lower_bound(l.ids.begin(), l.ids.end(), id) - l.ids.begin();
+		return std::make_pair(l.positions.data() + l.offsets[i], l.positions.data() + l.offsets[i + 1]);
+	};
+
+	std::vector<NoteId> ids;
+	for (auto id : candidates) {
+		auto first = positionsOf(0, id);
+		for (auto p = first.first; p != first.second; p++) {
+			bool match = true;
+			for (size_t k = 1; k < words.size() && match; k++) {
+				auto pk = positionsOf(k, id);
+				match = std::binary_search(pk.first, pk.second, *p + static_cast<uint32_t>(k));
+			}
+			if (match) {
+				ids.push_back(id);
+				break;
+			}
+		}
+	}
+	return ids;
+}
+
+std::vector<const TokenIndex::Postings*> TokenIndex::lookup(const std::vector<std::string> &words) const
+{
+	std::vector<const Postings*> lists;
+	for (auto const &word : words) {
+		auto sym = m_tokens.find(word);
+		if (sym == StringPool::npos) {
+			return {};
+		}
+		lists.push_back(&m_postings[sym]);
+	}
+	std::sort(lists.begin(), lists.end(), [](const Postings *a, const Postings *b) {
+		return a->ids.size() < b->ids.size();
+	});
+	lists.erase(std::unique(lists.begin(), lists.end()), lists.end());
+	return lists;
+}
+
+std::vector<SymbolId> TokenIndex::distinctSymbols(const std::string &text) const
+{
+	std::vector<SymbolId> syms;
+	for (auto const &token : tokenize(text)) {
+		syms.push_back(m_tokens.find(token));
+	}
+	std::sort(syms.begin(), syms.end());
+	syms.erase(std::unique(syms.begin(), syms.end()), syms.end());
+	return syms;
+}
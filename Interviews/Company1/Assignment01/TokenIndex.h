@@ -0,0 +1,106 @@
+#pragma once
+
+// Martin Flaska - flegy@flegy.sk / https://www.linkedin.com/in/martinflaska
+
+#include <string>
+#include <vector>
+
+#include "PostingIndex.h"
+#include "StringPool.h"
+
+
+/** Positional inverted index of words in note texts
+ *
+ * Every word keeps a sorted list of note ids plus the word positions within each note
+ * (CSR layout: @offsets index into @positions). Removal follows the PostingList scheme: ids of
+ * removed notes are only counted as dead and the list is compacted once most of it is dead,
+ * so query results may contain ids of removed notes and the caller filters them out.
+ */
+class TokenIndex
+{
+public:
+	/** Split @text into lower case words (ASCII letters/digits, other bytes >= 0x80 are kept
+	 * as a part of a word so UTF-8 words stay in one piece)
+	 */
+	static std::vector<std::string> tokenize(const std::string &text);
+
+	void add(NoteId id, const std::string &text);
+
+	/** Remove note @text words, @alive tells which notes are still alive (for compaction) */
+	template<typename Alive>
+	void remove(const std::string &text, Alive alive)
+	{
+		auto syms = distinctSymbols(text);
+		for (auto sym : syms) {
+			auto &list = m_postings[sym];
+			list.dead++;
+			if (list.live() == 0) {
+				list = Postings();
+			} else if (list.dead * 2 > list.ids.size()) {
+				compact(list, alive);
+			}
+		}
+		for (auto const &token : tokenize(text)) {
+			m_tokens.release(m_tokens.find(token));
+		}
+	}
+
+	/** Drop ids of the notes which are not @alive and replace the rest by @map(id)
+	 * (@map must keep the order of ids)
+	 */
+	template<typename Alive, typename Map>
+	void renumber(Alive alive, Map map)
+	{
+		for (auto &list : m_postings) {
+			if (list.dead != 0) {
+				compact(list, alive);
+			}
+			for (auto &id : list.ids) {
+				id = map(id);
+			}
+		}
+	}
+	/** Ids of notes containing all the @words (in any order) */
+	std::vector<NoteId> matchAll(const std::vector<std::string> &words) const;
+	/** Ids of notes containing the @words in this order next to each other */
+	std::vector<NoteId> matchPhrase(const std::vector<std::string> &words) const;
+
+	/** Number of distinct words */
+	size_t size() const { return m_tokens.size(); }
+
+private:
+	struct Postings
+	{
+		std::vector<NoteId> ids;          ///< sorted
+		std::vector<uint32_t> offsets{0}; ///< positions of ids[i] are positions[offsets[i] .. offsets[i + 1])
+		std::vector<uint32_t> positions;  ///< word positions (sorted per note)
+		uint32_t dead = 0;
+
+		size_t live() const { return ids.size() - dead; }
+	};
+
+	/** Posting lists of @words (smallest first) or empty if any of them is unknown */
+	std::vector<const Postings*> lookup(const std::vector<std::string> &words) const;
+	std::vector<SymbolId> distinctSymbols(const std::string &text) const;
+
+	template<typename Alive>
+	static void compact(Postings &list, Alive alive)
+	{
+		Postings c;
+		c.ids.reserve(list.live());
+		c.offsets.reserve(list.live() + 1);
+		for (size_t i = 0; i < list.ids.size(); i++) {
+			if (alive(list.ids[i])) {
+				c.ids.push_back(list.ids[i]);
+				c.positions.insert(c.positions.end(), list.positions.begin() + list.offsets[i],
+					list.positions.begin() + list.offsets[i + 1]);
+				c.offsets.push_back(static_cast<uint32_t>(c.positions.size()));
+			}
+		}
+		list = std::move(c);
+	}
+
+private:
+	StringPool m_tokens;
+	std::vector<Postings> m_postings; // index is the word SymbolId (dense)
+};
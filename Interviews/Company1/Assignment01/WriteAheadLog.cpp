@@ -0,0 +1,293 @@
+#include "WriteAheadLog.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace {
+
+const size_t HeaderSize = 2 * sizeof(uint32_t);
+
+std::runtime_error ioError(const std::string &what, const std::string &path)
+{
+	return std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+}
+
+/** CRC-32C (Castagnoli), bytewise table */
+class Crc32c
+{
+public:
+	Crc32c()
+	{
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++) {
+				c = c & 1 ? (c >> 1) ^ 0x82F63B78u : c >> 1;
+			}
+			m_table[i] = c;
+		}
+	}
+
+	uint32_t operator()(const char *data, size_t size) const
+	{
+		uint32_t c = 0xFFFFFFFFu;
+		for (size_t i = 0; i < size; i++) {
+			c = m_table[(c ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (c >> 8);
+		}
+		return c ^ 0xFFFFFFFFu;
+	}
+
+private:
+	uint32_t m_table[256];
+};
+
+const Crc32c crc32c;
+
+void put(std::vector<char> &buf, uint32_t v)
+{
+	auto p = reinterpret_cast<const char*>(&v);
+	buf.insert(buf.end(), p, p + sizeof(v));
+}
+
+void put(std::vector<char> &buf, const std::string &s)
+{
+	put(buf, static_cast<uint32_t>(s.size()));
+	buf.insert(buf.end(), s.begin(), s.end());
+}
+
+/** Bounds checked payload reader */
+class Reader
+{
+public:
+	Reader(const char *data, size_t size) : m_pos(data), m_end(data + size) {}
+
+	bool get(uint32_t &v)
+	{
+		if (size_t(m_end - m_pos) < sizeof(v)) {
+			return false;
+		}
+		std::memcpy(&v, m_pos, sizeof(v));
+		m_pos += sizeof(v);
+		return true;
+	}
+
+	bool get(std::string &s)
+	{
+		uint32_t size;
+		if (!get(size) || size_t(m_end - m_pos) < size) {
+			return false;
+		}
+		s.assign(m_pos, size);
+		m_pos += size;
+		return true;
+	}
+
+	bool done() const { return m_pos == m_end; }
+
+private:
+	const char *m_pos;
+	const char *m_end;
+};
+
+bool decode(const char *data, size_t size, Note &note)
+{
+	Reader r(data, size);
+	uint32_t tagCount;
+	if (!r.get(note.title) || !r.get(note.text) || !r.get(tagCount)) {
+		return false;
+	}
+	note.tags.clear();
+	for (uint32_t i = 0; i < tagCount; i++) {
+		std::string tag;
+		if (!r.get(tag)) {
+			return false;
+		}
+		note.tags.insert(std::move(tag));
+	}
+	return r.done();
+}
+
+bool writeAll(int fd, const char *data, size_t size)
+{
+	while (size > 0) {
+		auto n = ::write(fd, data, size);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			return false;
+		}
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+} // anonymous ns
+
+WriteAheadLog::WriteAheadLog(const std::string &path)
+	: m_path(path)
+{
+	m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (m_fd < 0) {
+		throw ioError("Can not open", path);
+	}
+	struct stat st;
+	if (::fstat(m_fd, &st) != 0) {
+		::close(m_fd);
+		throw ioError("Can not stat", path);
+	}
+	m_end = m_durable = st.st_size;
+	m_flusher = std::thread(&WriteAheadLog::run, this);
+}
+
+WriteAheadLog::~WriteAheadLog()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_appended.notify_one();
+	m_flusher.join(); // Note: the flusher drains the buffer before it stops
+	::close(m_fd);
+}
+
+WriteAheadLog::Lsn WriteAheadLog::append(RecordType type, const Note &note)
+{
+	// Serialize outside of the lock, only the copy into the shared buffer is serialized
+	// Note: the header is filled in once the payload is known
+	size_t size = HeaderSize + 1 + 3 * sizeof(uint32_t) + note.title.size() + note.text.size();
+	for (auto const &tag : note.tags) {
+		size += sizeof(uint32_t) + tag.size();
+	}
+	const char placeholder[HeaderSize] = {};
+	std::vector<char> record;
+	record.reserve(size);
+	record.insert(record.end(), placeholder, placeholder + HeaderSize);
+	record.push_back(static_cast<char>(type));
+	put(record, note.title);
+	put(record, note.text);
+	put(record, static_cast<uint32_t>(note.tags.size()));
+	for (auto const &tag : note.tags) {
+		put(record, tag);
+	}
+	uint32_t header[2] = {
+		static_cast<uint32_t>(record.size() - HeaderSize - 1),
+		crc32c(record.data() + HeaderSize, record.size() - HeaderSize),
+	};
+	std::memcpy(record.data(), header, HeaderSize);
+
+	Lsn lsn;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_failed) {
+			throw std::runtime_error("Can not write " + m_path);
+		}
+		m_buffer.insert(m_buffer.end(), record.begin(), record.end());
+		m_end += record.size();
+		lsn = m_end;
+	}
+	m_appended.notify_one();
+	return lsn;
+}
+
+void WriteAheadLog::waitDurable(Lsn lsn)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_synced.wait(lock, [this, lsn]() { return m_durable >= lsn || m_failed; });
+	if (m_durable < lsn) {
+		throw std::runtime_error("Can not write " + m_path);
+	}
+}
+
+WriteAheadLog::Lsn WriteAheadLog::end() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_end;
+}
+
+void WriteAheadLog::run()
+{
+	std::vector<char> batch;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;) {
+		m_appended.wait(lock, [this]() { return m_stop || !m_buffer.empty(); });
+		if (m_buffer.empty()) {
+			return; // stopped and drained
+		}
+		// Everything appended while the previous batch was being synced goes in one write + sync
+		batch.clear();
+		batch.swap(m_buffer);
+		auto end = m_end;
+		lock.unlock();
+		bool ok = writeAll(m_fd, batch.data(), batch.size()) && ::fdatasync(m_fd) == 0;
+		lock.lock();
+		if (!ok) {
+			// Note: the batch may be partly written and a failed fdatasync must not be retried (the kernel may
+			// have dropped the dirty pages already), so nothing after the last good record is ever durable
+			m_failed = true;
+			m_buffer.clear();
+			m_synced.notify_all();
+			return;
+		}
+		m_durable = end;
+		m_synced.notify_all();
+	}
+}
+
+size_t WriteAheadLog::replay(const std::string &path, const std::function<void(RecordType, const Note &)> &f)
+{
+	int fd = ::open(path.c_str(), O_RDWR);
+	if (fd < 0) {
+		if (errno == ENOENT) {
+			return 0;
+		}
+		throw ioError("Can not open", path);
+	}
+	std::vector<char> data;
+	char chunk[1 << 16];
+	for (;;) {
+		auto n = ::read(fd, chunk, sizeof(chunk));
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			::close(fd);
+			throw ioError("Can not read", path);
+		}
+		if (n == 0) {
+			break;
+		}
+		data.insert(data.end(), chunk, chunk + n);
+	}
+
+	size_t count = 0;
+	size_t pos = 0;
+	Note note;
+	while (data.size() - pos >= HeaderSize + 1) {
+		uint32_t header[2];
+		std::memcpy(header, data.data() + pos, HeaderSize);
+		auto body = data.data() + pos + HeaderSize;
+		if (data.size() - pos - HeaderSize - 1 < header[0] || crc32c(body, header[0] + 1) != header[1]) {
+			break;
+		}
+		auto type = static_cast<RecordType>(body[0]);
+		if ((type != RecordType::AddNote && type != RecordType::DeleteNote) || !decode(body + 1, header[0], note)) {
+			break;
+		}
+		f(type, note);
+		count++;
+		pos += HeaderSize + 1 + header[0];
+	}
+	if (pos < data.size() && ::ftruncate(fd, pos) != 0) {
+		::close(fd);
+		throw ioError("Can not truncate", path);
+	}
+	::close(fd);
+	return count;
+}
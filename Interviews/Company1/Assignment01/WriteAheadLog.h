@@ -0,0 +1,93 @@
+#pragma once
+
+// Martin Flaska - flegy@flegy.sk / https://www.linkedin.com/in/martinflaska
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Storyboard.h"
+
+
+/** Append only, group committed log of Storyboard changes
+ *
+ * Record layout (native byte order):
+ *   uint32_t size   payload size
+ *   uint32_t crc    CRC-32C of type + payload
+ *   uint8_t  type   RecordType
+ *   payload         title, text, tag count, tags; strings as uint32_t size + bytes
+ *
+ * append() only serializes the record into a memory buffer. A flusher thread writes whatever
+ * has accumulated and fdatasync()s it in one go, so concurrent writers waiting in
+ * waitDurable() share a single sync (group commit).
+ */
+class WriteAheadLog
+{
+public:
+	/** Log sequence number: end offset of a record in the log */
+	typedef uint64_t Lsn;
+
+	enum class RecordType : uint8_t
+	{
+		AddNote = 1,
+		DeleteNote = 2,
+	};
+
+	/** Open @path for appending (created if needed)
+	 * @throw std::runtime_error on I/O errors
+	 */
+	explicit WriteAheadLog(const std::string &path);
+	/** Flushes everything appended so far */
+	~WriteAheadLog();
+
+	WriteAheadLog(const WriteAheadLog &) = delete;
+	WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+	/** @throw std::runtime_error if the log failed (see waitDurable) */
+	Lsn append(RecordType type, const Note &note);
+	/** Block until the record ending at @lsn is on disk
+	 *
+	 * Once a write or sync fails the log stops writing: records up to the last synced one stay
+	 * durable, every later one fails here and so does any further append().
+	 *
+	 * @throw std::runtime_error if the log could not be written
+	 */
+	void waitDurable(Lsn lsn);
+	/** Make everything appended so far durable */
+	void flush() { waitDurable(end()); }
+
+	/** Size of the log including not yet written records */
+	Lsn end() const;
+	const std::string &path() const { return m_path; }
+
+	/** Read all the valid records of @path
+	 *
+	 * Replay stops at the first torn or corrupted record (crash during a write), the file is
+	 * truncated there so new records are not appended after garbage.
+	 *
+	 * @return Number of replayed records
+	 * @throw std::runtime_error on I/O errors
+	 */
+	static size_t replay(const std::string &path, const std::function<void(RecordType, const Note &)> &f);
+
+private:
+	void run();
+
+private:
+	std::string m_path;
+	int m_fd = -1;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_appended; ///< wakes up the flusher
+	std::condition_variable m_synced;   ///< wakes up waitDurable()
+	std::vector<char> m_buffer;         ///< appended, not written yet
+	Lsn m_end = 0;                      ///< appended
+	Lsn m_durable = 0;                  ///< written and synced
+	bool m_failed = false;
+	bool m_stop = false;
+	std::thread m_flusher;
+};
@@ -0,0 +1,411 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "GraphAnalytics.h"
+#include "SocialNetwork.h"
+#include "WorkStealingPool.h"
+
+using namespace std;
+
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+/** Latency samples of one operation */
+class Latencies
+{
+public:
+	template<typename F>
+	void time(F f)
+	{
+		auto start = Clock::now();
+		f();
+		m_samples.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+	}
+
+	size_t count() const { return m_samples.size(); }
+	/** Total time (us) */
+	double total() const
+	{
+		double t = 0;
+		for (auto s : m_samples) {
+			t += s;
+		}
+		return t;
+	}
+	/** @p-th percentile (us), @p in [0, 1] */
+	double percentile(double p)
+	{
+		if (m_samples.empty()) {
+			return 0;
+		}
+		auto nth = m_samples.begin() + static_cast<size_t>(p * (m_samples.size() - 1));
+		std::nth_element(m_samples.begin(), nth, m_samples.end());
+		return *nth;
+	}
+
+private:
+	std::vector<double> m_samples;
+};
+
+/** Ranks [0, n) with P(rank r) ~ 1 / (r + 1)^s */
+class Zipf
+{
+public:
+	Zipf(size_t n, double s)
+	{
+		std::vector<double> weights(n);
+		for (size_t r = 0; r < n; r++) {
+			weights[r] = 1.0 / std::pow(r + 1.0, s);
+		}
+		m_dist = std::discrete_distribution<size_t>(weights.begin(), weights.end());
+	}
+	size_t operator()(std::mt19937 &rng) { return m_dist(rng); }
+
+private:
+	std::discrete_distribution<size_t> m_dist;
+};
+
+/** Peak resident set size of the process (kB) */
+long peakRss()
+{
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+/** Peak RSS when the measured structure started to be built (after the input was generated) */
+long rssBaseline = 0;
+
+struct SuiteResult
+{
+	size_t scale;
+	std::string op;
+	size_t count;
+	double throughput; ///< ops per second
+	double p50;        ///< us
+	double p99;        ///< us
+	long rssGrowth;    ///< kB, peak RSS over rssBaseline (i.e. without the benchmark input)
+};
+
+SuiteResult summarize(size_t scale, const std::string &op, Latencies &l)
+{
+	return {scale, op, l.count(), l.count() / (l.total() / 1e6), l.percentile(0.5), l.percentile(0.99), peakRss() - rssBaseline};
+}
+
+void writeJson(std::ostream &os, const std::vector<SuiteResult> &results)
+{
+	os << "{\"project\": \"assignment02\", \"results\": [";
+	for (size_t i = 0; i < results.size(); i++) {
+		auto const &r = results[i];
+		os << (i ? "," : "") << "\n\t{\"scale\": " << r.scale << ", \"op\": \"" << r.op << "\", \"count\": " << r.count
+			<< ", \"throughput\": " << r.throughput << ", \"p50_us\": " << r.p50 << ", \"p99_us\": " << r.p99
+			<< ", \"rss_growth_kb\": " << r.rssGrowth << "}";
+	}
+	os << "\n]}" << std::endl;
+}
+
+ID userId(size_t i)
+{
+	return "user-" + std::to_string(i);
+}
+
+/** Insert, query and delete @scale synthetic users (Zipfian names and hobbies) */
+void runSuite(size_t scale, std::vector<SuiteResult> &results)
+{
+	std::mt19937 rng(42);
+	const size_t nameCount = std::max<size_t>(1, scale / 10);
+	const size_t hobbyCount = 200;
+	Zipf nameDist(nameCount, 1.0);
+	Zipf hobbyDist(hobbyCount, 1.0);
+
+	// Users are generated on the fly, so the input does not add to the measured memory
+	rssBaseline = peakRss();
+	SocialNetwork sn;
+	Latencies insert;
+	for (size_t i = 0; i < scale; i++) {
+		User user(userId(i), "Name " + std::to_string(nameDist(rng)));
+		user.setAge(static_cast<uint8_t>(1 + rng() % 99));
+		user.setHeight(static_cast<uint8_t>(150 + rng() % 50));
+		user.setGenderu(rng() % 2 ? Gender::male : Gender::female);
+		std::set<std::string> hobbies;
+		for (auto n = 1 + rng() % 3; hobbies.size() < n; ) {
+			hobbies.insert("hobby " + std::to_string(hobbyDist(rng)));
+		}
+		user.setHobbies(hobbies);
+		std::set<ID> friends;
+		for (auto n = 1 + rng() % 10; friends.size() < n && friends.size() + 1 < scale; ) {
+			auto f = rng() % scale;
+			if (f != i) {
+				friends.insert(userId(f));
+			}
+		}
+		user.setFriends(friends);
+		insert.time([&]() { sn.addUser(user); });
+	}
+	results.push_back(summarize(scale, "addUser", insert));
+
+	// Queries follow the data distribution, the ones returning large lists run fewer times
+	const size_t queryCount = std::min<size_t>(scale, 10000);
+	const size_t heavyCount = std::min<size_t>(scale, 1000);
+	size_t found = 0;
+	Latencies byName, byAge, byHobbies, friends;
+	for (size_t q = 0; q < queryCount; q++) {
+		auto name = "Name " + std::to_string(nameDist(rng));
+		byName.time([&]() { found += sn.searchUserByName(name).size(); });
+	}
+	for (size_t q = 0; q < heavyCount; q++) {
+		auto age = static_cast<uint8_t>(1 + rng() % 99);
+		byAge.time([&]() { found += sn.searchUserByAge(age).size(); });
+	}
+	Latencies byAnyHobby, byHobbiesAtLeast;
+	for (size_t q = 0; q < heavyCount; q++) {
+		std::set<std::string> hobbies;
+		while (hobbies.size() < 4) {
+			hobbies.insert("hobby " + std::to_string(hobbyDist(rng)));
+		}
+		std::set<std::string> two(hobbies.begin(), std::next(hobbies.begin(), 2));
+		byHobbies.time([&]() { found += sn.searchUserByHobbies(two).size(); });
+		byAnyHobby.time([&]() { found += sn.searchUserByHobbies(two, SocialNetwork::Match::Any).size(); });
+		byHobbiesAtLeast.time([&]() { found += sn.searchUserByHobbies(hobbies, 2).size(); });
+	}
+	for (size_t q = 0; q < queryCount; q++) {
+		auto id = userId(rng() % scale);
+		friends.time([&]() { found += sn.getFriendsOfUser(id).size(); });
+	}
+	// Compound queries, by hand as before (lists intersected by the client) and planned
+	Latencies clientCompound, nameAndAge, ageHeightGender, hobbiesAndAge;
+	for (size_t q = 0; q < heavyCount; q++) {
+		auto name = "Name " + std::to_string(nameDist(rng));
+		auto age = static_cast<uint8_t>(1 + rng() % 90);
+		clientCompound.time([&]() {
+			auto byAge = sn.searchUserByAge(age);
+			std::set<ID> ids;
+			for (auto const &u : byAge) {
+				ids.insert(u->id());
+			}
+			for (auto const &u : sn.searchUserByName(name)) {
+				found += ids.count(u->id());
+			}
+		});
+		UserQuery query;
+		query.setName(name);
+		query.setAgeRange(age, static_cast<uint8_t>(age + 9));
+		nameAndAge.time([&]() { found += sn.searchUsers(query).size(); });
+
+		UserQuery people;
+		people.setAgeRange(age, static_cast<uint8_t>(age + 4));
+		people.setHeightRange(170, 180);
+		people.setGender(Gender::female);
+		ageHeightGender.time([&]() { found += sn.searchUsers(people).size(); });
+
+		UserQuery hobbies;
+		hobbies.setHobbies({"hobby " + std::to_string(hobbyDist(rng)), "hobby " + std::to_string(hobbyDist(rng))}, 1);
+		hobbies.setAgeRange(age, static_cast<uint8_t>(age + 9));
+		hobbiesAndAge.time([&]() { found += sn.searchUsers(hobbies).size(); });
+	}
+	results.push_back(summarize(scale, "name & age (client)", clientCompound));
+	results.push_back(summarize(scale, "name & age range", nameAndAge));
+	results.push_back(summarize(scale, "age, height, gender", ageHeightGender));
+	results.push_back(summarize(scale, "hobbies & age range", hobbiesAndAge));
+	results.push_back(summarize(scale, "searchUserByName", byName));
+	results.push_back(summarize(scale, "searchUserByAge", byAge));
+	results.push_back(summarize(scale, "searchUserByHobbies", byHobbies));
+	results.push_back(summarize(scale, "hobbies (any of 2)", byAnyHobby));
+	results.push_back(summarize(scale, "hobbies (2 of 4)", byHobbiesAtLeast));
+	results.push_back(summarize(scale, "getFriendsOfUser", friends));
+
+	// Friends of friends as clients did it before the traversal API: getFriendsOfUser of every friend
+	Latencies clientHops, hops, separation, mutual, pymk;
+	for (size_t q = 0; q < heavyCount; q++) {
+		auto id = userId(rng() % scale);
+		clientHops.time([&]() {
+			std::set<ID> all;
+			for (auto const &f : sn.getFriendsOfUser(id)) {
+				auto ff = sn.getFriendsOfUser(f);
+				all.insert(ff.begin(), ff.end());
+			}
+			found += all.size();
+		});
+		hops.time([&]() { found += sn.getFriendsWithinHops(id, 2).size(); });
+	}
+	for (size_t q = 0; q < heavyCount; q++) {
+		auto from = userId(rng() % scale), to = userId(rng() % scale);
+		separation.time([&]() { found += sn.degreesOfSeparation(from, to) >= 0; });
+	}
+	for (size_t q = 0; q < queryCount; q++) {
+		auto a = userId(rng() % scale), b = userId(rng() % scale);
+		mutual.time([&]() { found += sn.getMutualFriends(a, b).size(); });
+	}
+	for (size_t q = 0; q < queryCount; q++) {
+		auto id = userId(rng() % scale);
+		pymk.time([&]() { found += sn.peopleYouMayKnow(id).size(); });
+	}
+	results.push_back(summarize(scale, "2 hops (client side)", clientHops));
+	results.push_back(summarize(scale, "getFriendsWithinHops", hops));
+	results.push_back(summarize(scale, "degreesOfSeparation", separation));
+	results.push_back(summarize(scale, "getMutualFriends", mutual));
+	results.push_back(summarize(scale, "peopleYouMayKnow", pymk));
+
+	// Whole graph jobs, once each
+	WorkStealingPool pool;
+	Latencies snapshot, components, degrees, triangles, pageRank;
+	std::unique_ptr<GraphAnalytics> analytics;
+	snapshot.time([&]() { analytics.reset(new GraphAnalytics(sn, pool)); });
+	components.time([&]() { found += analytics->connectedComponents().size(); });
+	degrees.time([&]() { found += analytics->degreeDistribution().size(); });
+	triangles.time([&]() { found += analytics->triangleCount(); });
+	pageRank.time([&]() { found += analytics->pageRank().size(); });
+	results.push_back(summarize(scale, "analytics snapshot", snapshot));
+	results.push_back(summarize(scale, "connectedComponents", components));
+	results.push_back(summarize(scale, "degreeDistribution", degrees));
+	results.push_back(summarize(scale, "triangleCount", triangles));
+	results.push_back(summarize(scale, "pageRank", pageRank));
+
+	std::vector<size_t> ids(scale);
+	for (size_t i = 0; i < scale; i++) {
+		ids[i] = i;
+	}
+	std::shuffle(ids.begin(), ids.end(), rng);
+	ids.resize(std::max<size_t>(1, scale / 10));
+	Latencies remove;
+	for (auto i : ids) {
+		auto id = userId(i);
+		remove.time([&]() { sn.deleteUser(id); });
+	}
+	results.push_back(summarize(scale, "deleteUser", remove));
+	if (found == 0) {
+		std::cout << "\t(no results found)" << std::endl;
+	}
+}
+
+/** runSuite(@scale) in a forked child, so every scale gets its own peak RSS (it never decreases in a process)
+ * @return false if the child could not be run
+ */
+bool runSuiteIsolated(size_t scale, std::vector<SuiteResult> &results)
+{
+	int fds[2];
+	if (::pipe(fds) != 0) {
+		return false;
+	}
+	std::cout.flush();
+	auto pid = ::fork();
+	if (pid < 0) {
+		::close(fds[0]);
+		::close(fds[1]);
+		return false;
+	}
+	if (pid == 0) {
+		::close(fds[0]);
+		std::vector<SuiteResult> own;
+		runSuite(scale, own);
+		std::ostringstream os;
+		os << std::setprecision(17);
+		for (auto const &r : own) {
+			os << r.scale << '\t' << r.op << '\t' << r.count << '\t' << r.throughput << '\t' << r.p50 << '\t' << r.p99
+				<< '\t' << r.rssGrowth << '\n';
+		}
+		auto data = os.str();
+		for (size_t done = 0; done < data.size(); ) {
+			auto n = ::write(fds[1], data.data() + done, data.size() - done);
+			if (n <= 0) {
+				_exit(1);
+			}
+			done += n;
+		}
+		std::cout.flush();
+		_exit(0);
+	}
+
+	::close(fds[1]);
+	std::string data;
+	char buffer[4096];
+	for (ssize_t n; (n = ::read(fds[0], buffer, sizeof(buffer))) > 0; ) {
+		data.append(buffer, n);
+	}
+	::close(fds[0]);
+	int status = 0;
+	::waitpid(pid, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		return false;
+	}
+
+	std::istringstream is(data);
+	for (std::string line; std::getline(is, line); ) {
+		std::istringstream fields(line);
+		SuiteResult r;
+		fields >> r.scale;
+		fields.ignore();
+		std::getline(fields, r.op, '\t');
+		fields >> r.count >> r.throughput >> r.p50 >> r.p99 >> r.rssGrowth;
+		results.push_back(r);
+	}
+	return true;
+}
+
+} // anonymous ns
+
+int main(int argc, char **argv)
+{
+	// [--scale N[,N...]] [--json FILE]: synthetic workload with latency percentiles
+	std::vector<size_t> scales;
+	std::string json;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--scale" && i + 1 < argc) {
+			std::stringstream list(argv[++i]);
+			for (std::string n; std::getline(list, n, ','); ) {
+				scales.push_back(std::stoul(n));
+			}
+		} else if (arg == "--json" && i + 1 < argc) {
+			json = argv[++i];
+		} else {
+			std::cerr << "Usage: " << argv[0] << " [--scale N[,N...]] [--json FILE|-]" << std::endl;
+			return 1;
+		}
+	}
+	if (scales.empty()) {
+		scales = {1000, 100000};
+	}
+
+	std::cout << "Assignment 2 benchmarks ..." << std::endl;
+	std::vector<SuiteResult> results;
+	for (auto scale : scales) {
+		if (!runSuiteIsolated(scale, results)) {
+			std::cerr << "Benchmark of scale " << scale << " failed" << std::endl;
+			return 1;
+		}
+	}
+
+	std::cout << std::left << std::setw(10) << "scale" << std::setw(22) << "op" << std::setw(10) << "count"
+		<< std::setw(14) << "ops/s" << std::setw(10) << "p50 us" << std::setw(10) << "p99 us" << "RSS growth kB" << std::endl;
+	for (auto const &r : results) {
+		std::cout << std::left << std::setw(10) << r.scale << std::setw(22) << r.op << std::setw(10) << r.count
+			<< std::setw(14) << static_cast<long>(r.throughput) << std::setw(10) << r.p50 << std::setw(10) << r.p99
+			<< r.rssGrowth << std::endl;
+	}
+	if (json == "-") {
+		writeJson(std::cout, results);
+	} else if (!json.empty()) {
+		std::ofstream out(json);
+		writeJson(out, results);
+		if (!out) {
+			std::cerr << "Cannot write " << json << std::endl;
+			return 1;
+		}
+	}
+	return 0;
+}
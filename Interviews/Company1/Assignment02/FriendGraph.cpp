@@ -0,0 +1,245 @@
+#include "FriendGraph.h"
+
+#include <algorithm>
+
+
+namespace {
+
+// Direction switching thresholds of the BFS (Beamer et al.): bottom-up once the frontier has more than
+// 1/Alpha of the unexplored edges, unless it has less than 1/Beta of the vertices.
+const size_t Alpha = 14;
+const size_t Beta = 24;
+
+class Bitmap
+{
+public:
+	explicit Bitmap(size_t size) : m_words((size + 63) / 64) {}
+	bool test(UserIndex i) const { return (m_words[i >> 6] >> (i & 63)) & 1; }
+	void set(UserIndex i) { m_words[i >> 6] |= uint64_t(1) << (i & 63); }
+
+private:
+	std::vector<uint64_t> m_words;
+};
+
+} // anonymous ns
+
+
+void FriendGraph::addEdge(UserIndex u, UserIndex v)
+{
+	add(u, v);
+	add(v, u);
+}
+
+void FriendGraph::removeEdge(UserIndex u, UserIndex v)
+{
+	remove(u, v);
+	remove(v, u);
+}
+
+std::vector<UserIndex> FriendGraph::neighbors(UserIndex u) const
+{
+	auto adj = adjacency(u);
+	adj.erase(std::unique(adj.begin(), adj.end()), adj.end());
+	return adj;
+}
+
+size_t FriendGraph::degree(UserIndex u) const
+{
+	size_t d = u + 1 < m_offsets.size() ? m_offsets[u + 1] - m_offsets[u] : 0;
+	if (deltaSize() != 0) {
+		auto added = m_added.find(u);
+		if (added != m_added.end()) {
+			d += added->second.size();
+		}
+		auto removed = m_removed.find(u);
+		if (removed != m_removed.end()) {
+			d -= removed->second.size();
+		}
+	}
+	return d;
+}
+
+void FriendGraph::bfs(const std::vector<UserIndex> &sources, unsigned maxDepth, const Filter &filter, const Visitor &visit) const
+{
+	UserIndex nodes = m_nodes;
+	for (auto s : sources) {
+		nodes = std::max<UserIndex>(nodes, s + 1);
+	}
+	Bitmap visited(nodes);
+	size_t unexplored = size();
+	std::vector<UserIndex> frontier;
+	for (auto s : sources) {
+		if (visited.test(s)) {
+			continue;
+		}
+		visited.set(s);
+		frontier.push_back(s);
+		unexplored -= degree(s);
+		if (!visit(s, 0)) {
+			return;
+		}
+	}
+
+	std::vector<UserIndex> next;
+	for (unsigned depth = 1; depth <= maxDepth && !frontier.empty(); depth++) {
+		size_t frontierEdges = 0;
+		for (auto u : frontier) {
+			frontierEdges += degree(u);
+		}
+		next.clear();
+		bool stopped = false;
+		if (frontierEdges > unexplored / Alpha && frontier.size() > nodes / Beta) {
+			Bitmap inFrontier(nodes);
+			for (auto u : frontier) {
+				inFrontier.set(u);
+			}
+			for (UserIndex v = 0; v < nodes && !stopped; v++) {
+				if (visited.test(v) || !filter(v)) {
+					continue;
+				}
+				bool reached = !forEachNeighbor(v, [&inFrontier](UserIndex w) { return !inFrontier.test(w); });
+				if (reached) {
+					visited.set(v);
+					next.push_back(v);
+					stopped = !visit(v, depth);
+				}
+			}
+		} else {
+			for (auto u : frontier) {
+				stopped = !forEachNeighbor(u, [&](UserIndex w) {
+					if (visited.test(w) || !filter(w)) {
+						return true;
+					}
+					visited.set(w);
+					next.push_back(w);
+					return visit(w, depth);
+				});
+				if (stopped) {
+					break;
+				}
+			}
+		}
+		if (stopped) {
+			return;
+		}
+		for (auto v : next) {
+			unexplored -= degree(v);
+		}
+		frontier.swap(next);
+	}
+}
+
+int FriendGraph::distance(UserIndex from, UserIndex to, unsigned maxDepth, const Filter &filter) const
+{
+	if (from == to) {
+		return 0;
+	}
+	UserIndex nodes = std::max({m_nodes, from + 1, to + 1});
+	Bitmap seen[2] = {Bitmap(nodes), Bitmap(nodes)};
+	std::vector<UserIndex> frontier[2] = {{from}, {to}};
+	seen[0].set(from);
+	seen[1].set(to);
+
+	std::vector<UserIndex> next;
+	for (unsigned depth = 1; depth <= maxDepth && !frontier[0].empty() && !frontier[1].empty(); depth++) {
+		size_t edges[2] = {0, 0};
+		for (int side = 0; side < 2; side++) {
+			for (auto u : frontier[side]) {
+				edges[side] += degree(u);
+			}
+		}
+		int side = edges[0] <= edges[1] ? 0 : 1;
+		next.clear();
+		for (auto u : frontier[side]) {
+			bool met = !forEachNeighbor(u, [&](UserIndex w) {
+				if (seen[side].test(w) || !filter(w)) {
+					return true;
+				}
+				if (seen[1 - side].test(w)) {
+					return false; // Note: w has to be on the other frontier, otherwise the sides met earlier
+				}
+				seen[side].set(w);
+				next.push_back(w);
+				return true;
+			});
+			if (met) {
+				return static_cast<int>(depth);
+			}
+		}
+		frontier[side].swap(next);
+	}
+	return -1;
+}
+
+void FriendGraph::compact()
+{
+	if (deltaSize() == 0) {
+		return;
+	}
+	UserIndex nodes = m_nodes;
+
+	std::vector<uint64_t> offsets;
+	std::vector<UserIndex> targets;
+	offsets.reserve(nodes + 1);
+	targets.reserve(size());
+	offsets.push_back(0);
+	for (UserIndex u = 0; u < nodes; u++) {
+		if (m_added.count(u) || m_removed.count(u)) {
+			auto adj = adjacency(u);
+			targets.insert(targets.end(), adj.begin(), adj.end());
+		} else if (u + 1 < m_offsets.size()) {
+			targets.insert(targets.end(), m_targets.begin() + m_offsets[u], m_targets.begin() + m_offsets[u + 1]);
+		}
+		offsets.push_back(targets.size());
+	}
+	m_offsets = std::move(offsets);
+	m_targets = std::move(targets);
+	m_added.clear();
+	m_removed.clear();
+	m_deltaAdded = m_deltaRemoved = 0;
+}
+
+void FriendGraph::add(UserIndex u, UserIndex v)
+{
+	m_added[u].push_back(v);
+	m_deltaAdded++;
+	m_nodes = std::max<UserIndex>(m_nodes, std::max(u, v) + 1);
+	if (deltaSize() > std::max<size_t>(1024, m_targets.size() / 8)) {
+		compact();
+	}
+}
+
+void FriendGraph::remove(UserIndex u, UserIndex v)
+{
+	m_removed[u].push_back(v);
+	m_deltaRemoved++;
+	if (deltaSize() > std::max<size_t>(1024, m_targets.size() / 8)) {
+		compact();
+	}
+}
+
+std::vector<UserIndex> FriendGraph::adjacency(UserIndex u) const
+{
+	std::vector<UserIndex> adj;
+	if (u + 1 < m_offsets.size()) {
+		adj.assign(m_targets.begin() + m_offsets[u], m_targets.begin() + m_offsets[u + 1]);
+	}
+	auto added = m_added.find(u);
+	if (added != m_added.end()) {
+		auto middle = adj.size();
+		adj.insert(adj.end(), added->second.begin(), added->second.end());
+		std::sort(adj.begin() + middle, adj.end());
+		std::inplace_merge(adj.begin(), adj.begin() + middle, adj.end());
+	}
+	auto removed = m_removed.find(u);
+	if (removed != m_removed.end()) {
+		auto r = removed->second;
+		std::sort(r.begin(), r.end());
+		std::vector<UserIndex> rest;
+		rest.reserve(adj.size());
+		// multiset difference: every removal cancels one occurrence
+		std::set_difference(adj.begin(), adj.end(), r.begin(), r.end(), std::back_inserter(rest));
+		adj.swap(rest);
+	}
+	return adj;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+// Martin Flaska - flegy@flegy.sk / https://www.linkedin.com/in/martinflaska
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+
+/** Dense internal user handle (index into the SocialNetwork tables) */
+typedef uint32_t UserIndex;
+
+/** Undirected friendship multigraph over dense user indexes
+ *
+ * Adjacency lives in a compressed sparse row (CSR) structure: one offsets array and one array
+ * of sorted neighbors, so the neighbors of a user are a single contiguous range. Mutations go
+ * to a small delta buffer (added / removed adjacency entries per user) which is merged into
+ * the CSR arrays once it grows over 1/8 of the edges, so an update is amortized O(1) and reads
+ * stay mostly sequential.
+ *
+ * An edge can be added several times (e.g. both users declare the friendship) and is gone
+ * once it is removed as many times.
+ */
+class FriendGraph
+{
+public:
+	/** Vertices a traversal may reach */
+	typedef std::function<bool(UserIndex)> Filter;
+	/** Called for a reached vertex and its depth, returns false to stop the traversal */
+	typedef std::function<bool(UserIndex, unsigned)> Visitor;
+
+	void addEdge(UserIndex u, UserIndex v);
+	/** Remove one occurrence of the edge (it must be there) */
+	void removeEdge(UserIndex u, UserIndex v);
+
+	/** Sorted distinct neighbors of @u */
+	std::vector<UserIndex> neighbors(UserIndex u) const;
+	/** Call @f for the neighbors of @u (with multiplicity, in no particular order) while it returns true
+	 * @return false if @f stopped the iteration
+	 */
+	template<typename F>
+	bool forEachNeighbor(UserIndex u, F f) const
+	{
+		if (deltaSize() == 0 || (!m_added.count(u) && !m_removed.count(u))) {
+			if (u + 1 < m_offsets.size()) { // Note: the common case, straight from the CSR arrays
+				for (auto i = m_offsets[u]; i < m_offsets[u + 1]; i++) {
+					if (!f(m_targets[i])) {
+						return false;
+					}
+				}
+			}
+			return true;
+		}
+		for (auto v : adjacency(u)) {
+			if (!f(v)) {
+				return false;
+			}
+		}
+		return true;
+	}
+	/** Neighbors of @u with multiplicity */
+	size_t degree(UserIndex u) const;
+	/** Upper bound of the vertices having an edge */
+	UserIndex nodeCount() const { return m_nodes; }
+
+	/** Direction optimizing breadth first search
+	 *
+	 * Levels with a small frontier are expanded top-down (edges of the frontier vertices), once the frontier
+	 * covers a large part of the remaining edges it is cheaper to go bottom-up: every unvisited vertex looks
+	 * for any neighbor in the frontier bitmap and stops at the first one.
+	 *
+	 * @param sources Depth 0 vertices (visited even if @filter rejects them)
+	 * @param maxDepth Vertices further away are not reached
+	 * @param filter Vertices which may be reached (and expanded)
+	 * @param visit Called once per reached vertex, in order of depth
+	 */
+	void bfs(const std::vector<UserIndex> &sources, unsigned maxDepth, const Filter &filter, const Visitor &visit) const;
+	/** Length of the shortest path between @from and @to through the vertices accepted by @filter
+	 *
+	 * Bidirectional BFS, every level expands the side with less frontier edges, so it usually touches about
+	 * the square root of the vertices a one sided BFS would.
+	 *
+	 * @return -1 if there is no path up to @maxDepth
+	 */
+	int distance(UserIndex from, UserIndex to, unsigned maxDepth, const Filter &filter) const;
+
+	/** Merge the delta buffer into the CSR arrays */
+	void compact();
+
+	/** Adjacency entries (2 per edge occurrence) */
+	size_t size() const { return m_targets.size() + m_deltaAdded - m_deltaRemoved; }
+	/** Adjacency entries waiting in the delta buffer */
+	size_t deltaSize() const { return m_deltaAdded + m_deltaRemoved; }
+
+private:
+	void add(UserIndex u, UserIndex v);
+	void remove(UserIndex u, UserIndex v);
+	/** Neighbors of @u with multiplicity (sorted), the delta buffer applied */
+	std::vector<UserIndex> adjacency(UserIndex u) const;
+
+private:
+	std::vector<uint64_t> m_offsets{0}; // neighbors of u are m_targets[m_offsets[u] .. m_offsets[u + 1])
+	std::vector<UserIndex> m_targets;
+	std::unordered_map<UserIndex, std::vector<UserIndex>> m_added;   // unsorted
+	std::unordered_map<UserIndex, std::vector<UserIndex>> m_removed; // unsorted
+	size_t m_deltaAdded = 0;
+	size_t m_deltaRemoved = 0;
+	UserIndex m_nodes = 0;
+};
@@ -0,0 +1,273 @@
+#include "GraphAnalytics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+
+
+namespace {
+
+typedef GraphAnalytics::Vertex Vertex;
+
+const Vertex NoVertex = UINT32_MAX;
+/** Vertices per chunk of the parallel loops (the skewed ones use smaller chunks) */
+const size_t Grain = 1024;
+
+/** Root of @x, halving the path on the way (lock-free, concurrent links are fine) */
+Vertex findRoot(std::atomic<Vertex> *parent, Vertex x)
+{
+	for (;;) {
+		auto p = parent[x].load(std::memory_order_acquire);
+		if (p == x) {
+			return x;
+		}
+		auto gp = parent[p].load(std::memory_order_acquire);
+		if (gp != p) {
+			parent[x].compare_exchange_weak(p, gp, std::memory_order_acq_rel);
+		}
+		x = gp;
+	}
+}
+
+} // anonymous ns
+
+GraphAnalytics::GraphAnalytics(const SocialNetwork &network, WorkStealingPool &pool)
+	: m_network(network)
+	, m_pool(pool)
+{
+	auto const &users = network.m_users;
+	std::vector<Vertex> vertexOf(users.size(), NoVertex);
+	for (UserIndex i = 0; i < users.size(); i++) {
+		if (users[i]) {
+			vertexOf[i] = static_cast<Vertex>(m_users.size());
+			m_users.push_back(i);
+		}
+	}
+
+	auto neighbors = [&](Vertex v, std::vector<Vertex> &out) {
+		out.clear();
+		network.m_friends.forEachNeighbor(m_users[v], [&](UserIndex w) {
+			auto x = vertexOf[w];
+			if (x != NoVertex && x != v) {
+				out.push_back(x);
+			}
+			return true;
+		});
+		std::sort(out.begin(), out.end());
+		out.erase(std::unique(out.begin(), out.end()), out.end());
+	};
+
+	// Two passes (degrees, then neighbors into their final place) instead of keeping all the lists around
+	const size_t n = m_users.size();
+	m_offsets.assign(n + 1, 0);
+	pool.parallelFor(n, Grain, [&](size_t begin, size_t end, unsigned) {
+		std::vector<Vertex> buffer;
+		for (auto v = begin; v < end; v++) {
+			neighbors(static_cast<Vertex>(v), buffer);
+			m_offsets[v + 1] = buffer.size();
+		}
+	});
+	for (size_t v = 0; v < n; v++) {
+		m_offsets[v + 1] += m_offsets[v];
+	}
+	m_targets.resize(m_offsets[n]);
+	pool.parallelFor(n, Grain, [&](size_t begin, size_t end, unsigned) {
+		std::vector<Vertex> buffer;
+		for (auto v = begin; v < end; v++) {
+			neighbors(static_cast<Vertex>(v), buffer);
+			std::copy(buffer.begin(), buffer.end(), m_targets.begin() + m_offsets[v]);
+		}
+	});
+}
+
+const ID &GraphAnalytics::id(Vertex v) const
+{
+	return m_network.m_ids[m_users[v]];
+}
+
+std::vector<Vertex> GraphAnalytics::connectedComponents() const
+{
+	// Concurrent union-find: a root is always linked below a smaller root, so the final root of a component
+	// is its smallest vertex
+	const size_t n = vertexCount();
+	std::unique_ptr<std::atomic<Vertex>[]> parent(new std::atomic<Vertex>[n]);
+	m_pool.parallelFor(n, Grain, [&](size_t begin, size_t end, unsigned) {
+		for (auto v = begin; v < end; v++) {
+			parent[v].store(static_cast<Vertex>(v), std::memory_order_relaxed);
+		}
+	});
+	m_pool.parallelFor(n, Grain, [&](size_t begin, size_t end, unsigned) {
+		for (auto v = begin; v < end; v++) {
+			for (auto i = m_offsets[v]; i < m_offsets[v + 1]; i++) {
+				auto w = m_targets[i];
+				if (w < v) {
+					continue; // every edge once
+				}
+				for (;;) {
+					auto a = findRoot(parent.get(), static_cast<Vertex>(v));
+					auto b = findRoot(parent.get(), w);
+					if (a == b) {
+						break;
+					}
+					if (a < b) {
+						std::swap(a, b);
+					}
+					auto expected = a;
+					if (parent[a].compare_exchange_strong(expected, b, std::memory_order_acq_rel)) {
+						break;
+					}
+				}
+			}
+		}
+	});
+
+	std::vector<Vertex> labels(n);
+	m_pool.parallelFor(n, Grain, [&](size_t begin, size_t end, unsigned) {
+		for (auto v = begin; v < end; v++) {
+			labels[v] = findRoot(parent.get(), static_cast<Vertex>(v));
+		}
+	});
+	return labels;
+}
+
+std::vector<uint64_t> GraphAnalytics::degreeDistribution() const
+{
+	std::vector<std::vector<uint64_t>> local(m_pool.size());
+	m_pool.parallelFor(vertexCount(), Grain, [&](size_t begin, size_t end, unsigned worker) {
+		auto &counts = local[worker];
+		for (auto v = begin; v < end; v++) {
+			auto d = degree(static_cast<Vertex>(v));
+			if (d >= counts.size()) {
+				counts.resize(d + 1);
+			}
+			counts[d]++;
+		}
+	});
+
+	std::vector<uint64_t> counts;
+	for (auto const &l : local) {
+		if (l.size() > counts.size()) {
+			counts.resize(l.size());
+		}
+		for (size_t d = 0; d < l.size(); d++) {
+			counts[d] += l[d];
+		}
+	}
+	return counts;
+}
+
+uint64_t GraphAnalytics::triangleCount() const
+{
+	// Orient every edge towards the vertex of higher (degree, index) rank, a triangle is then counted once,
+	// at its lowest vertex, and the lists left to intersect are short even for the hubs
+	const size_t n = vertexCount();
+	auto higher = [this](Vertex v, Vertex w) {
+		auto dv = degree(v), dw = degree(w);
+		return dw > dv || (dw == dv && w > v);
+	};
+	std::vector<uint64_t> offsets(n + 1, 0);
+	m_pool.parallelFor(n, Grain, [&](size_t begin, size_t end, unsigned) {
+		for (auto v = begin; v < end; v++) {
+			for (auto i = m_offsets[v]; i < m_offsets[v + 1]; i++) {
+				offsets[v + 1] += higher(static_cast<Vertex>(v), m_targets[i]);
+			}
+		}
+	});
+	for (size_t v = 0; v < n; v++) {
+		offsets[v + 1] += offsets[v];
+	}
+	std::vector<Vertex> targets(offsets[n]);
+	m_pool.parallelFor(n, Grain, [&](size_t begin, size_t end, unsigned) {
+		for (auto v = begin; v < end; v++) {
+			auto out = targets.begin() + offsets[v];
+			for (auto i = m_offsets[v]; i < m_offsets[v + 1]; i++) {
+				if (higher(static_cast<Vertex>(v), m_targets[i])) {
+					*out++ = m_targets[i]; // still sorted
+				}
+			}
+		}
+	});
+
+	std::vector<uint64_t> local(m_pool.size());
+	m_pool.parallelFor(n, Grain / 16, [&](size_t begin, size_t end, unsigned worker) {
+		uint64_t triangles = 0;
+		for (auto u = begin; u < end; u++) {
+			for (auto i = offsets[u]; i < offsets[u + 1]; i++) {
+				auto v = targets[i];
+				// |out(u) & out(v)|
+				auto a = targets.begin() + offsets[u], aEnd = targets.begin() + offsets[u + 1];
+				auto b = targets.begin() + offsets[v], bEnd = targets.begin() + offsets[v + 1];
+				while (a != aEnd && b != bEnd) {
+					if (*a < *b) {
+						++a;
+					} else if (*b < *a) {
+						++b;
+					} else {
+						triangles++;
+						++a;
+						++b;
+					}
+				}
+			}
+		}
+		local[worker] += triangles;
+	});
+
+	uint64_t triangles = 0;
+	for (auto t : local) {
+		triangles += t;
+	}
+	return triangles;
+}
+
+std::vector<double> GraphAnalytics::pageRank(double damping, unsigned maxIterations, double tolerance) const
+{
+	const size_t n = vertexCount();
+	if (n == 0) {
+		return std::vector<double>();
+	}
+	std::vector<double> rank(n, 1.0 / n), next(n), contribution(n);
+	std::vector<double> dangling(m_pool.size()), change(m_pool.size());
+	for (unsigned iteration = 0; iteration < maxIterations; iteration++) {
+		// Pull based: every vertex sums up its neighbors, so there are no concurrent writes
+		std::fill(dangling.begin(), dangling.end(), 0.0);
+		m_pool.parallelFor(n, Grain, [&](size_t begin, size_t end, unsigned worker) {
+			for (auto v = begin; v < end; v++) {
+				auto d = degree(static_cast<Vertex>(v));
+				contribution[v] = d ? rank[v] / d : 0.0;
+				if (d == 0) {
+					dangling[worker] += rank[v];
+				}
+			}
+		});
+		double lost = 0;
+		for (auto d : dangling) {
+			lost += d;
+		}
+		// users without friends spread their rank evenly
+		const double base = (1.0 - damping) / n + damping * lost / n;
+
+		std::fill(change.begin(), change.end(), 0.0);
+		m_pool.parallelFor(n, Grain, [&](size_t begin, size_t end, unsigned worker) {
+			for (auto v = begin; v < end; v++) {
+				double sum = 0;
+				for (auto i = m_offsets[v]; i < m_offsets[v + 1]; i++) {
+					sum += contribution[m_targets[i]];
+				}
+				next[v] = base + damping * sum;
+				change[worker] += std::fabs(next[v] - rank[v]);
+			}
+		});
+		rank.swap(next);
+
+		double total = 0;
+		for (auto c : change) {
+			total += c;
+		}
+		if (total < tolerance) {
+			break;
+		}
+	}
+	return rank;
+}
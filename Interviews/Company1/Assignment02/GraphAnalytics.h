@@ -0,0 +1,51 @@
+#pragma once
+
+// Martin Flaska - flegy@flegy.sk / https://www.linkedin.com/in/martinflaska
+
+#include <cstdint>
+#include <vector>
+
+#include "SocialNetwork.h"
+#include "WorkStealingPool.h"
+
+
+/** Whole graph analytics of the friendship graph of a SocialNetwork
+ *
+ * The constructor takes a snapshot of the friendships between added users: vertices are the users renumbered
+ * densely in the order of their internal index, edges are distinct friendships (no self loops), stored as one
+ * CSR array of sorted neighbors. All the algorithms are parallel loops over vertex ranges of the pool, so each
+ * worker walks the arrays sequentially.
+ *
+ * @note The network must outlive the object (for id()), later changes of the network are not seen.
+ */
+class GraphAnalytics
+{
+public:
+	typedef uint32_t Vertex;
+
+	GraphAnalytics(const SocialNetwork &network, WorkStealingPool &pool);
+
+	size_t vertexCount() const { return m_offsets.size() - 1; }
+	/** Distinct friendships */
+	size_t edgeCount() const { return m_targets.size() / 2; }
+	const ID &id(Vertex v) const;
+	size_t degree(Vertex v) const { return m_offsets[v + 1] - m_offsets[v]; }
+
+	/** Connected component of every vertex, labeled by its smallest vertex */
+	std::vector<Vertex> connectedComponents() const;
+	/** Number of vertices of every degree (index) */
+	std::vector<uint64_t> degreeDistribution() const;
+	/** Triangles (3 users being friends of each other) in the whole graph */
+	uint64_t triangleCount() const;
+	/** PageRank (influence) of every vertex, the scores sum up to 1
+	 * @param tolerance Stop once the L1 change of an iteration is smaller
+	 */
+	std::vector<double> pageRank(double damping = 0.85, unsigned maxIterations = 50, double tolerance = 1e-6) const;
+
+private:
+	const SocialNetwork &m_network;
+	WorkStealingPool &m_pool;
+	std::vector<UserIndex> m_users;  // vertex -> SocialNetwork index
+	std::vector<uint64_t> m_offsets; // neighbors of v are m_targets[m_offsets[v] .. m_offsets[v + 1])
+	std::vector<Vertex> m_targets;
+};
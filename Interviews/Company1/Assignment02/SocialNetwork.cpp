@@ -1,5 +1,38 @@
 #include "SocialNetwork.h"
 
+#include <algorithm>
+#include <iterator>
+
+
+namespace {
+
+/** Forward only membership test of a sorted list (for increasing values) */
+class Probe
+{
+public:
+	explicit Probe(const std::vector<UserIndex> &list) : m_list(list) {}
+
+	bool contains(UserIndex value)
+	{
+		// Gallop to a window holding @value, then binary search in it
+		size_t step = 1, low = m_pos;
+		while (m_pos < m_list.size() && m_list[m_pos] < value) {
+			low = m_pos;
+			m_pos = std::min(m_list.size(), m_pos + step);
+			step *= 2;
+		}
+		m_pos = std::lower_bound(m_list.begin() + low, m_list.begin() + m_pos, value) - m_list.begin();
+		return m_pos < m_list.size() && m_list[m_pos] == value;
+	}
+
+private:
+	const std::vector<UserIndex> &m_list;
+	size_t m_pos = 0;
+};
+
+} // anonymous ns
+
+
 void User::setName(const std::string &name)
 {
 	if (name.empty()) {
@@ -33,108 +66,451 @@ void User::setId(const ID& id)
 }
 
 
+void UserQuery::setName(const std::string &name)
+{
+	if (name.empty()) {
+		throw std::invalid_argument("Empty name.");
+	}
+	m_name = name;
+}
+
+void UserQuery::setAgeRange(uint8_t min, uint8_t max)
+{
+	if (min > max) {
+		throw std::invalid_argument("Invalid age range");
+	}
+	m_hasAge = true;
+	m_minAge = std::max<uint8_t>(min, 1); // 0 is not provided
+	m_maxAge = max;
+}
+
+void UserQuery::setHeightRange(uint8_t min, uint8_t max)
+{
+	if (min > max) {
+		throw std::invalid_argument("Invalid height range");
+	}
+	m_hasHeight = true;
+	m_minHeight = std::max<uint8_t>(min, 1);
+	m_maxHeight = max;
+}
+
+void UserQuery::setGender(Gender gender)
+{
+	m_gender = gender;
+}
+
+void UserQuery::setHobbies(const std::set<std::string> &hobbies, size_t atLeast)
+{
+	m_hobbies = hobbies;
+	m_atLeast = std::max<size_t>(1, std::min(atLeast, hobbies.size()));
+}
+
+
 void SocialNetwork::addUser(const User& user)
 {
 	auto id = user.id();
 	assert(!id.empty());
 
-	auto it = m_users.find(id);
-	if (it != m_users.end()) {
-		auto usr = *(it->second);
-		if (usr.name() != user.name()) {
+	auto index = indexOf(id);
+	if (m_users[index]) {
+		if (m_users[index]->name() != user.name()) {
 			throw std::invalid_argument("Another user with that ID already exists");
 		}
 		return; // No insertion, same user (id/name) already added
 	}
 
-	m_users.insert({id, std::make_shared<User>(user)});
+	auto usr = std::make_shared<User>(user);
+	assert(!usr->name().empty());
 
-	auto name = user.name();
-	assert(!name.empty());
+	insertIndex(m_nameIndex[usr->name()], index);
+	insertIndex(m_ageIndex[usr->age()], index);
+	for (auto const &hoby : usr->hobbies()) {
+		insertIndex(m_hobbiesIndex[hoby], index);
+	}
+	for (auto const &fId : usr->friends()) {
+		m_friends.addEdge(index, indexOf(fId));
+	}
 
-	m_nameIdMap.insert({name, id});
+	m_ages[index] = usr->age();
+	m_heights[index] = usr->height();
+	m_genders[index] = usr->gender();
+	m_users[index] = std::move(usr);
+	m_userCount++;
+}
 
-	m_ageIdMap.insert({user.age(), id});
+void SocialNetwork::deleteUser(const ID& id)
+{
+	auto index = userIndex(id);
+	auto const &usr = *m_users[index];
 
-	auto hobbies = user.hobbies();
+	eraseIndex(m_nameIndex, usr.name(), index);
+	eraseIndex(m_ageIndex[usr.age()], index);
+	for (auto const &hoby : usr.hobbies()) {
+		eraseIndex(m_hobbiesIndex, hoby, index);
+	}
+	std::vector<UserIndex> released{index};
+	for (auto const &fId : usr.friends()) {
+		auto f = m_indexes.at(fId);
+		m_friends.removeEdge(index, f);
+		released.push_back(f);
+	}
+
+	m_users[index].reset();
+	m_userCount--;
+	// Note: the user and the friends it was the last one to refer to are not needed anymore
+	for (auto i : released) {
+		releaseIndex(i);
+	}
+}
+
+User SocialNetwork::getUser(const ID &id) const
+{
+	return *m_users[userIndex(id)];
+}
+
+SocialNetwork::SharedUserList SocialNetwork::searchUserByHobbies(const std::set<std::string> &hobbies, size_t atLeast) const
+{
+	static const UserIndexList none;
+	std::vector<const UserIndexList*> lists;
 	for (auto const &hoby : hobbies) {
-		m_hobbiesMap.insert({hoby, id});
+		auto it = m_hobbiesIndex.find(hoby);
+		lists.push_back(it == m_hobbiesIndex.end() ? &none : &it->second);
 	}
+	return usersOf(matchAtLeast(lists, std::max<size_t>(atLeast, 1)));
+}
 
-	auto friendIDs = user.friends();
-	for (auto const &fId : friendIDs) {
-		m_friendsMap.insert({fId, id});
+SocialNetwork::QueryPlan SocialNetwork::planQuery(const UserQuery &query) const
+{
+	QueryPlan plan = {QueryPlan::Scan, m_users.size()};
+	auto cost = m_users.size() / 4;
+	auto consider = [&plan, &cost](QueryPlan::Access access, size_t estimate, size_t accessCost) {
+		if (accessCost < cost) {
+			plan = {access, estimate};
+			cost = accessCost;
+		}
+	};
+
+	if (!query.m_name.empty()) {
+		auto it = m_nameIndex.find(query.m_name);
+		consider(QueryPlan::Name, it == m_nameIndex.end() ? 0 : it->second.size(), it == m_nameIndex.end() ? 0 : it->second.size());
+	}
+	if (query.m_hasAge) {
+		size_t estimate = 0, lists = 0;
+		for (unsigned age = query.m_minAge; age <= query.m_maxAge; age++) {
+			estimate += m_ageIndex[age].size();
+			lists += !m_ageIndex[age].empty();
+		}
+		// more than one list has to be sorted
+		consider(QueryPlan::Age, estimate, lists > 1 ? estimate * 2 : estimate);
 	}
+	if (!query.m_hobbies.empty()) {
+		// Candidates come from the (count - atLeast + 1) shortest lists (see matchAtLeast)
+		std::vector<size_t> sizes;
+		for (auto const &hoby : query.m_hobbies) {
+			auto it = m_hobbiesIndex.find(hoby);
+			sizes.push_back(it == m_hobbiesIndex.end() ? 0 : it->second.size());
+		}
+		std::sort(sizes.begin(), sizes.end());
+		size_t estimate = 0;
+		for (size_t i = 0; i < sizes.size() - query.m_atLeast + 1; i++) {
+			estimate += sizes[i];
+		}
+		consider(QueryPlan::Hobbies, estimate, estimate);
+	}
+	return plan;
 }
 
-void SocialNetwork::deleteUser(const ID& id)
+SocialNetwork::SharedUserList SocialNetwork::searchUsers(const UserQuery &query) const
 {
-	auto it = m_users.find(id);
-	if (it == m_users.end()) { // map::contains is not available until c++20...
-		// not removed / invalid ID
-		throw std::invalid_argument("Not existing user/ID");
+	static const UserIndexList none;
+	auto listOf = [](const StringIndexMap &map, const std::string &key) -> const UserIndexList& {
+		auto it = map.find(key);
+		return it == map.end() ? none : it->second;
+	};
+
+	auto plan = planQuery(query);
+	UserIndexList candidates;
+	switch (plan.access) {
+	case QueryPlan::Scan:
+		for (UserIndex index = 0; index < m_users.size(); index++) {
+			if (isUser(index)) {
+				candidates.push_back(index);
+			}
+		}
+		break;
+	case QueryPlan::Name:
+		candidates = listOf(m_nameIndex, query.m_name);
+		break;
+	case QueryPlan::Age:
+		for (unsigned age = query.m_minAge; age <= query.m_maxAge; age++) {
+			candidates.insert(candidates.end(), m_ageIndex[age].begin(), m_ageIndex[age].end());
+		}
+		std::sort(candidates.begin(), candidates.end());
+		break;
+	case QueryPlan::Hobbies: {
+		std::vector<const UserIndexList*> lists;
+		for (auto const &hoby : query.m_hobbies) {
+			lists.push_back(&listOf(m_hobbiesIndex, hoby));
+		}
+		candidates = matchAtLeast(lists, query.m_atLeast);
+		break;
+	}
 	}
 
-	removeMapItems(m_nameIdMap, it->second->name(), id);
-	removeMapItems(m_ageIdMap, it->second->age(), id);
+	// The remaining predicates, candidates are sorted so the lists are probed forward only
+	const bool byName = !query.m_name.empty() && plan.access != QueryPlan::Name;
+	const bool byAge = query.m_hasAge && plan.access != QueryPlan::Age;
+	const bool byHobbies = !query.m_hobbies.empty() && plan.access != QueryPlan::Hobbies;
+	Probe name(listOf(m_nameIndex, query.m_name));
+	std::vector<Probe> hobbies;
+	if (byHobbies) {
+		for (auto const &hoby : query.m_hobbies) {
+			hobbies.emplace_back(listOf(m_hobbiesIndex, hoby));
+		}
+	}
 
-	auto hobbies = it->second->hobbies();
-	for (auto const &hoby : hobbies) {
-		removeMapItems(m_hobbiesMap, hoby, id);
+	UserIndexList matches;
+	for (auto index : candidates) {
+		if (byAge && (m_ages[index] < query.m_minAge || m_ages[index] > query.m_maxAge)) {
+			continue;
+		}
+		if (query.m_hasHeight && (m_heights[index] < query.m_minHeight || m_heights[index] > query.m_maxHeight)) {
+			continue;
+		}
+		if (query.m_gender != Gender::unknown && m_genders[index] != query.m_gender) {
+			continue;
+		}
+		if (byName && !name.contains(index)) {
+			continue;
+		}
+		if (byHobbies) {
+			size_t count = 0;
+			for (size_t h = 0; h < hobbies.size() && count < query.m_atLeast; h++) {
+				count += hobbies[h].contains(index);
+			}
+			if (count < query.m_atLeast) {
+				continue;
+			}
+		}
+		matches.push_back(index);
 	}
+	return usersOf(matches);
+}
 
-	auto friendIDs = it->second->friends();
-	for (auto const &fId : friendIDs) {
-		removeMapItems(m_friendsMap, fId, id);
+std::set<ID> SocialNetwork::getFriendsOfUser(const ID& id) const
+{
+	// User's own friends and other users which reffer to the same user are both edges of the user
+	std::set<ID> ret;
+	for (auto f : m_friends.neighbors(userIndex(id))) {
+		ret.insert(m_ids[f]);
 	}
+	return ret;
+}
 
-	m_users.erase(it);
+std::set<ID> SocialNetwork::getFriendsWithinHops(const ID &id, unsigned hops, size_t limit) const
+{
+	std::set<ID> ret;
+	if (limit == 0) {
+		userIndex(id); // check the ID anyway
+		return ret;
+	}
+	m_friends.bfs({userIndex(id)}, hops, [this](UserIndex v) { return isUser(v); }, [&](UserIndex v, unsigned depth) {
+		if (depth > 0) {
+			ret.insert(m_ids[v]);
+		}
+		return ret.size() < limit;
+	});
+	return ret;
 }
 
-User SocialNetwork::getUser(const ID &id) const
+int SocialNetwork::degreesOfSeparation(const ID &from, const ID &to, unsigned maxHops) const
 {
-	auto it = m_users.find(id);
-	if (it == m_users.end()) {
-		// not existig / invalid ID
-		throw std::invalid_argument("Not existing user/ID");
+	return m_friends.distance(userIndex(from), userIndex(to), maxHops, [this](UserIndex v) { return isUser(v); });
+}
+
+std::set<ID> SocialNetwork::getMutualFriends(const ID &a, const ID &b) const
+{
+	auto friendsA = m_friends.neighbors(userIndex(a));
+	auto friendsB = m_friends.neighbors(userIndex(b));
+	std::set<ID> ret;
+	auto itB = friendsB.begin();
+	for (auto f : friendsA) {
+		itB = std::lower_bound(itB, friendsB.end(), f);
+		if (itB != friendsB.end() && *itB == f) {
+			ret.insert(m_ids[f]);
+		}
+	}
+	return ret;
+}
+
+std::vector<std::pair<ID, size_t>> SocialNetwork::peopleYouMayKnow(const ID &id, size_t limit) const
+{
+	auto index = userIndex(id);
+	auto friends = m_friends.neighbors(index);
+	std::unordered_map<UserIndex, size_t> mutual;
+	for (auto f : friends) {
+		if (!isUser(f)) {
+			continue;
+		}
+		for (auto c : m_friends.neighbors(f)) {
+			if (c != index && isUser(c) && !std::binary_search(friends.begin(), friends.end(), c)) {
+				mutual[c]++;
+			}
+		}
 	}
 
-	return *(it->second);
+	std::vector<std::pair<ID, size_t>> ret;
+	ret.reserve(mutual.size());
+	for (auto const &kv : mutual) {
+		ret.emplace_back(m_ids[kv.first], kv.second);
+	}
+	auto byMutual = [](const std::pair<ID, size_t> &x, const std::pair<ID, size_t> &y) {
+		return x.second != y.second ? x.second > y.second : x.first < y.first;
+	};
+	if (ret.size() > limit) {
+		std::partial_sort(ret.begin(), ret.begin() + limit, ret.end(), byMutual);
+		ret.resize(limit);
+	} else {
+		std::sort(ret.begin(), ret.end(), byMutual);
+	}
+	return ret;
 }
 
-SocialNetwork::SharedUserList SocialNetwork::searchUserByHobbies(const std::set<std::string> &hobbies) const
+UserIndex SocialNetwork::indexOf(const ID &id)
 {
-	SocialNetwork::SharedUserList list;
-	for (auto const &hoby : hobbies) {
-		list.merge(searchUser(m_hobbiesMap, hoby));
+	auto it = m_indexes.find(id);
+	if (it != m_indexes.end()) {
+		return it->second;
+	}
+	if (!m_freeIndexes.empty()) {
+		auto index = m_freeIndexes.back();
+		m_freeIndexes.pop_back();
+		m_indexes.emplace(id, index);
+		m_ids[index] = id;
+		return index;
+	}
+	if (m_ids.size() > UINT32_MAX) {
+		throw std::length_error("Too many user IDs");
 	}
-	return list;
+	auto index = static_cast<UserIndex>(m_ids.size());
+	m_indexes.emplace(id, index);
+	m_ids.push_back(id);
+	m_users.emplace_back();
+	m_ages.push_back(0);
+	m_heights.push_back(0);
+	m_genders.push_back(Gender::unknown);
+	return index;
 }
 
-std::set<ID> SocialNetwork::getFriendsOfUser(const ID& id) const
+void SocialNetwork::releaseIndex(UserIndex index)
 {
-	std::set<ID> ret;
+	if (m_ids[index].empty() || isUser(index) || m_friends.degree(index) != 0) {
+		return; // already free or still in use
+	}
+	m_indexes.erase(m_ids[index]);
+	ID().swap(m_ids[index]);
+	m_freeIndexes.push_back(index);
+}
 
-	auto search = m_users.find(id);
-	if (search == m_users.end()) {
+UserIndex SocialNetwork::userIndex(const ID &id) const
+{
+	auto it = m_indexes.find(id);
+	if (it == m_indexes.end() || !m_users[it->second]) {
 		// not existig / invalid ID
 		throw std::invalid_argument("Not existing user/ID");
 	}
+	return it->second;
+}
 
-	// Start with user's own users,
-	ret = (*(search->second)).friends();
+void SocialNetwork::insertIndex(UserIndexList &list, UserIndex index)
+{
+	// Note: new users get the highest index, so this is mostly an append
+	if (list.empty() || list.back() < index) {
+		list.push_back(index);
+		return;
+	}
+	auto it = std::lower_bound(list.begin(), list.end(), index);
+	if (it == list.end() || *it != index) {
+		list.insert(it, index);
+	}
+}
 
-	// ... and append other users which reffer to the same user.
-	auto range = m_friendsMap.equal_range(id);
+void SocialNetwork::eraseIndex(UserIndexList &list, UserIndex index)
+{
+	auto it = std::lower_bound(list.begin(), list.end(), index);
+	if (it != list.end() && *it == index) {
+		list.erase(it);
+	}
+}
+
+void SocialNetwork::eraseIndex(StringIndexMap &map, const std::string &key, UserIndex index)
+{
+	auto it = map.find(key);
+	if (it == map.end()) {
+		return;
+	}
+	eraseIndex(it->second, index);
+	if (it->second.empty()) {
+		map.erase(it);
+	}
+}
 
-	if (range.first == m_friendsMap.end()) {
-		return ret; // no other records
+SocialNetwork::UserIndexList SocialNetwork::matchAtLeast(std::vector<const UserIndexList*> lists, size_t atLeast)
+{
+	if (atLeast > lists.size()) {
+		return UserIndexList();
 	}
+	std::sort(lists.begin(), lists.end(), [](const UserIndexList *a, const UserIndexList *b) {
+		return a->size() < b->size();
+	});
 
-	for (auto it = range.first; it != range.second; ++it) {
-		auto id_ = it->second;
-		ret.insert(id_);
+	// Candidates (with their counts) come from the shortest lists only
+	const size_t merged = lists.size() - atLeast + 1;
+	std::vector<std::pair<UserIndex, size_t>> candidates;
+	for (size_t i = 0; i < merged; i++) {
+		std::vector<std::pair<UserIndex, size_t>> next;
+		next.reserve(candidates.size() + lists[i]->size());
+		auto c = candidates.begin();
+		for (auto index : *lists[i]) {
+			for (; c != candidates.end() && c->first < index; ++c) {
+				next.push_back(*c);
+			}
+			if (c != candidates.end() && c->first == index) {
+				next.emplace_back(index, c->second + 1);
+				++c;
+			} else {
+				next.emplace_back(index, 1);
+			}
+		}
+		next.insert(next.end(), c, candidates.end());
+		candidates.swap(next);
 	}
 
+	std::vector<Probe> probes;
+	for (size_t i = merged; i < lists.size(); i++) {
+		probes.emplace_back(*lists[i]);
+	}
+	UserIndexList ret;
+	for (auto const &c : candidates) {
+		auto count = c.second;
+		for (size_t p = 0; p < probes.size() && count < atLeast; p++) {
+			if (count + (probes.size() - p) < atLeast) {
+				break; // not enough lists left
+			}
+			count += probes[p].contains(c.first);
+		}
+		if (count >= atLeast) {
+			ret.push_back(c.first);
+		}
+	}
 	return ret;
 }
+
+SocialNetwork::SharedUserList SocialNetwork::usersOf(const UserIndexList &list) const
+{
+	SocialNetwork::SharedUserList users;
+	for (auto index : list) {
+		users.push_back(m_users[index]);
+	}
+	return users;
+}
@@ -30,6 +30,9 @@
 
 // Martin Flaska - flegy@flegy.sk / https://www.linkedin.com/in/martinflaska
 
+#include <array>
+#include <climits>
+#include <cstdint>
 #include <iomanip>
 #include <iostream>
 #include <list>
@@ -37,12 +40,17 @@
 #include <memory>
 #include <set>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include <cassert>
 
+#include "FriendGraph.h"
+
 enum class Gender {
 	male,
-	female
+	female,
+	unknown ///< not provided
 };
 
 typedef std::string ID;
@@ -72,10 +80,12 @@ public:
 
 	/** Set age (years) */
 	void setAge(uint8_t age);
+	/** Age (years), 0 if not provided */
 	uint8_t age() const { return m_age; }
 
 	/** Set height (cm) */
 	void setHeight(uint8_t height);
+	/** Height (cm), 0 if not provided */
 	uint8_t height() const { return m_height; }
 
 	void setHobbies(const std::set<std::string> &hobbies) { m_hobbies = hobbies; }
@@ -92,16 +102,60 @@ public:
 
 private:
 	std::string m_name;
-	uint8_t m_age; ///< years
-	uint8_t m_height; ///< cm
+	uint8_t m_age = 0; ///< years
+	uint8_t m_height = 0; ///< cm
 	std::set<std::string> m_hobbies;
-	Gender m_gender;
+	Gender m_gender = Gender::unknown;
 	ID m_id;
 	std::set<ID> m_friends;
 };
 
+/** Predicates of SocialNetwork::searchUsers, a user has to match all the ones set
+ *
+ * @note Users who did not provide the age / height / gender never match a predicate on it.
+ */
+class UserQuery
+{
+	friend class SocialNetwork;
+
+public:
+	void setName(const std::string &name);
+	/** Age between @min and @max years (inclusive) */
+	void setAgeRange(uint8_t min, uint8_t max);
+	/** Height between @min and @max cm (inclusive) */
+	void setHeightRange(uint8_t min, uint8_t max);
+	void setGender(Gender gender);
+	/** At least @atLeast of @hobbies (all of them by default, 0 works as 1) */
+	void setHobbies(const std::set<std::string> &hobbies, size_t atLeast = SIZE_MAX);
+
+private:
+	std::string m_name; ///< empty if not set
+	bool m_hasAge = false;
+	uint8_t m_minAge = 0;
+	uint8_t m_maxAge = 0;
+	bool m_hasHeight = false;
+	uint8_t m_minHeight = 0;
+	uint8_t m_maxHeight = 0;
+	Gender m_gender = Gender::unknown; ///< unknown if not set
+	std::set<std::string> m_hobbies;
+	size_t m_atLeast = 0;
+};
+
+/** Users by ID with name / age / hobby lookups and the friendship graph
+ *
+ * Every ID (of a user or of a friend referred to by a user, which does not have to be added yet) is mapped to a
+ * dense UserIndex once, so the per-user tables are plain vectors and the lookup lists and the friendship graph
+ * store 4 byte integers instead of the strings. The external ID is resolved just once per call.
+ *
+ * @note A deleted user keeps its index as long as other users refer to it as a friend, so do their edges (and a user
+ * re-added with the same ID gets them back). Once an index is neither a user nor anyone's friend it goes to a free
+ * list and is handed out to the next new ID, so the tables are as large as the most IDs known at once, not as all
+ * the IDs ever seen.
+ */
 class SocialNetwork
 {
+	friend class GraphAnalytics; // snapshots the friendship graph
+
 public:
 	void addUser(const User &user);
 	//void addUser(User &&user); // in a case we want do even better memory optimization...
@@ -109,19 +163,42 @@ public:
 	void deleteUser(const ID &id);
 	void deleteUser(const User &user) { deleteUser(user.id()); } // Convenience / overloaded method
 	User getUser(const ID &id) const;
-	int userCount() const { return m_users.size(); }
+	int userCount() const { return m_userCount; }
+	/** Size of the per-index tables (indexes in use plus the free ones) */
+	size_t indexCapacity() const { return m_ids.size(); }
 
 	typedef std::list<std::shared_ptr<User>> SharedUserList;
 
+	/** How many of the searched values a user has to have */
+	enum class Match {
+		All,
+		Any
+	};
+
 	/** Lookup methods
 	 *
 	 * @note Returned list is optimized to save memory and to not copy & pase User data from the user map (using shared_ptr)
 	 *
 	 * @{
 	 */
-	SharedUserList searchUserByName(const std::string &name) const { return searchUser(m_nameIdMap, name); }
-	SharedUserList searchUserByAge(uint8_t age) const { return searchUser(m_ageIdMap, age); }
-	SharedUserList searchUserByHobbies(const std::set<std::string> &hobbies) const;
+	SharedUserList searchUserByName(const std::string &name) const { return searchUser(m_nameIndex, name); }
+	SharedUserList searchUserByAge(uint8_t age) const { return usersOf(m_ageIndex[age]); }
+	/** Users having all (or any) of @hobbies, no hobbies match nobody */
+	SharedUserList searchUserByHobbies(const std::set<std::string> &hobbies, Match match = Match::All) const
+	{
+		return searchUserByHobbies(hobbies, match == Match::All ? hobbies.size() : 1);
+	}
+	/** Users having at least @atLeast of @hobbies (0 works as 1)
+	 *
+	 * @note The hobby lists are sorted user indexes, a match has to be in at least one of the (count - atLeast + 1)
+	 * shortest lists. Only those are merged, the longer ones are just probed by galloping search, so a query of
+	 * all the hobbies costs about the shortest list, not the sum of them.
+	 */
+	SharedUserList searchUserByHobbies(const std::set<std::string> &hobbies, size_t atLeast) const;
+	/** Users matching all the predicates of @query (all users for an empty one)
+	 * @see planQuery
+	 */
+	SharedUserList searchUsers(const UserQuery &query) const;
 	/** Return user friends by ID
 	 *
 	 * @note This one is little bit tricky as there is unclear how to decide who are User's friends. I suppose this is meant
@@ -134,58 +211,98 @@ public:
 	std::set<ID> getFriendsOfUser(const User &user) const { return getFriendsOfUser(user.id()); } // Convenience / overloaded method
 	/* @} */
 
-private:
-	typedef std::multimap<std::string, ID> StringIdMap;
-	typedef std::multimap<uint8_t, ID> Uint8IdMap;
-
-	/** helper method to remove all @map items related to @id */
-	template<typename Map, typename Value>
-	static void removeMapItems(Map &map, const Value &value, const ID &id)
+	/** How searchUsers gets the candidates of a query */
+	struct QueryPlan
 	{
-		auto range = map.equal_range(value);
-		if (range.first != map.end()) {
-			for (auto it = range.first; it != range.second; ) {
-				auto id_ = it->second;
-				if (id_ == id) {
-					it = map.erase(it);
-				} else {
-					it++;
-				}
-			}
-		}
-	}
+		enum Access {
+			Scan,    ///< all the users
+			Name,    ///< the name list
+			Age,     ///< the age lists of the range
+			Hobbies, ///< users having enough of the hobbies
+		};
+		Access access;
+		size_t estimate; ///< candidates the access path reads
+	};
+	/** Pick the cheapest access path of @query
+	 *
+	 * Cardinalities come from the indexes themselves (sizes of the name, age and hobby lists), a scan costs
+	 * a quarter of an indexed candidate as it reads the attribute columns sequentially. All the other predicates
+	 * are checked on the candidates only: ages, heights and genders in the columns, names and hobbies by probing
+	 * their sorted lists.
+	 */
+	QueryPlan planQuery(const UserQuery &query) const;
 
-	/** Helper method to get all users for a @map related to @value */
-	template<typename Map, typename Value>
-	SharedUserList searchUser(const Map &map, const Value &value) const
-	{
-		auto range = map.equal_range(value);
+	/** Traversals of the friendship graph (friends as returned by getFriendsOfUser)
+	 *
+	 * @note Unlike getFriendsOfUser these walk through and return added users only, IDs which are just someone's
+	 * friend are not reached.
+	 * @throw std::invalid_argument for a not existing user/ID
+	 *
+	 * @{
+	 */
+	/** Users up to @hops friendships away from @id (not @id itself), at most @limit of them (the closest ones) */
+	std::set<ID> getFriendsWithinHops(const ID &id, unsigned hops, size_t limit = SIZE_MAX) const;
+	/** Friendships on the shortest path between the users, -1 if there is none up to @maxHops */
+	int degreesOfSeparation(const ID &from, const ID &to, unsigned maxHops = UINT_MAX) const;
+	/** Friends both users have (as getFriendsOfUser, so also IDs not added as users) */
+	std::set<ID> getMutualFriends(const ID &a, const ID &b) const;
+	/** Friends of friends who are not friends of @id yet, with the number of their mutual friends
+	 * @return Most mutual friends first (ties by ID), at most @limit of them
+	 */
+	std::vector<std::pair<ID, size_t>> peopleYouMayKnow(const ID &id, size_t limit = 10) const;
+	/* @} */
 
-		if (range.first == map.end()) {
-			return SocialNetwork::SharedUserList(); // no record
-		}
+private:
+	typedef std::vector<UserIndex> UserIndexList; ///< sorted
+	typedef std::unordered_map<std::string, UserIndexList> StringIndexMap;
 
-		SocialNetwork::SharedUserList list;
+	/** Dense index of @id, a new (or a free) one is assigned to an unknown ID */
+	UserIndex indexOf(const ID &id);
+	/** Put @index to the free list if it is neither a user nor has any edge */
+	void releaseIndex(UserIndex index);
+	/** Dense index of the added user @id
+	 * @throw std::invalid_argument There is no such user
+	 */
+	UserIndex userIndex(const ID &id) const;
 
-		for (auto it = range.first; it != range.second; ++it) {
-			auto id = it->second;
-			auto uIt = m_users.find(id);
-			list.push_back(uIt->second);
-		}
+	static void insertIndex(UserIndexList &list, UserIndex index);
+	static void eraseIndex(UserIndexList &list, UserIndex index);
+	/** Remove @index from the @key list, the list too once empty */
+	static void eraseIndex(StringIndexMap &map, const std::string &key, UserIndex index);
 
-		return list;
+	/** Helper method to get all users for a @map related to @key */
+	SharedUserList searchUser(const StringIndexMap &map, const std::string &key) const
+	{
+		auto it = map.find(key);
+		if (it == map.end()) {
+			return SocialNetwork::SharedUserList(); // no record
+		}
+		return usersOf(it->second);
 	}
+	SharedUserList usersOf(const UserIndexList &list) const;
+	/** Sorted indexes present in at least @atLeast of @lists */
+	static UserIndexList matchAtLeast(std::vector<const UserIndexList*> lists, size_t atLeast);
+	/** Added users only (see traversals) */
+	bool isUser(UserIndex index) const { return m_users[index] != nullptr; }
 
 private:
-	/** Map of all users (by ID key)
-	 * We could have it also as a 'map<ID, shared_ptr<User>>>' if the number of user is really huge, so we can expect also
-	 * big mem overhead for 'searchUserBy...' methods returning neither user IDs nor shared_ptr<User> but User.
+	std::unordered_map<ID, UserIndex> m_indexes; // ID -> dense index
+	std::vector<ID> m_ids;                        // dense index -> ID (empty for the free indexes)
+	std::vector<UserIndex> m_freeIndexes;
+	/** Users by dense index (nullptr for deleted users and the IDs known as friends only)
+	 * Lookups return the shared_ptr so no User is copied for 'searchUserBy...' methods.
 	 */
-	std::map<ID, std::shared_ptr<User>> m_users; // Note: ID is also part of User - if ID is not too big we do not care much about this overhead
+	std::vector<std::shared_ptr<User>> m_users;
+	int m_userCount = 0;
+	// Attribute columns by dense index for the query filters (valid for the added users only)
+	std::vector<uint8_t> m_ages;
+	std::vector<uint8_t> m_heights;
+	std::vector<Gender> m_genders;
 
-	// Helper maps for faster lookup into 'm_users' by name, age, ...
-	StringIdMap m_nameIdMap;
-	Uint8IdMap m_ageIdMap;
-	StringIdMap m_hobbiesMap;
-	std::multimap<ID, ID> m_friendsMap;
+	// Helper indexes for faster lookup into 'm_users' by name, age, ...
+	StringIndexMap m_nameIndex;
+	std::array<UserIndexList, 256> m_ageIndex;
+	StringIndexMap m_hobbiesIndex;
+	/** An edge for every friend a user has set (so both directions of User::friends) */
+	FriendGraph m_friends;
 };
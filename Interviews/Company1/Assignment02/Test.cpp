@@ -1,7 +1,14 @@
 #include "Test.h"
+#include "GraphAnalytics.h"
 #include "SocialNetwork.h"
+#include "WorkStealingPool.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <climits>
+#include <cmath>
+#include <functional>
 
 namespace {
 
@@ -212,7 +219,7 @@ void testSearchUserByHobbies()
 
 		assert(sn.userCount() == 5);
 
-		auto users = sn.searchUserByHobbies({"Reading", "Jogging"});
+		auto users = sn.searchUserByHobbies({"Reading", "Jogging"}, SocialNetwork::Match::Any);
 
 		assert(users.size() == 3); // Three users: user1, user2 and user4
 
@@ -221,6 +228,14 @@ void testSearchUserByHobbies()
 				|| user->hobbies().count("Jogging") > 0
 			);
 		}
+
+		assert(sn.searchUserByHobbies({"Reading", "Jogging"}).empty()); // nobody has both
+		users = sn.searchUserByHobbies({"Astronomy", "Reading"});
+		assert(users.size() == 1 && users.front()->id() == "id-004");
+		assert(sn.searchUserByHobbies({"Jogging"}).size() == 2);
+		assert(sn.searchUserByHobbies({"Jogging", "Chess"}).empty());
+		assert(sn.searchUserByHobbies({}).empty());
+		assert(sn.searchUserByHobbies({"Jogging", "Chess"}, SocialNetwork::Match::Any).size() == 2);
 	}
 	catch (const std::exception& e) {
 		std::cerr << "Exception caught: " << e.what() <<std::endl;
@@ -228,6 +243,155 @@ void testSearchUserByHobbies()
 	}
 }
 
+void testSearchUserByHobbies_atLeast()
+{
+	// Compared to counting the hobbies of every user
+	SocialNetwork sn;
+	const int n = 500;
+	uint32_t seed = 3;
+	for (int i = 0; i < n; i++) {
+		User user("id-" + std::to_string(i), "Name");
+		std::set<std::string> hobbies;
+		for (int h = 0; h < 6; h++) {
+			seed = seed * 1103515245 + 12345;
+			hobbies.insert("hobby " + std::to_string((seed >> 8) % (2 + h * 3))); // hobby 0 and 1 are common
+		}
+		user.setHobbies(hobbies);
+		sn.addUser(user);
+	}
+	sn.deleteUser("id-7");
+
+	const std::set<std::string> query = {"hobby 0", "hobby 1", "hobby 5", "hobby 9", "hobby 99"};
+	for (size_t k = 0; k <= query.size() + 1; k++) {
+		auto users = sn.searchUserByHobbies(query, k);
+		size_t expected = 0;
+		for (int i = 0; i < n; i++) {
+			if (i == 7) {
+				continue;
+			}
+			auto hobbies = sn.getUser("id-" + std::to_string(i)).hobbies();
+			size_t count = 0;
+			for (auto const &h : query) {
+				count += hobbies.count(h);
+			}
+			expected += count >= std::max<size_t>(k, 1);
+		}
+		assert(users.size() == expected);
+		for (auto const &user : users) {
+			size_t count = 0;
+			for (auto const &h : query) {
+				count += user->hobbies().count(h);
+			}
+			assert(count >= std::max<size_t>(k, 1));
+		}
+	}
+	assert(sn.searchUserByHobbies(query).empty()); // nobody has "hobby 99"
+	assert(sn.searchUserByHobbies(query, 1).size() == sn.searchUserByHobbies(query, SocialNetwork::Match::Any).size());
+}
+
+void testSearchUsers()
+{
+	SocialNetwork sn;
+	const int n = 2000;
+	uint32_t seed = 11;
+	auto next = [&seed]() {
+		seed = seed * 1103515245 + 12345;
+		return seed >> 8;
+	};
+	for (int i = 0; i < n; i++) {
+		User user("id-" + std::to_string(i), "Name " + std::to_string(next() % 50));
+		if (i % 10 != 0) { // some users do not provide them
+			user.setAge(static_cast<uint8_t>(1 + next() % 80));
+			user.setHeight(static_cast<uint8_t>(150 + next() % 50));
+			user.setGenderu(next() % 2 ? Gender::male : Gender::female);
+		}
+		std::set<std::string> hobbies;
+		for (int h = 0; h < 3; h++) {
+			hobbies.insert("hobby " + std::to_string(next() % (h == 0 ? 3 : 40)));
+		}
+		user.setHobbies(hobbies);
+		sn.addUser(user);
+	}
+	sn.deleteUser("id-1");
+	User unknown("id-x", "Name 1");
+	assert(unknown.age() == 0 && unknown.height() == 0 && unknown.gender() == Gender::unknown);
+
+	// Compared to checking every user
+	auto check = [&](const UserQuery &query, std::function<bool(const User&)> matches) {
+		size_t expected = 0;
+		for (int i = 0; i < n; i++) {
+			if (i != 1) {
+				expected += matches(sn.getUser("id-" + std::to_string(i)));
+			}
+		}
+		auto users = sn.searchUsers(query);
+		assert(users.size() == expected);
+		for (auto const &user : users) {
+			assert(matches(*user));
+		}
+	};
+
+	UserQuery all;
+	assert(sn.planQuery(all).access == SocialNetwork::QueryPlan::Scan);
+	check(all, [](const User&) { return true; });
+
+	UserQuery byName;
+	byName.setName("Name 7");
+	byName.setAgeRange(20, 60);
+	byName.setGender(Gender::female);
+	assert(sn.planQuery(byName).access == SocialNetwork::QueryPlan::Name);
+	check(byName, [](const User &u) { return u.name() == "Name 7" && u.age() >= 20 && u.age() <= 60 && u.gender() == Gender::female; });
+
+	UserQuery byAge;
+	byAge.setAgeRange(30, 30);
+	byAge.setHeightRange(160, 180);
+	byAge.setHobbies({"hobby 0", "hobby 1", "hobby 2"}, 1); // common ones
+	assert(sn.planQuery(byAge).access == SocialNetwork::QueryPlan::Age);
+	check(byAge, [](const User &u) {
+		auto h = u.hobbies();
+		return u.age() == 30 && u.height() >= 160 && u.height() <= 180 && (h.count("hobby 0") || h.count("hobby 1") || h.count("hobby 2"));
+	});
+
+	UserQuery byHobbies;
+	byHobbies.setHobbies({"hobby 0", "hobby 17"});
+	byHobbies.setName("Name 3");
+	byHobbies.setHeightRange(0, 255);
+	auto plan = sn.planQuery(byHobbies);
+	assert(plan.access == SocialNetwork::QueryPlan::Hobbies || plan.access == SocialNetwork::QueryPlan::Name);
+	check(byHobbies, [](const User &u) {
+		return u.name() == "Name 3" && u.height() != 0 && u.hobbies().count("hobby 0") && u.hobbies().count("hobby 17");
+	});
+
+	UserQuery rare;
+	rare.setHobbies({"hobby 0", "hobby 39"});
+	rare.setGender(Gender::male);
+	plan = sn.planQuery(rare);
+	assert(plan.access == SocialNetwork::QueryPlan::Hobbies);
+	assert(plan.estimate == sn.searchUserByHobbies({"hobby 39"}).size());
+	check(rare, [](const User &u) { return u.gender() == Gender::male && u.hobbies().count("hobby 0") && u.hobbies().count("hobby 39"); });
+
+	UserQuery byGender;
+	byGender.setGender(Gender::male);
+	byGender.setAgeRange(1, 255);
+	assert(sn.planQuery(byGender).access == SocialNetwork::QueryPlan::Scan);
+	check(byGender, [](const User &u) { return u.gender() == Gender::male && u.age() != 0; });
+
+	UserQuery nobody;
+	nobody.setName("Nobody");
+	nobody.setAgeRange(1, 100);
+	assert(sn.planQuery(nobody).access == SocialNetwork::QueryPlan::Name);
+	assert(sn.planQuery(nobody).estimate == 0);
+	assert(sn.searchUsers(nobody).empty());
+
+	try {
+		UserQuery invalid;
+		invalid.setAgeRange(50, 20);
+		assert(0);
+	}
+	catch (const std::invalid_argument&) {
+	}
+}
+
 void testSearchUserByFriends()
 {
 	try {
@@ -266,6 +430,374 @@ void testSearchUserByFriends()
 	}
 }
 
+void testFriendGraph()
+{
+	FriendGraph graph;
+	graph.addEdge(0, 1);
+	graph.addEdge(1, 0); // declared by both users
+	graph.addEdge(0, 2);
+	assert(graph.neighbors(0) == std::vector<UserIndex>({1, 2}));
+	assert(graph.neighbors(1) == std::vector<UserIndex>({0}));
+	assert(graph.neighbors(7).empty());
+
+	graph.removeEdge(0, 1);
+	assert(graph.neighbors(1) == std::vector<UserIndex>({0})); // still declared once
+	graph.compact();
+	assert(graph.deltaSize() == 0);
+	assert(graph.neighbors(0) == std::vector<UserIndex>({1, 2}));
+	graph.removeEdge(1, 0);
+	assert(graph.neighbors(0) == std::vector<UserIndex>({2}));
+	assert(graph.neighbors(1).empty());
+
+	// Enough mutations to get compacted on their own, delta and CSR have to agree
+	for (UserIndex u = 0; u < 2000; u++) {
+		graph.addEdge(u, (u * 7) % 2000);
+	}
+	assert(graph.deltaSize() < graph.size());
+	for (UserIndex u = 0; u < 2000; u += 2) {
+		graph.removeEdge(u, (u * 7) % 2000);
+	}
+	for (UserIndex u = 3; u < 2000; u += 2) {
+		auto n = graph.neighbors(u);
+		assert(std::find(n.begin(), n.end(), (u * 7) % 2000) != n.end());
+	}
+	auto n = graph.neighbors(1000);
+	assert(std::find(n.begin(), n.end(), 0) == n.end()); // 1000 * 7 % 2000 == 0, removed
+}
+
+void testSearchUserByFriends_deleted()
+{
+	SocialNetwork sn;
+
+	User user1("id-001", "John");
+	user1.setFriends({"id-002", "id-003"});
+	sn.addUser(user1);
+
+	User user2("id-002", "Paul");
+	user2.setFriends({"id-001"});
+	sn.addUser(user2);
+
+	assert(sn.getFriendsOfUser("id-002") == std::set<std::string>({"id-001"}));
+
+	sn.deleteUser(user1);
+	assert(sn.getFriendsOfUser("id-002") == std::set<std::string>({"id-001"})); // user2 still has the friend set
+	try {
+		sn.getFriendsOfUser("id-003"); // a friend only, never added
+		assert(0);
+	}
+	catch (const std::invalid_argument&) {
+	}
+
+	User user3("id-003", "Anna");
+	sn.addUser(user3);
+	assert(sn.getFriendsOfUser(user3).empty()); // user1 is gone
+
+	sn.addUser(user1); // re-added with the same ID
+	assert(sn.getFriendsOfUser(user3) == std::set<std::string>({"id-001"}));
+	assert(sn.getFriendsOfUser(user1) == std::set<std::string>({"id-002", "id-003"}));
+	assert(sn.userCount() == 3);
+}
+
+void testDeleteUser_churn()
+{
+	SocialNetwork sn;
+	User stable("stable", "Stable");
+	stable.setFriends({"member-0"});
+	sn.addUser(stable);
+
+	// Every round adds users with new IDs (and friends known by ID only) and deletes them again
+	size_t capacity = 0;
+	for (int round = 0; round < 100; round++) {
+		std::vector<ID> ids;
+		for (int i = 0; i < 50; i++) {
+			auto id = "user-" + std::to_string(round) + "-" + std::to_string(i);
+			User user(id, "Name " + std::to_string(i));
+			user.setAge(static_cast<uint8_t>(20 + i));
+			user.setHobbies({"hobby " + std::to_string(i % 5)});
+			user.setFriends({"stable", "friend-" + std::to_string(round) + "-" + std::to_string(i)});
+			sn.addUser(user);
+			ids.push_back(id);
+		}
+		sn.addUser(User("member-0", "Member"));
+		assert(sn.getFriendsOfUser("stable").size() == 51);
+		for (auto const &id : ids) {
+			sn.deleteUser(id);
+		}
+		sn.deleteUser("member-0"); // still referred to by "stable"
+		assert(sn.userCount() == 1);
+		assert(sn.getFriendsOfUser("stable") == std::set<std::string>({"member-0"}));
+		if (round == 0) {
+			capacity = sn.indexCapacity();
+		}
+	}
+	assert(capacity == 102);
+	assert(sn.indexCapacity() == capacity); // the free indexes got reused
+	assert(sn.searchUserByName("Name 1").empty());
+	assert(sn.searchUserByHobbies({"hobby 1"}).empty());
+
+	// A reused index starts from scratch
+	User user("new", "New");
+	sn.addUser(user);
+	assert(sn.getFriendsOfUser(user).empty());
+	assert(sn.searchUserByName("New").size() == 1);
+	sn.addUser(User("member-0", "Member"));
+	assert(sn.getFriendsOfUser("member-0") == std::set<std::string>({"stable"}));
+	assert(sn.indexCapacity() == capacity);
+}
+
+void testFriendGraph_bfs()
+{
+	// Dense enough for the bottom-up levels, compared to a plain queue based BFS
+	const UserIndex n = 3000;
+	FriendGraph graph;
+	uint32_t seed = 1;
+	for (UserIndex u = 0; u < n; u++) {
+		for (int e = 0; e < 8; e++) {
+			seed = seed * 1103515245 + 12345;
+			graph.addEdge(u, (seed >> 8) % n);
+		}
+	}
+	auto filter = [](UserIndex v) { return v % 10 != 3; };
+
+	std::vector<int> expected(n, -1);
+	std::vector<UserIndex> queue = {5};
+	expected[5] = 0;
+	for (size_t i = 0; i < queue.size(); i++) {
+		for (auto v : graph.neighbors(queue[i])) {
+			if (expected[v] < 0 && filter(v)) {
+				expected[v] = expected[queue[i]] + 1;
+				queue.push_back(v);
+			}
+		}
+	}
+
+	std::vector<int> depths(n, -1);
+	unsigned last = 0;
+	graph.bfs({5}, UINT_MAX, filter, [&](UserIndex v, unsigned depth) {
+		assert(depths[v] < 0);
+		assert(depth >= last);
+		depths[v] = static_cast<int>(depth);
+		last = depth;
+		return true;
+	});
+	assert(depths == expected);
+	for (UserIndex t = 0; t < n; t += 7) {
+		if (filter(t)) {
+			assert(graph.distance(5, t, UINT_MAX, filter) == expected[t]);
+			assert(graph.distance(t, 5, UINT_MAX, filter) == expected[t]);
+		}
+	}
+	assert(graph.distance(5, 6, 0, filter) == -1);
+
+	size_t visited = 0;
+	graph.bfs({5}, 1, filter, [&](UserIndex, unsigned) { return ++visited < 3; });
+	assert(visited == 3);
+}
+
+void testTraversals()
+{
+	// 1 - 2 - 3 - 4   5 (alone)
+	//  \ /
+	//   6 ---- 7
+	SocialNetwork sn;
+	User user1("id-1", "A");
+	user1.setFriends({"id-2", "id-6"});
+	sn.addUser(user1);
+	User user2("id-2", "B");
+	user2.setFriends({"id-3", "id-6"});
+	sn.addUser(user2);
+	User user3("id-3", "C");
+	user3.setFriends({"id-4", "id-9"}); // id-9 is never added
+	sn.addUser(user3);
+	sn.addUser(User("id-4", "D"));
+	sn.addUser(User("id-5", "E"));
+	User user6("id-6", "F");
+	user6.setFriends({"id-7"});
+	sn.addUser(user6);
+	User user7("id-7", "G");
+	user7.setFriends({"id-6", "id-3"});
+	sn.addUser(user7);
+
+	assert(sn.getFriendsWithinHops("id-1", 1) == std::set<std::string>({"id-2", "id-6"}));
+	assert(sn.getFriendsWithinHops("id-1", 2) == std::set<std::string>({"id-2", "id-3", "id-6", "id-7"}));
+	assert(sn.getFriendsWithinHops("id-1", 10) == std::set<std::string>({"id-2", "id-3", "id-4", "id-6", "id-7"}));
+	assert(sn.getFriendsWithinHops("id-1", 10, 2).size() == 2);
+	assert(sn.getFriendsWithinHops("id-5", 3).empty());
+	assert(sn.getFriendsOfUser("id-3").count("id-9") == 1);
+	assert(sn.getFriendsWithinHops("id-3", 1).count("id-9") == 0);
+
+	assert(sn.degreesOfSeparation("id-1", "id-1") == 0);
+	assert(sn.degreesOfSeparation("id-1", "id-7") == 2);
+	assert(sn.degreesOfSeparation("id-1", "id-4") == 3);
+	assert(sn.degreesOfSeparation("id-1", "id-4", 2) == -1);
+	assert(sn.degreesOfSeparation("id-1", "id-5") == -1);
+
+	assert(sn.getMutualFriends("id-1", "id-2") == std::set<std::string>({"id-6"}));
+	assert(sn.getMutualFriends("id-1", "id-3") == std::set<std::string>({"id-2"}));
+	assert(sn.getMutualFriends("id-2", "id-7") == std::set<std::string>({"id-3", "id-6"}));
+	assert(sn.getMutualFriends("id-1", "id-5").empty());
+
+	auto pymk = sn.peopleYouMayKnow("id-1");
+	assert(pymk.size() == 2);
+	assert(pymk[0] == std::make_pair(std::string("id-3"), size_t(1))); // ties by ID
+	assert(pymk[1] == std::make_pair(std::string("id-7"), size_t(1)));
+	pymk = sn.peopleYouMayKnow("id-6");
+	assert(pymk.size() == 1);
+	assert(pymk[0] == std::make_pair(std::string("id-3"), size_t(2))); // through id-2 and id-7
+	assert(sn.peopleYouMayKnow("id-4", 0).empty());
+
+	sn.deleteUser("id-2");
+	assert(sn.degreesOfSeparation("id-1", "id-4") == 4); // 1 - 6 - 7 - 3 - 4
+	try {
+		sn.degreesOfSeparation("id-1", "id-2");
+		assert(0);
+	}
+	catch (const std::invalid_argument&) {
+	}
+}
+
+void testWorkStealingPool()
+{
+	WorkStealingPool pool(4);
+	assert(pool.size() == 4);
+
+	// Skewed items: all of them done exactly once
+	const size_t n = 10000;
+	std::vector<std::atomic<int>> done(n);
+	std::atomic<uint64_t> sum{0};
+	pool.parallelFor(n, 16, [&](size_t begin, size_t end, unsigned worker) {
+		assert(worker < 4);
+		for (auto i = begin; i < end; i++) {
+			done[i]++;
+			volatile uint64_t spin = 0;
+			for (size_t k = 0; k < (i < 100 ? 10000 : 10); k++) {
+				spin = spin + k;
+			}
+			sum += i;
+		}
+	});
+	for (auto const &d : done) {
+		assert(d == 1);
+	}
+	assert(sum == n * (n - 1) / 2);
+
+	pool.parallelFor(0, 1, [](size_t, size_t, unsigned) { assert(0); });
+	try {
+		pool.parallelFor(n, 1, [](size_t begin, size_t, unsigned) {
+			if (begin == 5000) {
+				throw std::runtime_error("failed");
+			}
+		});
+		assert(0);
+	}
+	catch (const std::runtime_error&) {
+	}
+	sum = 0;
+	pool.parallelFor(100, 1, [&](size_t begin, size_t end, unsigned) { sum += end - begin; }); // usable again
+	assert(sum == 100);
+}
+
+void testGraphAnalytics()
+{
+	// Triangles 1-2-3 and 2-3-4 (sharing 2-3), a separate pair 5-6, 7 alone, 8 is a friend only
+	SocialNetwork sn;
+	User user1("id-1", "A");
+	user1.setFriends({"id-2", "id-3", "id-8"});
+	sn.addUser(user1);
+	User user2("id-2", "B");
+	user2.setFriends({"id-1", "id-3", "id-4"}); // 1-2 twice
+	sn.addUser(user2);
+	User user3("id-3", "C");
+	user3.setFriends({"id-4", "id-3"}); // self loop
+	sn.addUser(user3);
+	sn.addUser(User("id-4", "D"));
+	User user5("id-5", "E");
+	user5.setFriends({"id-6"});
+	sn.addUser(user5);
+	sn.addUser(User("id-6", "F"));
+	sn.addUser(User("id-7", "G"));
+	User user9("id-9", "H");
+	user9.setFriends({"id-7"});
+	sn.addUser(user9);
+	sn.deleteUser(user9);
+
+	WorkStealingPool pool(3);
+	GraphAnalytics analytics(sn, pool);
+	assert(analytics.vertexCount() == 7);
+	assert(analytics.edgeCount() == 6);
+	assert(analytics.id(0) == "id-1");
+
+	auto components = analytics.connectedComponents();
+	assert(components == std::vector<GraphAnalytics::Vertex>({0, 0, 0, 0, 4, 4, 6}));
+
+	auto degrees = analytics.degreeDistribution();
+	assert(degrees == std::vector<uint64_t>({1, 2, 2, 2})); // 7; 5, 6; 1, 4; 2, 3
+
+	assert(analytics.triangleCount() == 2);
+
+	auto rank = analytics.pageRank();
+	double total = 0;
+	for (auto r : rank) {
+		total += r;
+	}
+	assert(std::fabs(total - 1.0) < 1e-6);
+	assert(std::fabs(rank[1] - rank[2]) < 1e-9); // symmetric
+	assert(std::fabs(rank[4] - rank[5]) < 1e-9);
+	assert(rank[1] > rank[0] && rank[1] > rank[3]); // more friends in the same component
+}
+
+void testGraphAnalytics_random()
+{
+	// Compared to the serial answers
+	SocialNetwork sn;
+	const int n = 400;
+	uint32_t seed = 7;
+	std::vector<std::set<int>> adjacency(n);
+	for (int i = 0; i < n; i++) {
+		User user("u" + std::to_string(1000 + i), "Name");
+		std::set<std::string> friends;
+		for (int e = 0; e < 3; e++) {
+			seed = seed * 1103515245 + 12345;
+			int f = (seed >> 8) % (i < 200 ? 200 : n); // two halves connected through the second one only
+			friends.insert("u" + std::to_string(1000 + f));
+			if (f != i) {
+				adjacency[i].insert(f);
+				adjacency[f].insert(i);
+			}
+		}
+		user.setFriends(friends);
+		sn.addUser(user);
+	}
+
+	WorkStealingPool pool(4);
+	GraphAnalytics analytics(sn, pool);
+	assert(analytics.vertexCount() == n);
+	uint64_t triangles = 0;
+	std::vector<uint64_t> degrees;
+	for (int a = 0; a < n; a++) {
+		if (adjacency[a].size() >= degrees.size()) {
+			degrees.resize(adjacency[a].size() + 1);
+		}
+		degrees[adjacency[a].size()]++;
+		for (auto b : adjacency[a]) {
+			for (auto c : adjacency[b]) {
+				triangles += a < b && b < c && adjacency[a].count(c);
+			}
+		}
+	}
+	assert(analytics.triangleCount() == triangles);
+	assert(analytics.degreeDistribution() == degrees);
+
+	auto components = analytics.connectedComponents();
+	for (int a = 0; a < n; a++) {
+		for (auto b : adjacency[a]) {
+			assert(components[a] == components[b]);
+		}
+		assert(components[a] <= static_cast<GraphAnalytics::Vertex>(a));
+		assert(components[components[a]] == components[a]);
+	}
+}
+
 } // anonymous ns
 
 void test()
@@ -284,7 +816,17 @@ void test()
 	testSearchUserByName();
 	testSearchUserByAge();
 	testSearchUserByHobbies();
+	testSearchUserByHobbies_atLeast();
+	testSearchUsers();
 	testSearchUserByFriends();
+	testSearchUserByFriends_deleted();
+	testDeleteUser_churn();
+	testFriendGraph();
+	testFriendGraph_bfs();
+	testTraversals();
+	testWorkStealingPool();
+	testGraphAnalytics();
+	testGraphAnalytics_random();
 	std::cout << "All tests passed." << std::endl;
 }
 
@@ -0,0 +1,163 @@
+#include "WorkStealingPool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+
+WorkStealingPool::WorkStealingPool(unsigned threads)
+{
+	if (threads == 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	m_size = threads;
+	void *memory = nullptr;
+	if (::posix_memalign(&memory, alignof(Range), sizeof(Range) * threads) != 0) {
+		throw std::bad_alloc();
+	}
+	m_ranges = static_cast<Range*>(memory);
+	for (unsigned i = 0; i < threads; i++) {
+		new (&m_ranges[i]) Range();
+	}
+	// Worker 0 is the thread calling parallelFor
+	for (unsigned i = 1; i < threads; i++) {
+		m_threads.emplace_back(&WorkStealingPool::run, this, i);
+	}
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_cv.notify_all();
+	for (auto &t : m_threads) {
+		t.join();
+	}
+	for (unsigned i = 0; i < m_size; i++) {
+		m_ranges[i].~Range();
+	}
+	std::free(m_ranges);
+}
+
+void WorkStealingPool::parallelFor(size_t n, size_t grain, const Body &body)
+{
+	if (n == 0) {
+		return;
+	}
+	std::lock_guard<std::mutex> call(m_callMutex);
+	for (unsigned i = 0; i < m_size; i++) {
+		std::lock_guard<std::mutex> lock(m_ranges[i].mutex);
+		m_ranges[i].begin = n * i / m_size;
+		m_ranges[i].end = n * (i + 1) / m_size;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_body = &body;
+		m_grain = std::max<size_t>(1, grain);
+		m_running = m_size - 1;
+		m_failed = false;
+		m_error = nullptr;
+		m_generation++;
+	}
+	m_cv.notify_all();
+
+	work(0);
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_doneCv.wait(lock, [this]() { return m_running == 0; });
+	m_body = nullptr;
+	if (m_error) {
+		auto error = m_error;
+		m_error = nullptr;
+		std::rethrow_exception(error);
+	}
+}
+
+void WorkStealingPool::run(unsigned worker)
+{
+	uint64_t seen = 0;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cv.wait(lock, [this, seen]() { return m_stop || m_generation != seen; });
+			if (m_stop) {
+				return;
+			}
+			seen = m_generation;
+		}
+		work(worker);
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (--m_running == 0) {
+			m_doneCv.notify_all();
+		}
+	}
+}
+
+void WorkStealingPool::work(unsigned worker)
+{
+	auto &own = m_ranges[worker];
+	while (!m_failed.load(std::memory_order_relaxed)) {
+		size_t begin, end;
+		{
+			std::lock_guard<std::mutex> lock(own.mutex);
+			begin = own.begin;
+			end = std::min(own.end, begin + m_grain);
+			own.begin = end;
+		}
+		if (begin == end) {
+			if (!steal(worker)) {
+				return;
+			}
+			continue;
+		}
+		try {
+			(*m_body)(begin, end, worker);
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!m_error) {
+				m_error = std::current_exception();
+			}
+			m_failed = true;
+		}
+	}
+}
+
+bool WorkStealingPool::steal(unsigned worker)
+{
+	for (;;) {
+		// Note: a size may change right after it is read, the victim is checked again below
+		unsigned victim = worker;
+		size_t largest = 0;
+		for (unsigned i = 0; i < m_size; i++) {
+			std::lock_guard<std::mutex> lock(m_ranges[i].mutex);
+			auto left = m_ranges[i].end - m_ranges[i].begin;
+			if (i != worker && left > largest) {
+				largest = left;
+				victim = i;
+			}
+		}
+		if (largest == 0) {
+			return false;
+		}
+
+		size_t begin, end;
+		{
+			std::lock_guard<std::mutex> lock(m_ranges[victim].mutex);
+			auto &r = m_ranges[victim];
+			if (r.begin == r.end) {
+				continue; // taken meanwhile, look again
+			}
+			// Leave the victim its next chunk, a single chunk is taken whole
+			end = r.end;
+			begin = r.end - r.begin <= m_grain ? r.begin : r.begin + (r.end - r.begin) / 2;
+			r.end = begin;
+		}
+		std::lock_guard<std::mutex> lock(m_ranges[worker].mutex);
+		m_ranges[worker].begin = begin;
+		m_ranges[worker].end = end;
+		return true;
+	}
+}
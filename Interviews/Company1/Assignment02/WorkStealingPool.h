@@ -0,0 +1,73 @@
+#pragma once
+
+// Martin Flaska - flegy@flegy.sk / https://www.linkedin.com/in/martinflaska
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/** Worker threads running data parallel loops with range stealing
+ *
+ * Every worker starts on its own contiguous part of the index range and takes it from the front in chunks, so
+ * the items it touches stay in order (cache and prefetch friendly). A worker done with its part steals the back
+ * half of the largest part left, which balances skewed work (e.g. high degree vertices) without a shared queue.
+ *
+ * @note Loops must not be nested (a loop body must not call parallelFor of the same pool).
+ */
+class WorkStealingPool
+{
+public:
+	/** Loop body: items [begin, end), worker index in [0, size()) */
+	typedef std::function<void(size_t, size_t, unsigned)> Body;
+
+	/** @param threads Number of workers including the calling thread, 0 means std::thread::hardware_concurrency() */
+	explicit WorkStealingPool(unsigned threads = 0);
+	~WorkStealingPool();
+
+	WorkStealingPool(const WorkStealingPool &) = delete;
+	WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+	unsigned size() const { return m_size; }
+
+	/** Run @body over [0, @n) in chunks of @grain items, blocks until all of them are done
+	 * @throw Rethrows the first exception of @body (the remaining chunks are skipped)
+	 */
+	void parallelFor(size_t n, size_t grain, const Body &body);
+
+private:
+	struct alignas(64) Range
+	{
+		std::mutex mutex;
+		size_t begin = 0;
+		size_t end = 0;
+	};
+
+	void run(unsigned worker);
+	void work(unsigned worker);
+	/** Move the back half of the largest range to @worker's range, false if there is nothing left */
+	bool steal(unsigned worker);
+
+private:
+	unsigned m_size;
+	std::vector<std::thread> m_threads;
+	Range *m_ranges; ///< one per worker, on their own cache lines (operator new of C++14 ignores alignas)
+
+	std::mutex m_callMutex; // one loop at a time
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::condition_variable m_doneCv;
+	const Body *m_body = nullptr;
+	size_t m_grain = 1;
+	uint64_t m_generation = 0;
+	unsigned m_running = 0;
+	bool m_stop = false;
+	std::atomic<bool> m_failed{false};
+	std::exception_ptr m_error;
+};